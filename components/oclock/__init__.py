@@ -1,9 +1,9 @@
 import imp
-from esphome.const import CONF_BAUD_RATE, CONF_BLUE, CONF_BRIGHTNESS, CONF_DISABLED_BY_DEFAULT, CONF_GREEN, CONF_ID, CONF_INITIAL_VALUE, CONF_LIGHT, CONF_LOGGER, CONF_MAX_VALUE, CONF_MIN_VALUE, CONF_NAME, CONF_RED, CONF_STEP, CONF_TYPE, CONF_WHILE
+from esphome.const import CONF_BAUD_RATE, CONF_BLUE, CONF_BRIGHTNESS, CONF_DISABLED_BY_DEFAULT, CONF_FORCE_UPDATE, CONF_GREEN, CONF_ID, CONF_INITIAL_VALUE, CONF_LIGHT, CONF_LOGGER, CONF_MAX_VALUE, CONF_MIN_VALUE, CONF_NAME, CONF_RED, CONF_STEP, CONF_TYPE, CONF_WHILE
 from esphome.core import CORE
 from esphome import core
 from esphome.voluptuous_schema import _Schema
-from esphome.components import time, switch, number, output, select, text_sensor, light
+from esphome.components import time, switch, sensor, number, output, select, text_sensor, light
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.cpp_generator import Pvariable
@@ -21,6 +21,7 @@ AUTO_LOAD = [
     "time",
     "number",
     "switch",
+    "sensor",
     "output",
 ]
 
@@ -116,8 +117,14 @@ CONFIG_SCHEMA = _Schema(
         cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
         cv.Optional(CONF_COUNT_START, -1): cv.int_range(min=-1, max=64),
         cv.Optional('baud_rate', 1200): cv.int_range(min=1200),
+        cv.Optional('tx_budget', 2000): cv.int_range(min=100, max=20000),
+        cv.Optional('reliable', False): cv.boolean,
+        cv.Optional('baud_probe', False): cv.boolean,
+        cv.Optional('slotted_responses', False): cv.boolean,
         cv.Optional('turn_speed', 4): cv.int_range(min=0, max=8),
         cv.Optional('turn_steps', 10): cv.int_range(min=0, max=90),
+        # in revs per minute per second, 0 to speed up / down the moves with turn_speed and turn_steps
+        cv.Optional('acceleration', 0): cv.int_range(min=0, max=1023),
         cv.Required(CONF_SLAVES): cv_slaves_check,
         cv.Required('components'): COMPONENTS_SCHEMA,
         # cv.Optional(CONF_BRIGHTNESS, default={}): BRIGHTNESS_SCHEMA,
@@ -139,6 +146,21 @@ async def cg_add_switch(id, expression):
     await switch.register_switch(var, switchConf)
 
 
+async def cg_add_sensor(id, expression):
+    sensorId = core.ID(id, is_declaration=False, type=sensor.Sensor)
+
+    sensorConf = {
+        CONF_ID: sensorId,
+        CONF_NAME: str(sensorId),
+        CONF_DISABLED_BY_DEFAULT: False,
+        CONF_FORCE_UPDATE: False,
+    }
+    var: Pvariable = cg.Pvariable(
+        sensorConf[CONF_ID], expression)
+    await cg.register_component(var, sensorConf)
+    await sensor.register_sensor(var, sensorConf)
+
+
 def to_code_slave(physicalSlaveId, slaveConf):
     print(f"S{physicalSlaveId} maps to: ${slaveConf}")
     cg.add(cg.RawExpression(
@@ -201,6 +223,19 @@ async def to_code(config):
     await cg_add_switch("oclock_dump_logs", cg.RawExpression("new oclock::DumpLogsSwitch()"))
     await cg_add_switch("oclock_dump_config", cg.RawExpression("new oclock::DumpConfigSwitch()"))
     await cg_add_switch("oclock_dump_config_slaves", cg.RawExpression("new oclock::DumpConfigSlavesSwitch()"))
+    await cg_add_switch("oclock_capture", cg.RawExpression("new oclock::CaptureSwitch()"))
+    await cg_add_switch("oclock_dump_capture", cg.RawExpression("new oclock::DumpCaptureSwitch()"))
+    await cg_add_switch("oclock_reset_transport_stats", cg.RawExpression("new oclock::ResetTransportStatsSwitch()"))
+
+    for name, kind in [
+        ("oclock_rx_frames", "RX_FRAMES"),
+        ("oclock_tx_frames", "TX_FRAMES"),
+        ("oclock_rx_errors", "RX_ERRORS"),
+        ("oclock_decode_p95", "DECODE_P95"),
+        ("oclock_turnaround_p95", "TURNAROUND_P95"),
+        ("oclock_broadcast_p95", "BROADCAST_P95"),
+    ]:
+        await cg_add_sensor(name, cg.RawExpression(f"new oclock::TransportSensor(oclock::TransportSensor::{kind})"))
 
     turn_speed=config['turn_speed']
     expression=f"Instructions::turn_speed={turn_speed};"
@@ -212,11 +247,36 @@ async def to_code(config):
     cg.add(cg.RawExpression(expression))
     print(expression)
 
+    tx_budget=config['tx_budget']
+    expression=f"oclock::master.set_tx_budget({tx_budget});"
+    cg.add(cg.RawExpression(expression))
+    print(expression)
+
+    reliable='true' if config['reliable'] else 'false'
+    expression=f"oclock::master.set_reliable({reliable});"
+    cg.add(cg.RawExpression(expression))
+    print(expression)
+
+    baud_probe='true' if config['baud_probe'] else 'false'
+    expression=f"oclock::master.set_baud_probe({baud_probe});"
+    cg.add(cg.RawExpression(expression))
+    print(expression)
+
+    slotted_responses='true' if config['slotted_responses'] else 'false'
+    expression=f"oclock::master.set_slotted_responses({slotted_responses});"
+    cg.add(cg.RawExpression(expression))
+    print(expression)
+
 
     turn_steps=config['turn_steps']
     expression=f"Instructions::turn_steps={turn_steps};"
     cg.add(cg.RawExpression(expression))
     print(expression)
+
+    acceleration=config['acceleration']
+    expression=f"Instructions::acceleration={acceleration};"
+    cg.add(cg.RawExpression(expression))
+    print(expression)
   
     components = config['components']
 
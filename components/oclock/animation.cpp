@@ -5,6 +5,7 @@
 using namespace esphome;
 
 #include "animation.h"
+#include "interop.h"
 #include "ticks.h"
 #include <cmath>
 
@@ -12,6 +13,48 @@ typedef std::function<int(int from, int to)> StepCalculator;
 
 int Instructions::turn_speed{8};
 int Instructions::turn_steps{5};
+int Instructions::acceleration{0};
+
+int Instructions::ramp_acceleration()
+{
+    return oclock::bus_supports(Feature::Ramps) ? min(acceleration, MAX_RAMP_ACCELERATION) : 0;
+}
+
+int steps_needed_for_given_time_and_speed(double time, int speed);
+
+// note: a time right on a milli is not rounded up by the error of the double
+static uint32_t to_wait_millis(double time)
+{
+    return ceil(time * 1000.0 - 1e-6);
+}
+
+double Instructions::wait_deadline(double time)
+{
+    const uint32_t units = (to_wait_millis(time) + WAIT_UNTIL_UNIT_MILLIS - 1) / WAIT_UNTIL_UNIT_MILLIS;
+    return units * WAIT_UNTIL_UNIT_MILLIS / 1000.0;
+}
+
+void Instructions::wait_until(int handle_id, double time, int speed, bool sync)
+{
+    const double seconds = time - timers[handle_id];
+    if (seconds < 0 || (seconds == 0 && !sync))
+        return;
+    const uint32_t millis = to_wait_millis(time);
+    const bool fits = millis <= uint32_t(MAX_WAIT_UNTIL_UNITS) * WAIT_UNTIL_UNIT_MILLIS;
+    if (!fits && oclock::bus_supports(Feature::Waits))
+        ESP_LOGW(TAG, "wait_until: handle_id=%d at %ld millis is beyond a WAIT_UNTIL key, ghost steps instead", handle_id, long(millis));
+    if (!fits || !oclock::bus_supports(Feature::Waits))
+    {
+        const auto steps = steps_needed_for_given_time_and_speed(seconds, speed);
+        if (steps > 0)
+            add(handle_id, DeflatedCmdKey(GHOST | RELATIVE, steps, speed));
+        return;
+    }
+    const auto key = InflatedCmdKey::wait_until(millis);
+    cmds.push_back(HandleCmd(handle_id, DeflatedCmdKey(key), cmds.size()));
+    // rounded up by the key
+    timers[handle_id] = key.wait_until_millis() / 1000.0;
+}
 
 DistanceCalculators::Func DistanceCalculators::shortest = [](int from, int to)
 {
@@ -81,6 +124,12 @@ void HandlesAnimations::instructUsingStepCalculator(Instructions &instructions,
     }
 }
 
+// how long the move of 'steps' takes (ramps included)
+static double time_of_move(int steps, int speed)
+{
+    return Instructions::time_of(DeflatedCmdKey(CLOCKWISE | CmdEnum::RELATIVE, abs(steps), speed));
+}
+
 void instructUsingSwipeWithBase(Instructions &instructions, int speed, const HandlesState &goal, const StepCalculator &steps_calculator, int base_tick)
 {
     base_tick = Ticks::normalize(base_tick);
@@ -110,15 +159,15 @@ void instructUsingSwipeWithBase(Instructions &instructions, int speed, const Han
 
         // wait
         int steps = steps_calculator(from, base_tick);
-        int ghost_steps = max_steps_from - abs(steps);
-        ESP_LOGD(TAG, "instructUsingSwipeWithBase: handle_id=%d steps=%d ghost_steps=%d", handle_id, steps, ghost_steps);
-        instructions.add(handle_id, DeflatedCmdKey(CmdEnum::GHOST, ghost_steps, speed));
+        auto wait = time_of_move(max_steps_from, speed) - time_of_move(steps, speed);
+        ESP_LOGD(TAG, "instructUsingSwipeWithBase: handle_id=%d steps=%d wait=%.3f", handle_id, steps, wait);
+        instructions.wait(handle_id, wait, speed);
 
         // go to base_tick
         instructions.add(handle_id, DeflatedCmdKey((steps >= 0 ? CLOCKWISE : ANTI_CLOCKWISE) | CmdEnum::RELATIVE, abs(steps), speed));
 
         // wait a sec
-        instructions.add(handle_id, DeflatedCmdKey(CLOCKWISE | CmdEnum::RELATIVE | CmdEnum::GHOST, 100 / speed, speed));
+        instructions.wait(handle_id, DeflatedCmdKey(CLOCKWISE | CmdEnum::RELATIVE | CmdEnum::GHOST, 100 / speed, speed).time(), speed);
 
         // go to final
         auto to = goal[handle_id];
@@ -126,8 +175,7 @@ void instructUsingSwipeWithBase(Instructions &instructions, int speed, const Han
         instructions.add(handle_id, DeflatedCmdKey((additional_steps >= 0 ? CLOCKWISE : ANTI_CLOCKWISE) | CmdEnum::RELATIVE, abs(additional_steps), speed));
 
         // wait
-        ghost_steps = max_steps_to - abs(additional_steps);
-        instructions.add(handle_id, DeflatedCmdKey(CmdEnum::GHOST, ghost_steps, speed));
+        instructions.wait(handle_id, time_of_move(max_steps_to, speed) - time_of_move(additional_steps, speed), speed);
     }
 }
 
@@ -212,17 +260,15 @@ void InBetweenAnimations::instructDelayUntilAllAreReady(Instructions &instructio
     if (max_time < 0)
         // no valid handles?
         return;
-    max_time += additional_time;
+    // every handle waits for the same deadline, the last one as well
+    max_time = Instructions::wait_deadline(max_time + additional_time);
     for (int handle_id = 0; handle_id < MAX_HANDLES; ++handle_id)
     {
         if (!instructions.valid_handle(handle_id))
         {
             continue;
         }
-        auto time = max_time - instructions.time_at(handle_id);
-        auto steps = steps_needed_for_given_time_and_speed(time, speed);
-        if (steps > 0)
-            instructions.add(handle_id, DeflatedCmdKey(GHOST | RELATIVE, steps, speed));
+        instructions.wait_until(handle_id, max_time, speed, true);
     }
 }
 
@@ -2,6 +2,7 @@
 
 #include "oclock.h"
 #include "ticks.h"
+#include "ramp.h"
 
 using namespace esphome;
 
@@ -247,6 +248,19 @@ public:
     uint64_t speed_detection{~uint64_t(0)};
     static int turn_speed;
     static int turn_steps;
+    // in revs per minute per second, 0: the moves speed up / down by speed detection (see CmdSpecialMode::RAMP)
+    static int acceleration;
+    // the acceleration of the moves on this bus, 0 when not every slave ramps (see Feature::Ramps)
+    static int ramp_acceleration();
+
+    // how long a (relative) key takes
+    static double time_of(const DeflatedCmdKey &cmd)
+    {
+        const int ramp = ramp_acceleration();
+        if (ramp == 0 || cmd.ghost())
+            return cmd.time();
+        return Ramp::micros(cmd.steps() * RAMP_STEP_MULTIPLIER, min(cmd.speed(), 255), ramp) / 1000000.0;
+    }
 
     void iterate_handle_ids(std::function<void(int handle_id)> func)
     {
@@ -347,13 +361,28 @@ public:
         add(handle_id, discrete ? CmdSpecialMode::FOLLOW_SECONDS_DISCRETE : CmdSpecialMode::FOLLOW_SECONDS);
     }
 
+    /***
+     * The handle stands still until 'time' (in seconds after the start of the animation): a WAIT_UNTIL key
+     * (with 'sync' also when the handle is on time, so the slaves start it on the deadline as well), or ghost steps
+     * at 'speed' when not every slave knows it (see Feature::Waits) or the deadline does not fit in the key
+     */
+    void wait_until(int handle_id, double time, int speed, bool sync = false);
+
+    // the time a WAIT_UNTIL key really waits until: rounded up to WAIT_UNTIL_UNIT_MILLIS
+    static double wait_deadline(double time);
+
+    void wait(int handle_id, double seconds, int speed)
+    {
+        wait_until(handle_id, timers[handle_id] + seconds, speed);
+    }
+
     /***
      * NOTE: cmd is relative
      */
     void add_(int handle_id, const DeflatedCmdKey &cmd)
     {
         // calculate time
-        timers[handle_id] += cmd.time();
+        timers[handle_id] += time_of(cmd);
         cmds.push_back(HandleCmd(handle_id, cmd, cmds.size()));
 
         const auto ghosting = cmd.ghost();
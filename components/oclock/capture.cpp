@@ -0,0 +1,85 @@
+#include "capture.h"
+
+#ifdef MASTER_MODE
+FrameCapture frameCapture;
+#endif
+
+void FrameCapture::set_enabled(bool value)
+{
+    // the ring is only allocated once really needed
+    if (value && ring_ == nullptr)
+        ring_ = new byte[CAPTURE_RING_SIZE];
+    enabled_ = value;
+    ESP_LOGI(TAG, "capture: %s", enabled_ ? "on" : "off");
+}
+
+void FrameCapture::drop()
+{
+    const uint16_t size = HEADER_SIZE + at(tail_ + 5);
+    tail_ = (tail_ + size) % CAPTURE_RING_SIZE;
+    used_ -= size;
+    records_--;
+    overwritten_++;
+}
+
+void FrameCapture::record(CaptureKind kind, const byte *bytes, byte length, Micros stamp)
+{
+    if (!enabled_)
+        return;
+
+    const uint16_t size = HEADER_SIZE + length;
+    while (used_ + size > CAPTURE_RING_SIZE)
+        drop();
+
+    for (uint8_t shift = 0; shift < 32; shift += 8)
+        put(byte(stamp >> shift));
+    put(byte(kind));
+    put(length);
+    for (byte idx = 0; idx < length; ++idx)
+        put(bytes[idx]);
+    used_ += size;
+    records_++;
+}
+
+void FrameCapture::clear()
+{
+    head_ = tail_ = used_ = records_ = 0;
+    overwritten_ = 0;
+}
+
+void FrameCapture::dump(const char *tag, uint32_t baud_rate, uint8_t framing) const
+{
+    ESP_LOGI(tag, "cap: begin baud=%ld framing=%d records=%d", long(baud_rate), framing, records_);
+    char line[2 * CAPTURE_LINE_BYTES + 1];
+    uint16_t idx = tail_;
+    for (uint16_t record = 0; record < records_; ++record)
+    {
+        uint32_t stamp = 0;
+        for (uint8_t shift = 0; shift < 32; shift += 8)
+            stamp |= uint32_t(at(idx++)) << shift;
+        // the kind first, then the length (see record)
+        const byte length = at(idx + 1);
+
+        byte offset = 0;
+        do
+        {
+            const byte count = min(length - offset, CAPTURE_LINE_BYTES);
+            for (byte pos = 0; pos < count; ++pos)
+                sprintf(line + 2 * pos, "%02x", at(idx + 2 + offset + pos));
+            line[2 * count] = 0;
+            if (offset == 0)
+                ESP_LOGI(tag, "cap %08lx %c %s", (unsigned long)stamp, char(at(idx)), line);
+            else
+                ESP_LOGI(tag, "cap+ %s", line);
+            offset += count;
+        } while (offset < length);
+        idx += 2 + length;
+    }
+    ESP_LOGI(tag, "cap: end");
+}
+
+void FrameCapture::dump_config(const char *tag) const
+{
+    ESP_LOGI(tag, "  capture: %s, %d records, %d of %d bytes (overwritten: %ld)",
+             enabled_ ? "on" : "off", records_, used_, CAPTURE_RING_SIZE, long(overwritten_));
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "oclock.h"
+
+/**
+ * Binary frame capture: every frame on the bus (as it is sent or received) with a micros timestamp,
+ * kept in a fixed ring (oldest records are overwritten) and dumped over the logger.
+ *
+ * Dump format (one record per line, longer frames continue on 'cap+' lines):
+ *
+ *   cap: begin baud=<baud> framing=<0: nibble, 1: cobs> records=<count>
+ *   cap <micros, hex> <kind> <bytes, hex>
+ *   cap+ <bytes, hex>
+ *   cap: end
+ *
+ * See tools/replay_capture.cpp to replay a dump on the host.
+ */
+
+#define CAPTURE_RING_SIZE 4096
+// bytes per dumped line, keeps the lines well within the logger buffer
+#define CAPTURE_LINE_BYTES 48
+
+enum class CaptureKind : uint8_t
+{
+  // a frame from a slave
+  Rx = 'R',
+  // a frame to the slaves
+  Tx = 'T',
+  // a receive error, the only byte is the Protocol::RxError
+  Error = 'E',
+};
+
+class FrameCapture
+{
+  // record: micros (4), kind (1), length (1), bytes (length)
+  static const uint16_t HEADER_SIZE = 6;
+
+  byte *ring_{nullptr};
+  uint16_t head_{0}, tail_{0}, used_{0};
+  uint16_t records_{0};
+  uint32_t overwritten_{0};
+  bool enabled_{false};
+
+  void put(byte value)
+  {
+    ring_[head_] = value;
+    head_ = (head_ + 1) % CAPTURE_RING_SIZE;
+  }
+
+  byte at(uint16_t idx) const { return ring_[idx % CAPTURE_RING_SIZE]; }
+
+  // frees the oldest record
+  void drop();
+
+public:
+  void set_enabled(bool value);
+  bool is_enabled() const { return enabled_; }
+
+  void record(CaptureKind kind, const byte *bytes, byte length, Micros stamp);
+  void record(CaptureKind kind, const byte *bytes, byte length) { record(kind, bytes, length, micros()); }
+  void error(uint8_t error) { record(CaptureKind::Error, &error, 1); }
+  void clear();
+
+  void dump(const char *tag, uint32_t baud_rate, uint8_t framing) const;
+  void dump_config(const char *tag) const;
+};
+
+#ifdef MASTER_MODE
+extern FrameCapture frameCapture;
+#endif
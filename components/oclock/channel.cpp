@@ -1,32 +1,210 @@
 #include "channel.h"
 #include "hal.h"
-
-// Helper class to calucalte CRC8
+#include "stats.h"
+#include "capture.h"
+
+#ifdef __AVR__
+// received bytes are handled by the RX interrupt (see ISR(USART_RX_vect)) instead of HardwareSerial
+#define USE_RX_INTERRUPT
+#include <util/atomic.h>
+// the receiver state is shared with the RX interrupt
+#define RX_ATOMIC() ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define RX_ATOMIC()
+#endif
 
 uint32_t initial_baud_rate{57600};
 
-class CRC8
+#ifdef MASTER_MODE
+#ifdef UART_TX_FIFO_SIZE
+#define TX_FIFO_SIZE UART_TX_FIFO_SIZE
+#else
+#define TX_FIFO_SIZE 128
+#endif
+
+// see TX_BULK_AHEAD_MICROS, at least a few bytes to keep the UART busy
+static uint16_t bulk_ahead(uint32_t baud_rate)
 {
+    const uint32_t bytes = TX_BULK_AHEAD_MICROS * (baud_rate / 10) / 1000000UL;
+    return bytes < 16 ? 16 : bytes;
+}
+#endif
+
+#ifdef USE_RX_INTERRUPT
+/**
+ * Minimal replacement of HardwareSerial for USART0: no RX/TX buffers (RAM!),
+ * the RX interrupt feeds the Protocol directly and writing waits (while yielding) for the data register.
+ * The TX complete interrupt is used to turn the gate around (see Channel::start_receiving).
+ */
+class SerialPort
+{
+    friend void on_tx_complete();
+    static volatile bool written;
+
 public:
-    static byte calc(const byte *addr, byte len)
+    static void begin(uint32_t baud)
     {
-        byte crc = 0;
-        while (len--)
+        // same as HardwareSerial: try double speed mode first
+        uint16_t baud_setting = (F_CPU / 4 / baud - 1) / 2;
+        UCSR0A = _BV(U2X0);
+        if (((F_CPU == 16000000UL) && (baud == 57600)) || (baud_setting > 4095))
         {
-            byte inbyte = *addr++;
-            for (byte i = 8; i; i--)
-            {
-                byte mix = (crc ^ inbyte) & 0x01;
-                crc >>= 1;
-                if (mix)
-                    crc ^= 0x8C;
-                inbyte >>= 1;
-            } // end of for
-        }     // end of while
-        return crc;
+            UCSR0A = 0;
+            baud_setting = (F_CPU / 8 / baud - 1) / 2;
+        }
+        UBRR0H = baud_setting >> 8;
+        UBRR0L = baud_setting;
+        written = false;
+
+        // 8N1
+        UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+        UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+    }
+
+    static void end()
+    {
+        flush();
+        UCSR0B = 0;
+    }
+
+    static void write(byte value)
+    {
+        while (!(UCSR0A & _BV(UDRE0)))
+            Hal::yield();
+        UDR0 = value;
+        // clear 'transmit complete' (by writing a one), keep the speed mode
+        UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+        written = true;
+    }
+
+    static void flush()
+    {
+        // wait until the last byte left the shift register
+        while (!tx_complete())
+            Hal::yield();
+    }
+
+    // true if the last byte left the shift register
+    static bool tx_complete() { return !written || (UCSR0A & _BV(TXC0)); }
+
+    // calls on_tx_complete() once the last byte left the shift register
+    static void notify_tx_complete(bool enable)
+    {
+        if (enable)
+            UCSR0B |= _BV(TXCIE0);
+        else
+            UCSR0B &= ~_BV(TXCIE0);
+    }
+};
+
+volatile bool SerialPort::written = false;
+#else
+class SerialPort
+{
+    // see tx_complete()
+    static Micros byteMicros_;
+    static Micros emptySince_;
+
+public:
+    static void begin(uint32_t baud)
+    {
+        Serial.begin(baud);
+        byteMicros_ = 10 * 1000000UL / baud + 1;
+        emptySince_ = 0;
+    }
+    static void end() { Serial.end(); }
+    static void write(byte value) { Serial.write(value); }
+    static void flush() { Serial.flush(); }
+
+    // true if the last byte left the shift register, to be polled (see Channel::poll_turnaround)
+    static bool tx_complete()
+    {
+#ifdef UART_TX_FIFO_SIZE
+        if (Serial.availableForWrite() < UART_TX_FIFO_SIZE)
+        {
+            emptySince_ = 0;
+            return false;
+        }
+        // the FIFO is empty, give the last byte the time to leave the shift register
+        if (emptySince_ == 0)
+            emptySince_ = micros() | 1;
+        return micros() - emptySince_ >= byteMicros_;
+#else
+        return true;
+#endif
     }
 };
 
+Micros SerialPort::byteMicros_ = 0;
+Micros SerialPort::emptySince_ = 0;
+#endif
+
+/**
+ * Frames that are received completely (CRC checked and accepted) but not processed yet.
+ *
+ * The buffer is split in RX_QUEUE_FRAMES slots, the slot at tail is the one being assembled.
+ * There is a single producer (the receiver, possibly the RX interrupt) and a single consumer (Channel::loop),
+ * head and tail are bytes, so no locking is needed.
+ *
+ * The frame being processed is out of the queue already but its slot is held until it is released, so a handler
+ * can run the loop itself (see do_wait_for_animation) or skip what is received without that frame coming back.
+ */
+class FrameQueue
+{
+    Buffer &buffer_;
+    const byte frameSize_;
+    byte lengths_[RX_QUEUE_FRAMES];
+    Micros stamps_[RX_QUEUE_FRAMES];
+    volatile uint8_t head_{0}, tail_{0};
+    volatile uint8_t held_{NONE};
+
+    static uint8_t next(uint8_t idx) { return idx + 1 == RX_QUEUE_FRAMES ? 0 : idx + 1; }
+    byte *slot(uint8_t idx) const { return buffer_.raw() + idx * frameSize_; }
+
+public:
+    static const uint8_t NONE = 0xFF;
+
+    // frames lost since the queue was full
+    volatile uint16_t dropped_{0};
+
+    FrameQueue(Buffer &buffer) : buffer_(buffer), frameSize_(buffer.size() / RX_QUEUE_FRAMES) {}
+
+    byte frame_size() const { return frameSize_; }
+
+    // producer
+    bool full() const { return next(tail_) == head_ || next(tail_) == held_; }
+    byte *assembling() const { return slot(tail_); }
+    bool commit(byte length)
+    {
+        if (full())
+        {
+            dropped_++;
+            return false;
+        }
+        lengths_[tail_] = length;
+        stamps_[tail_] = micros();
+        tail_ = next(tail_);
+        return true;
+    }
+
+    // consumer
+    bool empty() const { return head_ == tail_; }
+    const byte *front() const { return slot(head_); }
+    byte front_length() const { return lengths_[head_]; }
+    Micros front_stamp() const { return stamps_[head_]; }
+    // takes the front frame out of the queue, returns the slot held before (see release)
+    uint8_t hold()
+    {
+        const uint8_t previous = held_;
+        held_ = head_;
+        head_ = next(head_);
+        return previous;
+    }
+    // note: a nested hold released the slot of the outer frame, so it should be done with it by then
+    void release(uint8_t previous) { held_ = previous; }
+    void clear() { head_ = tail_; }
+};
+
 // based on: http://www.gammon.com.au/forum/?id=11428
 
 class Protocol
@@ -34,22 +212,43 @@ class Protocol
 public:
     enum
     {
-        STX = '\2', // start of text
-        ETX = '\3'  // end of text
-    };              // end of enum
+        STX = '\2',           // start of text
+        ETX = '\3',           // end of text
+        COBS_DELIMITER = '\0' // end of a cobs frame
+    };                        // end of enum
 
-    // where we save incoming stuff
-    Gate &gate;
-    Buffer &buffer;
+    // why the last frame was rejected, will be logged by Channel::loop (not from the interrupt)
+    enum class RxError : uint8_t
+    {
+        None,
+        Nibble,
+        Crc,
+        Overflow,
+        Truncated,
+        Dropped,
+        Uart,
+        Timeout,
+    };
 
-    // this is true once we have valid data in buf
-    bool available_;
+    Channel &channel;
+    Gate &gate;
+    // where we save incoming stuff
+    FrameQueue rxQueue_;
 
     // an STX (start of text) signals a packet start
     bool haveSTX_;
 
     // count of errors
-    unsigned long errorCount_;
+    volatile unsigned long errorCount_;
+    volatile RxError lastError_{RxError::None};
+
+    // from the first error until the next good frame (see complete)
+    bool resyncing_{false};
+    // the frame is assembled without an STX, see error()
+    bool speculative_{false};
+#ifdef MASTER_MODE
+    Micros resyncStart_{0};
+#endif
 
     // variables below are set when we get an STX
     bool haveETX_;
@@ -58,8 +257,44 @@ public:
     bool firstNibble_;
     unsigned long startTime_;
 
+    // how the bytes are put on the wire
+    Framing framing_{Framing::Nibble};
+    // cobs: bytes left in the current block (0: next byte is a block code)
+    byte cobsRemaining_;
+    // cobs: code of the current block, 0xFF means no implicit zero will follow
+    byte cobsCode_;
+
+    // nibble: the checksum received so far (after the ETX)
+    Checksum::Value receivedChecksum_;
+    byte checksumPos_;
+
     // helper private functions
-    byte crc8(const byte *addr, byte len) { return CRC8::calc(addr, len); }
+    Checksum::Value checksum(const byte *addr, byte len) { return Checksum::calc(addr, len); }
+    // the checksum goes on the wire most significant byte first
+    static byte checksum_byte(Checksum::Value value, byte idx) { return byte(value >> (8 * (CHECKSUM_SIZE - 1 - idx))); }
+    static Checksum::Value checksum_of(const byte *bytes)
+    {
+        Checksum::Value value = 0;
+        for (byte idx = 0; idx < CHECKSUM_SIZE; ++idx)
+            value = (value << 8) | bytes[idx];
+        return value;
+    }
+
+#ifdef MASTER_MODE
+    // the master queues, see Channel::drain
+    TxQueue &txQueue_;
+
+    inline void put(const byte what)
+    {
+        txQueue_.push(what);
+    }
+#else
+    inline void put(const byte what)
+    {
+        SerialPort::write(what);
+        Hal::yield();
+    }
+#endif
 
     // send a byte complemented, repeated
     // only values sent would be (in hex):
@@ -70,18 +305,21 @@ public:
 
         // first nibble
         c = what >> 4;
-        Serial.write((c << 4) | (c ^ 0x0F));
-        Hal::yield();
+        put((c << 4) | (c ^ 0x0F));
 
         // second nibble
         c = what & 0x0F;
-        Serial.write((c << 4) | (c ^ 0x0F));
-        Hal::yield();
+        put((c << 4) | (c ^ 0x0F));
     } // end of RS485::sendComplemented
 
 public:
     // constructor
-    Protocol(Gate &gate, Buffer &buffer) : gate(gate), buffer(buffer)
+    Protocol(Channel &channel, Gate &gate, Buffer &buffer)
+        : channel(channel), gate(gate), rxQueue_(buffer)
+#ifdef MASTER_MODE
+          ,
+          txQueue_(channel.tx_queue_)
+#endif
     {
     }
 
@@ -94,10 +332,24 @@ public:
     // reset to no incoming data (eg. after a timeout)
     void reset()
     {
-        haveSTX_ = false;
-        available_ = false;
-        inputPos_ = 0;
-        startTime_ = 0;
+        RX_ATOMIC()
+        {
+            haveSTX_ = false;
+            speculative_ = false;
+            inputPos_ = 0;
+            startTime_ = 0;
+            cobsRemaining_ = 0;
+            cobsCode_ = 0;
+        }
+    }
+
+    void set_framing(Framing framing)
+    {
+        RX_ATOMIC()
+        {
+            framing_ = framing;
+            reset();
+        }
     }
 
     // reset
@@ -105,65 +357,170 @@ public:
     {
         reset();
         errorCount_ = 0;
+        resyncing_ = false;
     }
 
-    // free memory in buf_
-    void stop()
+    // a frame is broken, start again
+    inline void error(RxError error)
     {
+        if (speculative_)
+        {
+            // it was the rest of the broken frame after all, already counted
+            reset();
+            return;
+        }
         reset();
+        errorCount_++;
+        lastError_ = error;
+        transportStats.count_error(uint8_t(error));
+#ifdef MASTER_MODE
+        frameCapture.error(uint8_t(error));
+        if (!resyncing_)
+            resyncStart_ = micros();
+#endif
+        resyncing_ = true;
+
+        // resync: what follows is decoded as a frame right away, so the next frame is not lost if the broken byte
+        // was its STX (nibble) or the delimiter before it (cobs), otherwise it is the rest of the broken frame that
+        // will fail (not counted) and we are where we would have been by waiting for the next frame, note: it is
+        // only dispatched if trusted
+        if (error == RxError::Uart || (error == RxError::Overflow && framing_ == Framing::Cobs))
+        {
+            if (framing_ == Framing::Nibble)
+                start_frame();
+            speculative_ = true;
+        }
     }
 
-    // handle incoming data, return true if packet ready
-    bool update();
+    // a frame is in progress for too long (e.g. truncated), see RX_TIMEOUT_MILLIS
+    bool stale(Millis now) const
+    {
+        return haveSTX_ && now - startTime_ > channel.frame_micros(inputPos_) / 1000 + RX_TIMEOUT_MILLIS;
+    }
 
-    inline void wait_for_room()
+    // nibble: an STX is received
+    inline void start_frame()
     {
-        return;
+        haveSTX_ = true;
+        haveETX_ = false;
+        speculative_ = false;
+        inputPos_ = 0;
+        firstNibble_ = true;
+        startTime_ = millis();
+    }
 
-        bool waited = false;
-        int av = Serial.availableForWrite();
-        while (av < 20)
+    // a speculative frame (see error) needs more than the checksum (1 in 256 for 8 bits): it has to look like a message
+    inline bool trusted() const
+    {
+        return !speculative_ || channel.plausible(rxQueue_.assembling(), inputPos_);
+    }
+
+    // a complete frame with a valid CRC
+    inline void complete()
+    {
+        haveSTX_ = false;
+        if (!trusted())
         {
-            if (!waited)
-            {
-                ESP_LOGW(TAG, "Waited for available: %d", av);
-            }
-            waited = true;
-            delay(3); // FIX CRC ERRORS ?
-            av = Serial.availableForWrite();
+            // dropped, as if we waited for the next frame: the resync goes on
+            speculative_ = false;
+            return;
+        }
+        if (resyncing_)
+        {
+            resyncing_ = false;
+#ifdef MASTER_MODE
+            transportStats.count_resync(speculative_, micros() - resyncStart_);
+#else
+            transportStats.count_resync(speculative_);
+#endif
+        }
+        speculative_ = false;
+        if (channel.accept(rxQueue_.assembling(), inputPos_) && !rxQueue_.commit(inputPos_))
+        {
+            lastError_ = RxError::Dropped;
+            transportStats.count_error(uint8_t(RxError::Dropped));
+#ifdef MASTER_MODE
+            frameCapture.error(uint8_t(RxError::Dropped));
+#endif
         }
     }
 
+    // free memory in buf_
+    void stop()
+    {
+        reset();
+    }
+
+    // handle incoming data (when there is no RX interrupt)
+    void update();
+    // log errors found by the receiver
+    void report();
+
+    // handle one received byte, complete frames will end up in the rxQueue_
+    inline void receive(byte inByte)
+    {
+        if (framing_ == Framing::Cobs)
+            receiveCobs(inByte);
+        else
+            receiveNibble(inByte);
+    }
+    void receiveNibble(byte inByte);
+    void receiveCobs(byte inByte);
+
     // send a message of "length" bytes (max 255) to other end
     // put STX at start, ETX at end, and add CRC
-    inline void sendMsg(const byte *data, const byte length)
+    inline void sendNibbleMsg(const byte *data, const byte length)
     {
-        wait_for_room();
-        Serial.write(STX); // STX
-        Hal::yield();
+        put(STX); // STX
         for (byte i = 0; i < length; i++)
         {
-            wait_for_room();
             sendComplemented(data[i]);
         }
-        Serial.write(ETX); // ETX
-        Hal::yield();
-        sendComplemented(crc8(data, length));
-    } // end of RS485::sendMsg
-
-    // returns true if packet available
-    bool available() const
+        put(ETX); // ETX
+        const Checksum::Value sum = checksum(data, length);
+        for (byte idx = 0; idx < CHECKSUM_SIZE; idx++)
+            sendComplemented(checksum_byte(sum, idx));
+    } // end of RS485::sendNibbleMsg
+
+    // send a message of "length" bytes (max 253) COBS encoded, the checksum is part of the encoded data
+    // and the frame is terminated by a 0x00 delimiter
+    inline void sendCobsMsg(const byte *data, const byte length)
     {
-        return available_;
-    };
+        const Checksum::Value sum = checksum(data, length);
+        // note: the checksum is virtually appended to data
+        const byte total = length + CHECKSUM_SIZE;
+#define AT(idx) ((idx) < length ? data[idx] : checksum_byte(sum, (idx)-length))
+        byte blockStart = 0;
+        while (blockStart < total)
+        {
+            // search the next zero (or the end of the block)
+            byte blockEnd = blockStart;
+            while (blockEnd < total && AT(blockEnd) != 0 && blockEnd - blockStart < 254)
+                blockEnd++;
 
-    byte *getData() const
-    {
-        return buffer.raw();
-    }
-    byte getLength() const
+            put(byte(blockEnd - blockStart + 1));
+            for (byte idx = blockStart; idx < blockEnd; idx++)
+            {
+                put(AT(idx));
+            }
+            // skip the zero, a full block (254 bytes) has no implicit zero
+            blockStart = blockEnd - blockStart == 254 ? blockEnd : blockEnd + 1;
+            if (blockStart == total && AT(total - 1) == 0)
+            {
+                // data ends with a zero, so we need an empty block
+                put(byte(1));
+            }
+        }
+#undef AT
+        put(COBS_DELIMITER);
+    } // end of RS485::sendCobsMsg
+
+    inline void sendMsg(const byte *data, const byte length)
     {
-        return inputPos_;
+        if (framing_ == Framing::Cobs)
+            sendCobsMsg(data, length);
+        else
+            sendNibbleMsg(data, length);
     }
 
     // return how many errors we have had
@@ -186,140 +543,429 @@ public:
 
 }; // end of class RS485Protocol
 
-// called periodically from main loop to process data and
-// assemble the finished packet in 'buffer_'
+#ifdef USE_RX_INTERRUPT
+// the one and only receiver, see Channel::setup
+Protocol *rxProtocol = nullptr;
 
-// returns true if packet received.
+ISR(USART_RX_vect)
+{
+    // note: status needs to be read before the data
+    const bool uartError = UCSR0A & (_BV(FE0) | _BV(DOR0));
+    const byte inByte = UDR0;
+    if (!rxProtocol)
+        return;
+    if (uartError)
+        rxProtocol->error(Protocol::RxError::Uart);
+    else
+        rxProtocol->receive(inByte);
+}
+
+// the one and only channel, see Channel::setup
+Channel *txChannel = nullptr;
+
+void on_tx_complete()
+{
+    // TXC0 is cleared by taking this interrupt
+    SerialPort::written = false;
+    SerialPort::notify_tx_complete(false);
+    if (txChannel)
+        txChannel->complete_turnaround();
+}
+
+ISR(USART_TX_vect)
+{
+    on_tx_complete();
+}
+#endif
 
-// You could implement a timeout by seeing if isPacketStarted() returns
-// true, and if too much time has passed since getPacketStartTime() time.
+// called periodically from main loop to process data and
+// assemble the finished packets in 'rxQueue_'
 
-bool Protocol::update()
+void Protocol::update()
 {
+#ifndef USE_RX_INTERRUPT
     int available = Serial.available();
-    if (available == 0)
-        return false;
+    if (available > 0)
+    {
+        ESP_LOGD(TAG, "RS485: available() = %d", available);
+        // note: if the queue is full the bytes can wait in the Serial buffer
+        while (!rxQueue_.full() && Serial.available() > 0)
+        {
+            receive(Serial.read());
+        } // end of while incoming data
+    }
+    // the rest of the frame might still be in the Serial buffer
+    if (Serial.available() > 0)
+        return;
+#endif
+    // drop a half received frame, so the next one starts clean
+    RX_ATOMIC()
+    {
+        if (stale(millis()))
+            error(RxError::Timeout);
+    }
+} // end of Protocol::update
 
-    ESP_LOGD(TAG, "RS485: available() = %d", available);
-    while (Serial.available() > 0)
+void Protocol::report()
+{
+    const RxError error = lastError_;
+    if (error == RxError::None)
+        return;
+    lastError_ = RxError::None;
+
+    switch (error)
     {
-        byte inByte = Serial.read();
-        switch (inByte)
+    case RxError::Nibble:
+        ESP_LOGE(TAG, "invalid nibble !? (E=%ld)", errorCount_);
+        break;
+    case RxError::Crc:
+        ESP_LOGE(TAG, "CRC!? (E=%ld)", errorCount_);
+        break;
+    case RxError::Overflow:
+        ESP_LOGE(TAG, "OVERFLOW !? (E=%ld)", errorCount_);
+        break;
+    case RxError::Truncated:
+        ESP_LOGE(TAG, "truncated !? (E=%ld)", errorCount_);
+        break;
+    case RxError::Dropped:
+        ESP_LOGE(TAG, "rx queue full, dropped: %d", rxQueue_.dropped_);
+        break;
+    case RxError::Uart:
+        ESP_LOGE(TAG, "frame error or overrun !? (E=%ld)", errorCount_);
+        break;
+    case RxError::Timeout:
+        ESP_LOGE(TAG, "timeout, frame dropped (E=%ld)", errorCount_);
+        break;
+    default:
+        break;
+    }
+} // end of Protocol::report
+
+void Protocol::receiveNibble(byte inByte)
+{
+    switch (inByte)
+    {
+    case STX: // start of text
+        ESP_LOGD(TAG, "RS485: STX  (E=%ld)", errorCount_);
+        start_frame();
+        break;
+
+    case ETX: // end of text (now expect the CRC check)
+        ESP_LOGD(TAG, "RS485: ETX  (E=%ld)", errorCount_);
+        haveETX_ = true;
+        checksumPos_ = 0;
+        receivedChecksum_ = 0;
+        break;
+
+    default:
+        // wait until packet officially starts
+        if (!haveSTX_)
         {
-        case STX: // start of text
-            ESP_LOGD(TAG, "RS485: STX  (E=%ld)", errorCount_);
-            haveSTX_ = true;
-            haveETX_ = false;
-            inputPos_ = 0;
-            firstNibble_ = true;
-            startTime_ = millis();
+            ESP_LOGD(TAG, "ignoring %d (E=%ld)", (int)inByte, errorCount_);
             break;
+        }
+        ESP_LOGVV(TAG, "received nibble %d (E=%ld)", (int)inByte, errorCount_);
+
+        // check byte is in valid form (4 bits followed by 4 bits complemented)
+        if ((inByte >> 4) != ((inByte & 0x0F) ^ 0x0F))
+        {
+            error(RxError::Nibble);
+            break; // bad character
+        }          // end if bad byte
 
-        case ETX: // end of text (now expect the CRC check)
-            ESP_LOGD(TAG, "RS485: ETX  (E=%ld)", errorCount_);
-            haveETX_ = true;
+        // convert back
+        inByte >>= 4;
+
+        // high-order nibble?
+        if (firstNibble_)
+        {
+            currentByte_ = inByte;
+            firstNibble_ = false;
             break;
+        } // end of first nibble
 
-        default:
-            // wait until packet officially starts
-            if (!haveSTX_)
-            {
-                ESP_LOGD(TAG, "ignoring %d (E=%ld)", (int)inByte, errorCount_);
-                break;
-            }
-            ESP_LOGVV(TAG, "received nibble %d (E=%ld)", (int)inByte, errorCount_);
+        // low-order nibble
+        currentByte_ <<= 4;
+        currentByte_ |= inByte;
+        firstNibble_ = true;
 
-            // check byte is in valid form (4 bits followed by 4 bits complemented)
-            if ((inByte >> 4) != ((inByte & 0x0F) ^ 0x0F))
+        // if we have the ETX this must be the checksum
+        if (haveETX_)
+        {
+            receivedChecksum_ = (receivedChecksum_ << 8) | currentByte_;
+            if (++checksumPos_ < CHECKSUM_SIZE)
+                break;
+            if (checksum(rxQueue_.assembling(), inputPos_) != receivedChecksum_)
             {
-                reset();
-                errorCount_++;
-                ESP_LOGE(TAG, "invalid nibble !? (E=%ld)", errorCount_);
-                break; // bad character
-            }          // end if bad byte
+                error(RxError::Crc);
+                break; // bad crc
+            }          // end of bad CRC
 
-            // convert back
-            inByte >>= 4;
+            complete();
+            break;
+        } // end if have ETX already
 
-            // high-order nibble?
-            if (firstNibble_)
-            {
-                currentByte_ = inByte;
-                firstNibble_ = false;
-                break;
-            } // end of first nibble
+        // keep adding if not full
+        if (inputPos_ < rxQueue_.frame_size())
+        {
+            ESP_LOGVV(TAG, "received byte %d (E=%ld)", (int)currentByte_, errorCount_);
+            rxQueue_.assembling()[inputPos_++] = currentByte_;
+        }
+        else
+        {
+            error(RxError::Overflow); // overflow, start again
+        }
 
-            // low-order nibble
-            currentByte_ <<= 4;
-            currentByte_ |= inByte;
-            firstNibble_ = true;
+        break;
 
-            // if we have the ETX this must be the CRC
-            if (haveETX_)
-            {
-                if (crc8(buffer.raw(), inputPos_) != currentByte_)
-                {
-                    reset();
-                    errorCount_++;
-                    ESP_LOGE(TAG, "CRC!? (E=%ld)", errorCount_);
-                    break; // bad crc
-                }          // end of bad CRC
-
-                available_ = true;
-                return true; // show data ready
-            }                // end if have ETX already
-
-            // keep adding if not full
-            if (inputPos_ < buffer.size())
-            {
-                ESP_LOGVV(TAG, "received byte %d (E=%ld)", (int)currentByte_, errorCount_);
-                buffer.raw()[inputPos_++] = currentByte_;
-            }
-            else
-            {
-                reset(); // overflow, start again
-                errorCount_++;
-                ESP_LOGE(TAG, "OVERFLOW !? (E=%ld)", errorCount_);
-            }
+    } // end of switch
+} // end of Protocol::receiveNibble
 
+void Protocol::receiveCobs(byte inByte)
+{
+    if (inByte == COBS_DELIMITER)
+    {
+        if (!haveSTX_)
+        {
+            // empty frame (or a second delimiter), nothing to do
+            speculative_ = false;
+            return;
+        }
+        // note: the last bytes are the checksum
+        if (cobsRemaining_ != 0 || inputPos_ < 1 + CHECKSUM_SIZE)
+        {
+            error(RxError::Truncated);
+            return;
+        }
+        inputPos_ -= CHECKSUM_SIZE;
+        if (checksum(rxQueue_.assembling(), inputPos_) != checksum_of(rxQueue_.assembling() + inputPos_))
+        {
+            error(RxError::Crc);
+            return;
+        }
+        complete();
+        return;
+    }
+
+    byte decoded;
+    if (cobsRemaining_ == 0)
+    {
+        // a new block
+        const bool implicitZero = haveSTX_ && cobsCode_ != 0xFF;
+        if (!haveSTX_)
+        {
+            ESP_LOGD(TAG, "RS485: COBS (E=%ld)", errorCount_);
+            haveSTX_ = true;
+            inputPos_ = 0;
+            startTime_ = millis();
+        }
+        cobsCode_ = inByte;
+        cobsRemaining_ = inByte - 1;
+        if (!implicitZero)
+            return;
+        decoded = 0;
+    }
+    else
+    {
+        decoded = inByte;
+        cobsRemaining_--;
+    }
+
+    // keep adding if not full
+    if (inputPos_ < rxQueue_.frame_size())
+    {
+        ESP_LOGVV(TAG, "received byte %d (E=%ld)", (int)decoded, errorCount_);
+        rxQueue_.assembling()[inputPos_++] = decoded;
+    }
+    else
+    {
+        error(RxError::Overflow); // overflow, start again
+    }
+} // end of Protocol::receiveCobs
+
+#ifdef MASTER_MODE
+bool Credits::take(Micros now)
+{
+    if (capacity_ == 0)
+        return true;
+
+    // give back the credits of the frames handled by now
+    while (used_ > 0 && now - last_ >= frame_micros_)
+    {
+        used_--;
+        last_ += frame_micros_;
+    }
+    if (used_ >= capacity_)
+    {
+        stalls_++;
+        return false;
+    }
+    if (used_ == 0)
+        last_ = now;
+    used_++;
+    return true;
+}
+
+void TxQueue::push(byte value)
+{
+    if (pushing_->full())
+    {
+        ESP_LOGW(TAG, "TxQueue full (%d bytes), flushing", pushing_->size());
+        overflows_++;
+        flush();
+    }
+    pushing_->push(value);
+    if (size() > max_size_)
+        max_size_ = size();
+}
+
+void TxQueue::end_frame()
+{
+    if (pushing_->frames_full())
+    {
+        ESP_LOGW(TAG, "TxQueue full (frames), flushing");
+        overflows_++;
+        flush();
+    }
+    if (pushing_->end_frame() && pushing_ == &control_)
+        controlQueued_[(controlQueuedHead_ + controlQueuedCount_++) % TX_CONTROL_FRAMES] = micros();
+    pushing_ = &bulk_;
+}
+
+void TxQueue::drain(Micros budget)
+{
+    if (bulk_.complete() == 0 && control_.complete() == 0 && writingLeft_ == 0)
+        return;
+
+    const Micros start = micros();
+    Micros spent = 0;
+    while (spent < budget)
+    {
+        if (writingLeft_ == 0)
+        {
+            // control frames first
+            TxRing *next = control_.has_frame() ? &control_ : bulk_.has_frame() ? &bulk_ : nullptr;
+            if (next == nullptr || !credits_.take(micros()))
+                // nothing (allowed) to write, try again next loop
+                break;
+            writing_ = next;
+            writingLeft_ = next->pop_frame();
+        }
+
+        const int available = Serial.availableForWrite();
+        int room = available;
+        if (writing_ == &bulk_)
+        {
+            // do not run too far ahead, a control frame might come
+            const int ahead = int(bulkAhead_) - (TX_FIFO_SIZE - available);
+            if (ahead < room)
+                room = ahead;
+        }
+        if (room <= 0)
+            // UART is full, try again next loop
             break;
 
-        } // end of switch
-    }     // end of while incoming data
+        while (room-- > 0 && writingLeft_ > 0)
+        {
+            Serial.write(writing_->pop());
+            writingLeft_--;
+        }
+        if (writingLeft_ == 0 && writing_ == &control_)
+        {
+            transportStats.control.add(micros() - controlQueued_[controlQueuedHead_]);
+            controlQueuedHead_ = (controlQueuedHead_ + 1) % TX_CONTROL_FRAMES;
+            controlQueuedCount_--;
+        }
+        spent = micros() - start;
+    }
+    if (spent > max_drain_micros_)
+        max_drain_micros_ = spent;
+}
 
-    return false; // not ready yet
-} // end of Protocol::update
+void TxQueue::flush()
+{
+    // note: the frame being pushed (if any) stays
+    while (bulk_.complete() > 0 || control_.complete() > 0 || writingLeft_ > 0)
+    {
+        drain(Micros(-1));
+        ::yield();
+    }
+}
+#endif
 
 Channel::Channel(Gate &gate, Buffer &buffer)
     : baud_rate(initial_baud_rate),
       gate(gate),
-      protocol_(new Protocol(gate, buffer))
+      protocol_(new Protocol(*this, gate, buffer))
 {
 }
 
 void Channel::skip()
 {
+#ifndef USE_RX_INTERRUPT
     while (Serial.available() > 0)
     {
         Serial.read();
     }
+#endif
+    protocol_->reset();
+    protocol_->rxQueue_.clear();
 }
 
 void Channel::start_receiving()
 {
-    if (receiving)
+    // note: held back messages do not make us transmitting yet
+    flush_pending();
+    if (receiving || turning_)
         return;
 
+#ifdef MASTER_MODE
+    if (tx_pending())
+    {
+        // we will start receiving once everything is written, see drain()
+        receive_pending_ = true;
+        return;
+    }
+    receive_pending_ = false;
+#endif
+
     ESP_LOGD(TAG, "receiving=T");
 
-    // make sure we are done with sending
-    Serial.flush();
+    // no need to wait until we are done with sending, the gate is turned around once the last byte left
+    turnaroundStart_ = micros();
+    if (SerialPort::tx_complete())
+    {
+        complete_turnaround();
+        return;
+    }
+    turning_ = true;
+#ifdef USE_RX_INTERRUPT
+    SerialPort::notify_tx_complete(true);
+#endif
+}
 
+void Channel::complete_turnaround()
+{
     gate.start_receiving();
 
     // ignore input
     protocol_->reset();
     receiving = true;
+    turning_ = false;
+
+    turnaroundCount_++;
+    turnaroundLastMicros_ = micros() - turnaroundStart_;
+    if (turnaroundLastMicros_ > turnaroundMaxMicros_)
+        turnaroundMaxMicros_ = turnaroundLastMicros_;
+    transportStats.turnaround.add(turnaroundLastMicros_);
+}
+
+void Channel::poll_turnaround()
+{
+#ifndef USE_RX_INTERRUPT
+    if (turning_ && SerialPort::tx_complete())
+        complete_turnaround();
+#endif
 }
 
 void Channel::start_transmitting()
@@ -327,40 +973,124 @@ void Channel::start_transmitting()
     // delay(10);
     ESP_LOGD(TAG, "receiving=F");
 
-    gate.start_transmitting();
+    RX_ATOMIC()
+    {
+        // still sending, so no need to turn around
+        if (turning_)
+        {
+#ifdef USE_RX_INTERRUPT
+            SerialPort::notify_tx_complete(false);
+#endif
+            turning_ = false;
+        }
+        gate.start_transmitting();
+        receiving = false;
+    }
 
     protocol_->reset();
-
-    receiving = false;
 }
 
-void Channel::_send(const byte *bytes, const byte length)
+void Channel::_send(const byte *bytes, const byte length, TxPriority priority)
 {
-    if (receiving)
+#ifdef MASTER_MODE
+    // a control frame slips in between: afterwards we listen again if we were (about) to
+    const bool listen = priority == TxPriority::Control && (receiving || turning_ || receive_pending_);
+    receive_pending_ = false;
+#endif
+    if (receiving || turning_)
     {
         // delay(200);
         start_transmitting();
         // delay(10);
     }
+#ifdef MASTER_MODE
+    tx_queue_.begin_frame(priority);
+#endif
     protocol_->sendMsg(bytes, length);
+    transportStats.count_tx(bytes, length);
+#ifdef MASTER_MODE
+    frameCapture.record(CaptureKind::Tx, bytes, length);
+    tx_queue_.end_frame();
+    if (listen)
+        start_receiving();
+#endif
 }
 
 void Channel::downgrade_baud_rate()
 {
     upgrade_baud_rate(initial_baud_rate);
+    set_framing(Framing::Nibble);
+}
+
+Micros Channel::frame_micros(byte length) const
+{
+    // nibble: STX, every byte (and the checksum) as 2 nibbles, ETX
+    // cobs: overhead byte (one extra per 254), the bytes and the checksum, delimiter
+    const uint32_t bytes = get_framing() == Framing::Cobs ? length + 2 + CHECKSUM_SIZE + length / 254 : 2 * (length + CHECKSUM_SIZE) + 2;
+    return bytes * 10 * 1000000UL / baud_rate;
+}
+
+unsigned long Channel::error_count() const
+{
+    return protocol_->getErrorCount();
+}
+
+void Channel::set_framing(Framing framing)
+{
+    if (protocol_->framing_ == framing)
+        return;
+
+    ESP_LOGI(TAG, "framing: %d -> %d", int(protocol_->framing_), int(framing));
+    protocol_->set_framing(framing);
+}
+
+Framing Channel::get_framing() const
+{
+    return protocol_->framing_;
+}
+
+#ifdef MASTER_MODE
+void Channel::drain(Micros budget)
+{
+    tx_queue_.drain(budget);
+    if (receive_pending_ && !tx_pending())
+        start_receiving();
+    poll_turnaround();
 }
 
+void Channel::set_credits(uint8_t rx_frames, Micros frame_micros)
+{
+    ESP_LOGI(TAG, "credits: %d frames, %ld micros/frame", rx_frames, frame_micros);
+    tx_queue_.credits().set(rx_frames, frame_micros);
+}
+
+void Channel::flush()
+{
+    flush_pending();
+    tx_queue_.flush();
+    if (receive_pending_)
+        start_receiving();
+}
+#endif
+
 void Channel::upgrade_baud_rate(uint32_t value)
 {
     if (baud_rate == value)
         return;
 
-    Serial.end();
+#ifdef MASTER_MODE
+    // queued bytes are meant for the old baud rate
+    flush();
+#endif
+    SerialPort::end();
     ESP_LOGI(TAG, "UP: %ld -> %ld baud", baud_rate, value);
     baud_rate = value;
 
-    Serial.begin(baud_rate);
+    SerialPort::begin(baud_rate);
     protocol_->reset();
+#ifdef MASTER_MODE
+    tx_queue_.set_bulk_ahead(bulk_ahead(baud_rate));
+#endif
 
     start_transmitting();
 }
@@ -369,8 +1099,15 @@ void Channel::setup()
 {
     gate.setup();
 
-    Serial.begin(baud_rate);
+#ifdef USE_RX_INTERRUPT
+    rxProtocol = protocol_;
+    txChannel = this;
+#endif
+    SerialPort::begin(baud_rate);
     protocol_->begin();
+#ifdef MASTER_MODE
+    tx_queue_.set_bulk_ahead(bulk_ahead(baud_rate));
+#endif
 
     // initially we always listen
     start_receiving();
@@ -381,21 +1118,58 @@ void Channel::setup()
 void Channel::dump_config(const char *tag)
 {
     ESP_LOGI(tag, " channel(%ld baud):", baud_rate);
+    ESP_LOGI(tag, "  framing: %s", get_framing() == Framing::Cobs ? "cobs" : "nibble");
     ESP_LOGI(tag, "  gate:");
     gate.dump_config(tag);
     ESP_LOGI(tag, "  receiving: %s", receiving ? "T" : "F");
+    ESP_LOGI(tag, "  turnaround: last %ld, max %ld micros (count: %ld)", turnaroundLastMicros_, turnaroundMaxMicros_, turnaroundCount_);
     ESP_LOGI(tag, "  # errors: %ld", protocol_->errorCount_);
+    ESP_LOGI(tag, "  rx queue: %d frames of %d bytes (dropped: %d)", RX_QUEUE_FRAMES, protocol_->rxQueue_.frame_size(), protocol_->rxQueue_.dropped_);
+#ifdef MASTER_MODE
+    ESP_LOGI(tag, "  tx queue: %d bytes (max: %d of %d, overflows: %ld)", tx_queue_.size(), tx_queue_.max_size(), TX_QUEUE_SIZE, tx_queue_.overflows());
+    ESP_LOGI(tag, "  tx max drain: %ld micros", tx_queue_.max_drain_micros());
+    ESP_LOGI(tag, "  tx credits: %d frames, %ld micros/frame (stalls: %ld)", tx_queue_.credits().capacity(), tx_queue_.credits().frame_micros(), tx_queue_.credits().stalls());
+    frameCapture.dump_config(tag);
+#endif
+    transportStats.dump_config(tag);
 }
 
 void Channel::loop()
 {
     if (!receiving)
     {
+        if (turning_)
+        {
+            // the last byte is still leaving, see start_receiving()
+            poll_turnaround();
+            return;
+        }
+#ifdef MASTER_MODE
+        if (receive_pending_)
+            // still writing, see drain()
+            return;
+#endif
         ESP_LOGE(TAG, "Not receiving !?");
         return;
     }
-    if (!protocol_->update())
+    const Micros start = micros();
+    protocol_->update();
+    protocol_->report();
+
+    auto &rxQueue = protocol_->rxQueue_;
+    if (rxQueue.empty())
         return;
 
-    process(protocol_->getData(), protocol_->getLength());
+    // note: the receiver can continue with the next frame while we are processing this one
+    received_at_ = rxQueue.front_stamp();
+    transportStats.count_rx(rxQueue.front(), rxQueue.front_length());
+#ifdef MASTER_MODE
+    frameCapture.record(CaptureKind::Rx, rxQueue.front(), rxQueue.front_length(), received_at_);
+#endif
+    const byte *frame = rxQueue.front();
+    const byte length = rxQueue.front_length();
+    const uint8_t held = rxQueue.hold();
+    process(frame, length);
+    rxQueue.release(held);
+    transportStats.decode.add(micros() - start);
 }
\ No newline at end of file
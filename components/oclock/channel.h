@@ -1,16 +1,27 @@
 #pragma once
 #include "oclock.h"
 #include "Arduino.h"
+#include "crc.h"
+
+// the receiver keeps this number of frames: one being assembled and the others waiting for Channel::loop
+#define RX_QUEUE_FRAMES 3
+// the worst case time a slave needs to take a waiting frame out of its queue (advertised during MSG_ID_ACCEPT)
+#define RX_FRAME_MICROS 2000
+// a frame in progress is dropped when it is this much behind its wire time (e.g. truncated, or garbage after a baud rate change),
+// note: the master writes its frames in chunks from its loop, so a gap (of a slow loop) within a frame is normal
+#define RX_TIMEOUT_MILLIS 100
+// the size of the Buffer to give to a Channel, note: cobs keeps the checksum in the frame while decoding
+#define RX_QUEUE_SIZE (RX_QUEUE_FRAMES * (RECEIVER_BUFFER_SIZE + CHECKSUM_SIZE))
 
 class Buffer
 {
 private:
   byte *bytesPtr_;
-  uint8_t size_;
+  uint16_t size_;
 
 public:
-  uint8_t size() const { return size_; }
-  Buffer(byte *bytes_ptr, uint8_t size) : bytesPtr_(bytes_ptr), size_(size){};
+  uint16_t size() const { return size_; }
+  Buffer(byte *bytes_ptr, uint16_t size) : bytesPtr_(bytes_ptr), size_(size){};
   // TODO: get rid of raw
   byte *raw() const { return bytesPtr_; }
 };
@@ -73,25 +84,266 @@ class RS485Gate : public Gate
   }
 };
 
+/**
+ * How a message is put on the wire.
+ *
+ * Nibble: every byte is sent as 2 complemented nibbles between STX and ETX (the original encoding)
+ * Cobs: Consistent Overhead Byte Stuffing, a frame is terminated by a 0x00 delimiter (about 1x instead of 2x)
+ *
+ * Every party starts with Nibble, a faster framing is only used once negotiated (see MSG_ID_ACCEPT/MSG_ID_DONE)
+ */
+enum class Framing : uint8_t
+{
+  Nibble = 0,
+  Cobs = 1,
+};
+
+#define FRAMING_BIT(framing) (uint8_t(1) << uint8_t(framing))
+// the framings this firmware is able to decode and encode
+const uint8_t SUPPORTED_FRAMINGS = FRAMING_BIT(Framing::Nibble) | FRAMING_BIT(Framing::Cobs);
+
+/**
+ * Priority of a frame in the TxQueue: a control frame (stop, brightness, halt) is written before any queued bulk frame,
+ * so it only waits for the bulk frame being written and the bulk bytes already handed to the UART.
+ */
+enum class TxPriority : uint8_t
+{
+  Bulk,
+  Control,
+};
+
+#ifdef MASTER_MODE
+// a full minute update (all handles) should fit, even with nibble framing
+#define TX_QUEUE_SIZE 4096
+// the number of complete frames the TxQueue keeps track of
+#define TX_QUEUE_FRAMES 256
+
+/**
+ * Credit model of the receive queues of the slaves (see RX_QUEUE_FRAMES).
+ *
+ * Every frame written takes a credit, a credit is given back every frame_micros: the time the slowest
+ * slave may need to handle a queued frame. The slaves advertise both values during MSG_ID_ACCEPT,
+ * until then there is no limit.
+ */
+class Credits
+{
+  uint8_t capacity_{0};
+  Micros frame_micros_{0};
+  uint8_t used_{0};
+  Micros last_{0};
+
+  // statistics
+  uint32_t stalls_{0};
+
+public:
+  // capacity 0 means no limit
+  void set(uint8_t capacity, Micros frame_micros)
+  {
+    capacity_ = capacity;
+    frame_micros_ = frame_micros;
+    used_ = 0;
+  }
+  void clear() { set(0, 0); }
+
+  uint8_t capacity() const { return capacity_; }
+  Micros frame_micros() const { return frame_micros_; }
+  uint32_t stalls() const { return stalls_; }
+
+  // true if a frame may be written now
+  bool take(Micros now);
+};
+
+// control frames are small and few
+#define TX_CONTROL_SIZE 256
+#define TX_CONTROL_FRAMES 16
+// the bulk bytes handed to the UART ahead of time (in wire time), bounds the latency of a control frame
+#define TX_BULK_AHEAD_MICROS 4000
+
+/**
+ * Ring of complete frames (and the one being pushed), see TxQueue.
+ */
+class TxRing
+{
+  byte *const bytes_;
+  const uint16_t capacity_;
+  uint16_t *const frames_;
+  const uint16_t frameCapacity_;
+  uint16_t head_{0}, size_{0};
+  uint16_t frameHead_{0}, frameCount_{0};
+  // bytes pushed since the last end_frame()
+  uint16_t open_{0};
+
+public:
+  TxRing(byte *bytes, uint16_t capacity, uint16_t *frames, uint16_t frameCapacity)
+      : bytes_(bytes), capacity_(capacity), frames_(frames), frameCapacity_(frameCapacity) {}
+
+  uint16_t size() const { return size_; }
+  uint16_t capacity() const { return capacity_; }
+  // bytes of complete frames
+  uint16_t complete() const { return size_ - open_; }
+  bool full() const { return size_ == capacity_; }
+  bool frames_full() const { return frameCount_ == frameCapacity_; }
+  bool has_frame() const { return frameCount_ > 0; }
+  uint16_t frame_count() const { return frameCount_; }
+
+  void push(byte value)
+  {
+    bytes_[(head_ + size_) % capacity_] = value;
+    size_++;
+    open_++;
+  }
+  // returns false if there is nothing to end
+  bool end_frame()
+  {
+    if (open_ == 0)
+      return false;
+    frames_[(frameHead_ + frameCount_) % frameCapacity_] = open_;
+    frameCount_++;
+    open_ = 0;
+    return true;
+  }
+
+  // the length of the oldest complete frame, its bytes are taken with pop()
+  uint16_t pop_frame()
+  {
+    const uint16_t length = frames_[frameHead_];
+    frameHead_ = (frameHead_ + 1) % frameCapacity_;
+    frameCount_--;
+    return length;
+  }
+  byte pop()
+  {
+    const byte value = bytes_[head_];
+    head_ = (head_ + 1) % capacity_;
+    size_--;
+    return value;
+  }
+  // drops everything but the first keep bytes (the rest of the frame being written)
+  void discard(uint16_t keep)
+  {
+    size_ = keep;
+    frameCount_ = 0;
+    open_ = 0;
+  }
+};
+
+/**
+ * Ring buffers with encoded bytes waiting to be written to Serial, one per TxPriority.
+ *
+ * The master fills it with complete frames and drains it from its loop, so a large upload
+ * is spread over several loop iterations and never blocks on a full UART.
+ * A frame is only started when the Credits allow it, so the slaves are never overrun.
+ */
+class TxQueue
+{
+  byte bulkBytes_[TX_QUEUE_SIZE];
+  uint16_t bulkFrames_[TX_QUEUE_FRAMES];
+  byte controlBytes_[TX_CONTROL_SIZE];
+  uint16_t controlFrames_[TX_CONTROL_FRAMES];
+  TxRing bulk_{bulkBytes_, TX_QUEUE_SIZE, bulkFrames_, TX_QUEUE_FRAMES};
+  TxRing control_{controlBytes_, TX_CONTROL_SIZE, controlFrames_, TX_CONTROL_FRAMES};
+
+  // the ring of the frame being pushed
+  TxRing *pushing_{&bulk_};
+  // the ring of the frame being written and its bytes left
+  TxRing *writing_{nullptr};
+  uint16_t writingLeft_{0};
+  // see TX_BULK_AHEAD_MICROS
+  uint16_t bulkAhead_{0xFFFF};
+  // when the control frames not completely written yet were queued
+  Micros controlQueued_[TX_CONTROL_FRAMES];
+  uint8_t controlQueuedHead_{0}, controlQueuedCount_{0};
+
+  Credits credits_;
+
+  // statistics
+  uint16_t max_size_{0};
+  Micros max_drain_micros_{0};
+  uint32_t overflows_{0};
+
+public:
+  uint16_t size() const { return bulk_.size() + control_.size(); }
+  bool empty() const { return size() == 0; }
+
+  Credits &credits() { return credits_; }
+  const Credits &credits() const { return credits_; }
+
+  uint16_t max_size() const { return max_size_; }
+  Micros max_drain_micros() const { return max_drain_micros_; }
+  uint32_t overflows() const { return overflows_; }
+
+  // the next frame pushed goes to this priority
+  void begin_frame(TxPriority priority) { pushing_ = priority == TxPriority::Control ? &control_ : &bulk_; }
+  // note: will block (flush) if there is no room left
+  void push(byte value);
+  // marks the bytes pushed so far as a complete frame
+  void end_frame();
+
+  // see TX_BULK_AHEAD_MICROS
+  void set_bulk_ahead(uint16_t bytes) { bulkAhead_ = bytes; }
+  // drops the queued bulk frames (e.g. on a reset), the frame being written is finished
+  void discard_bulk() { bulk_.discard(writing_ == &bulk_ ? writingLeft_ : 0); }
+
+  // write as much as the UART and the credits allow without blocking, but not longer than budget
+  void drain(Micros budget);
+  // write all complete frames, blocking
+  void flush();
+};
+#endif
+
+// the baud rate everyone starts with (and falls back to, see Channel::downgrade_baud_rate)
+extern uint32_t initial_baud_rate;
+
 class Protocol;
 
 class Channel
 {
+  friend class Protocol;
+
 private:
-  bool receiving = false;
+  volatile bool receiving = false;
+  // waiting for the last byte to leave before turning the gate around, see start_receiving()
+  volatile bool turning_ = false;
   uint32_t baud_rate;
+  // see received_at()
+  Micros received_at_{0};
+
+  // turnaround statistics: from start_receiving() until the gate is turned around
+  Micros turnaroundStart_{0};
+  Micros turnaroundLastMicros_{0};
+  Micros turnaroundMaxMicros_{0};
+  uint32_t turnaroundCount_{0};
+
+  // completes the turnaround if the last byte left (if not done by the TX complete interrupt)
+  void poll_turnaround();
   Gate &gate;
   Protocol *const protocol_;
+#ifdef MASTER_MODE
+  TxQueue tx_queue_;
+  // start_receiving() was called while bytes were still queued
+  bool receive_pending_ = false;
+#endif
 public: //NOTE: 'start_transmitting' should be private
   void start_transmitting();
+  // called once the last byte left (possibly from the TX complete interrupt)
+  void complete_turnaround();
 
 protected:
-  void _send(const byte *bytes, const byte length);
+  // note: the priority only matters for the master (see TxQueue)
+  void _send(const byte *bytes, const byte length, TxPriority priority = TxPriority::Bulk);
   template <class M>
   void _send(const M &m) { _send((const byte *)&m, (byte)sizeof(M)); }
 
 protected:
+  // called by the receiver for every valid frame (possibly from an interrupt, so keep it short!),
+  // frames not accepted will not be queued for process()
+  virtual bool accept(const byte *bytes, const byte length) const { return true; }
+  // a frame decoded right after a receive error (see Protocol::error) might be the rest of the broken one that
+  // passed the checksum by chance: only dispatched if it looks like a message, never if the channel can not tell
+  virtual bool plausible(const byte *bytes, const byte length) const { return false; }
   virtual void process(const byte *bytes, const byte length) = 0;
+  // send whatever is held back (e.g. coalesced messages), called before receiving and flushing
+  virtual void flush_pending() {}
 
 public:
   Channel(Gate &gate, Buffer &buffer);
@@ -104,7 +356,32 @@ public:
   void start_receiving();
 
   void upgrade_baud_rate(uint32_t value);
+  // note: will also fall back to Framing::Nibble
   void downgrade_baud_rate();
+  uint32_t get_baud_rate() const { return baud_rate; }
+  // the number of receive errors so far (see Protocol::RxError)
+  unsigned long error_count() const;
+  // the time on the wire of a frame with length bytes at the current baud rate and framing
+  Micros frame_micros(byte length) const;
+  // when the frame being processed was completely received (see Channel::loop)
+  Micros received_at() const { return received_at_; }
+
+  void set_framing(Framing framing);
+  Framing get_framing() const;
+
+#ifdef MASTER_MODE
+  // writes queued bytes for at most budget micros, will start receiving once the queue is empty (if requested)
+  void drain(Micros budget);
+  // writes all queued bytes, blocking
+  void flush();
+  bool tx_pending() const { return !tx_queue_.empty(); }
+  // the gate will be turned around once the last byte left, see drain()
+  bool turnaround_pending() const { return turning_; }
+  const TxQueue &tx_queue() const { return tx_queue_; }
+  void discard_bulk() { tx_queue_.discard_bulk(); }
+  // the receive capacity of the slaves (see Credits), 0 means no limit
+  void set_credits(uint8_t rx_frames, Micros frame_micros);
+#endif
 
   template <class M>
   void send(const M &m) { _send(m); }
@@ -0,0 +1,124 @@
+#pragma once
+#include "oclock.h"
+
+/**
+ * Checksum of a frame (see Protocol), selected at compile time with CHECKSUM (e.g. -DCHECKSUM=CHECKSUM_CRC8_NIBBLE).
+ *
+ * All CRC8 variants calculate the same Dallas/Maxim CRC8, so they can be mixed on one bus.
+ * CRC16 (CCITT) puts 2 bytes on the wire: master and slaves should agree!
+ *
+ * See tools/bench_checksum.cpp for the costs.
+ */
+
+// the classic bit by bit loop, no tables
+#define CHECKSUM_CRC8_BITWISE 1
+// 256 byte table (in flash on the AVR)
+#define CHECKSUM_CRC8_TABLE 2
+// 2x16 byte table, for RAM/flash-starved builds
+#define CHECKSUM_CRC8_NIBBLE 3
+// 16 word table, for longer frames
+#define CHECKSUM_CRC16 4
+
+#ifndef CHECKSUM
+#define CHECKSUM CHECKSUM_CRC8_TABLE
+#endif
+
+class Crc8Bitwise
+{
+public:
+  typedef byte Value;
+
+  static Value calc(const byte *addr, byte len)
+  {
+    byte crc = 0;
+    while (len--)
+    {
+      byte inbyte = *addr++;
+      for (byte i = 8; i; i--)
+      {
+        byte mix = (crc ^ inbyte) & 0x01;
+        crc >>= 1;
+        if (mix)
+          crc ^= 0x8C;
+        inbyte >>= 1;
+      } // end of for
+    }   // end of while
+    return crc;
+  }
+};
+
+class Crc8Table
+{
+  static const byte table_[256] PROGMEM;
+
+public:
+  typedef byte Value;
+
+  static Value calc(const byte *addr, byte len)
+  {
+    byte crc = 0;
+    while (len--)
+      crc = pgm_read_byte(table_ + (crc ^ *addr++));
+    return crc;
+  }
+};
+
+class Crc8Nibble
+{
+  // CRC8 is linear: table[x] == low_[x & 0x0F] ^ high_[x >> 4]
+  static const byte low_[16] PROGMEM;
+  static const byte high_[16] PROGMEM;
+
+public:
+  typedef byte Value;
+
+  static Value calc(const byte *addr, byte len)
+  {
+    byte crc = 0;
+    while (len--)
+    {
+      const byte idx = crc ^ *addr++;
+      crc = pgm_read_byte(low_ + (idx & 0x0F)) ^ pgm_read_byte(high_ + (idx >> 4));
+    }
+    return crc;
+  }
+};
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+class Crc16
+{
+  static const uint16_t table_[16] PROGMEM;
+
+public:
+  typedef uint16_t Value;
+
+  static Value calc(const byte *addr, byte len)
+  {
+    uint16_t crc = 0xFFFF;
+    while (len--)
+    {
+      const byte value = *addr++;
+      crc = (crc << 4) ^ pgm_read_word(table_ + ((crc >> 12) ^ (value >> 4)));
+      crc = (crc << 4) ^ pgm_read_word(table_ + ((crc >> 12) ^ (value & 0x0F)));
+    }
+    return crc;
+  }
+};
+
+#if CHECKSUM == CHECKSUM_CRC8_BITWISE
+typedef Crc8Bitwise Checksum;
+#define CHECKSUM_SIZE 1
+#elif CHECKSUM == CHECKSUM_CRC8_TABLE
+typedef Crc8Table Checksum;
+#define CHECKSUM_SIZE 1
+#elif CHECKSUM == CHECKSUM_CRC8_NIBBLE
+typedef Crc8Nibble Checksum;
+#define CHECKSUM_SIZE 1
+#elif CHECKSUM == CHECKSUM_CRC16
+typedef Crc16 Checksum;
+#define CHECKSUM_SIZE 2
+#else
+#error "unknown CHECKSUM"
+#endif
+
+static_assert(sizeof(Checksum::Value) == CHECKSUM_SIZE, "CHECKSUM_SIZE does not match the checksum");
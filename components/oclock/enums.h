@@ -80,18 +80,6 @@ namespace oclock
         TrackTestTime,
     };
 
-    union RgbColor16
-    {
-        uint16_t raw;
-        struct
-        {
-            uint16_t red : 5,
-                green : 5,
-                blue : 5,
-                alpha : 1;
-        } rgb;
-    } __attribute__((packed, aligned(1)));
-
     const int ALPHA_BITS = 3;
     const int BRIGHTNESS_BITS = 5;
     const int MAX_ALPHA = (1 << ALPHA_BITS) - 1;
@@ -299,5 +287,38 @@ namespace oclock
 #endif
     } __attribute__((packed, aligned(1)));
 
+    /**
+     * A RgbColor in 16 bits: 5 bits per channel (red in the lowest bits) and the top bit set if invisible,
+     * always at full brightness.
+     */
+    struct RgbColor16
+    {
+        uint16_t raw;
+
+        explicit RgbColor16(uint16_t raw) : raw(raw) {}
+        explicit RgbColor16(const RgbColor &color)
+            : raw((color.get_red() >> 3) | (uint16_t(color.get_green() >> 3) << 5) | (uint16_t(color.get_blue() >> 3) << 10) |
+                  (color.invisible() ? 0x8000 : 0)) {}
+
+        // only the lowest 3 bits of every channel get lost
+        static bool fits(const RgbColor &color)
+        {
+            return color.get_brightness() == MAX_BRIGHTNESS && (color.get_alpha() == 0 || color.invisible());
+        }
+
+        RgbColor color() const
+        {
+            return RgbColor(expand(raw), expand(raw >> 5), expand(raw >> 10), (raw & 0x8000) ? MAX_ALPHA : 0);
+        }
+
+    private:
+        // 5 to 8 bits, so 0x1F is 0xFF again
+        static uint8_t expand(uint16_t bits)
+        {
+            bits &= 0x1F;
+            return (bits << 3) | (bits >> 2);
+        }
+    };
+
     typedef RgbColor RgbColorLeds[LED_COUNT];
 }
\ No newline at end of file
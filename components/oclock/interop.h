@@ -4,39 +4,96 @@
 #include "channel.h"
 #include "ticks.h"
 #include "enums.h"
+#include "wire.h"
+#include "stats.h"
 
 #ifdef ESP8266
 #include <functional>
+#include <vector>
 #endif
 
 const int MAX_UART_MESSAGE_SIZE = 32;
-const int ALL_SLAVES = 32;
+// the broadcast address, above the ids of the slaves (0 .. 2 * MAX_SLAVES - 1), see Broadcast
+const int ALL_SLAVES = 0x7E;
+// the broadcast address of the legacy firmware: also the id of the 17th slave
+const int LEGACY_ALL_SLAVES = 32;
+static_assert(ALL_SLAVES >= 2 * MAX_SLAVES, "the broadcast address has to differ from every slave id");
+
+/**
+ * The broadcast address on the bus: LEGACY_ALL_SLAVES until MSG_ID_DONE enabled Feature::Broadcast (every slave
+ * knows ALL_SLAVES), back to it on a reset. Only a legacy bus is limited to 16 slaves.
+ */
+class Broadcast
+{
+  static uint8_t &id_()
+  {
+    static uint8_t id = LEGACY_ALL_SLAVES;
+    return id;
+  }
+
+public:
+  static uint8_t id() { return id_(); }
+  static void set_wide(bool wide) { id_() = wide ? ALL_SLAVES : LEGACY_ALL_SLAVES; }
+  static bool is_wide() { return id_() == ALL_SLAVES; }
+  // note: ALL_SLAVES is never the id of a slave, so always taken as a broadcast
+  static bool is(int destination_id) { return destination_id == ALL_SLAVES || destination_id == id_(); }
+};
+
+/**
+ * All message types with their (log) name, in wire order: the position in this list is the value on the wire, so
+ * only append. The enum, the names of InteropStringifier and the bounds of the dispatch tables (see DispatchTable)
+ * all come from this one list.
+ */
+#define OCLOCK_MSG_TYPES(X)                     \
+  X(MSG_ID_RESET, "ID_R")                       \
+  X(MSG_ID_START, "ID_S")                       \
+  X(MSG_ID_ACCEPT, "ID_A")                      \
+  X(MSG_ID_DONE, "ID_D")                        \
+  X(MSG_POS_REQUEST, "POS")                     \
+  X(MSG_BEGIN_KEYS, "B_KS")                     \
+  X(MSG_SEND_KEYS, "S_KS")                      \
+  X(MSG_END_KEYS, "E_KS")                       \
+  X(MSG_CALIBRATE_START, "C_S")                 \
+  X(MSG_CALIBRATE_END, "C_E")                   \
+  X(MSG_LOG, "LOG")                             \
+  X(MSG_COLOR, "C")                             \
+  X(MSG_COLOR_ANIMATION, "C_A")                 \
+  X(MSG_LED_MODE, "L_M")                        \
+  X(MSG_DUMP_LOG_REQUEST, "D_L")                \
+  X(MSG_SLAVE_CONFIG, "CFG")                    \
+  X(MSG_BRIGHTNESS, "BR")                       \
+  X(MSG_BOOL_DEBUG_LED_LAYER, "DBG")            \
+  X(MSG_RESERVED_18, "")                        \
+  X(MSG_INFORM_STOP_ANIMATION, "I_S_A")         \
+  X(MSG_WAIT_FOR_ANIMATION, "W_F_A")            \
+  X(MSG_FOREGROUND_RGB_LEDS, "FG")              \
+  X(MSG_BACKGROUND_RGB_LEDS, "BG")              \
+  X(MSG_ENVELOPE, "ENV")                        \
+  X(MSG_SEQ_ENVELOPE, "S_ENV")                  \
+  X(MSG_SEQ_CHECK, "S_C")                       \
+  X(MSG_BAUD_PROBE, "B_P")                      \
+  X(MSG_BAUD_PATTERN, "B_PT")                   \
+  X(MSG_BAUD_REPORT, "B_R")                     \
+  X(MSG_BAUD_COMMIT, "B_C")                     \
+  X(MSG_STATUS, "ST")                           \
+  X(MSG_RGB16_LEDS, "L16")                      \
+  X(MSG_PALETTE_LEDS, "L_P")                     \
+  X(MSG_SPEED_BANK, "S_B")
+
+// longest name (and its terminator)
+#define MSG_NAME_SIZE 6
 
 enum MsgType
 {
-  MSG_ID_RESET = 0,
-  MSG_ID_START = 1,
-  MSG_ID_ACCEPT = 2,
-  MSG_ID_DONE = 3,
-  MSG_POS_REQUEST = 4,
-  MSG_BEGIN_KEYS = 5,
-  MSG_SEND_KEYS = 6,
-  MSG_END_KEYS = 7,
-  MSG_CALIBRATE_START = 8,
-  MSG_CALIBRATE_END = 9,
-  MSG_LOG = 10,
-  MSG_COLOR = 11,
-  MSG_COLOR_ANIMATION = 12,
-  MSG_LED_MODE = 13,
-  MSG_DUMP_LOG_REQUEST = 14,
-  MSG_SLAVE_CONFIG = 15,
-  MSG_BRIGHTNESS = 16,
-  MSG_BOOL_DEBUG_LED_LAYER = 17,
-  MSG_INFORM_STOP_ANIMATION = 19,
-  MSG_WAIT_FOR_ANIMATION = 20,
-  MSG_FOREGROUND_RGB_LEDS = 21,
-  MSG_BACKGROUND_RGB_LEDS = 22,
+#define MSG_TYPE_ENUM(type, name) type,
+  OCLOCK_MSG_TYPES(MSG_TYPE_ENUM)
+#undef MSG_TYPE_ENUM
+  MSG_TYPE_COUNT
 };
+// a tripwire for an insert in the middle of the list
+static_assert(MSG_BRIGHTNESS == 16 && MSG_INFORM_STOP_ANIMATION == 19 && MSG_STATUS == 30, "OCLOCK_MSG_TYPES is append only");
+// every type its own transport counters, the last one is for the unknown types
+static_assert(MSG_TYPE_COUNT < STATS_MSG_TYPES, "STATS_MSG_TYPES has to grow with OCLOCK_MSG_TYPES");
 
 struct UartMessage
 {
@@ -50,14 +107,138 @@ public:
   MsgType getMsgType() const { return (MsgType)msgType; }
   int getDstId() const { return destination_id; }
 
-  UartMessage(uint8_t source_id, MsgType msgType) : source_id(source_id), msgType((u8)msgType), destination_id(ALL_SLAVES) {}
+  UartMessage(uint8_t source_id, MsgType msgType) : source_id(source_id), msgType((u8)msgType), destination_id(Broadcast::id()) {}
   UartMessage(uint8_t source_id, MsgType msgType, uint8_t destination_id) : source_id(source_id), msgType((uint8_t)msgType), destination_id(destination_id) {}
 
   MsgType getMessageType() const
   {
     return (MsgType)msgType;
   }
-} __attribute__((packed, aligned(1)));
+
+  // true if a message of length bytes (see InteropRS485::dispatch_length) has field: older firmware sends less
+  template <class F>
+  bool includes(int length, const F &field) const
+  {
+    return reinterpret_cast<const uint8_t *>(&field + 1) - reinterpret_cast<const uint8_t *>(this) <= length;
+  }
+};
+WIRE_MESSAGE(UartMessage, 3);
+
+/**
+ * Several messages in one frame, every sub-message is prefixed by its length.
+ *
+ * Saves the framing overhead for runs of small messages, see InteropRS485::send_raw.
+ */
+struct UartEnvelopeMessage : public UartMessage
+{
+public:
+  static const uint8_t MAX_PAYLOAD = RECEIVER_BUFFER_SIZE - sizeof(UartMessage);
+  uint8_t payload[MAX_PAYLOAD];
+
+  UartEnvelopeMessage() : UartMessage(-1, MSG_ENVELOPE) {}
+};
+WIRE_FRAME(UartEnvelopeMessage, RECEIVER_BUFFER_SIZE);
+
+/**
+ * An envelope with a sequence number, used in reliable mode (see SequenceTracker).
+ */
+struct UartSeqEnvelopeMessage : public UartMessage
+{
+public:
+  static const uint8_t MAX_PAYLOAD = RECEIVER_BUFFER_SIZE - sizeof(UartMessage) - 1;
+  uint8_t seq;
+  uint8_t payload[MAX_PAYLOAD];
+
+  UartSeqEnvelopeMessage(uint8_t seq) : UartMessage(-1, MSG_SEQ_ENVELOPE), seq(seq) {}
+};
+WIRE_FRAME(UartSeqEnvelopeMessage, RECEIVER_BUFFER_SIZE);
+
+// the number of sequenced envelopes the master keeps for a retransmit (and slaves can report missing)
+#define SEQ_WINDOW 32
+
+/**
+ * Passed along all slaves (like UartPosRequest), every slave adds the sequenced envelopes it is missing.
+ */
+struct UartSeqCheckMessage : public UartMessage
+{
+public:
+  // the sequence number the master will use next
+  uint8_t next_seq;
+  // bit i set: seq (next_seq - 1 - i) is missing
+  LittleEndian<uint32_t> missing;
+
+  UartSeqCheckMessage(uint8_t next_seq) : UartMessage(-1, MSG_SEQ_CHECK, 0), next_seq(next_seq), missing(0) {}
+  UartSeqCheckMessage(u8 source_id, u8 destination_id, uint8_t next_seq, uint32_t missing) : UartMessage(source_id, MSG_SEQ_CHECK, destination_id), next_seq(next_seq), missing(missing) {}
+};
+WIRE_MESSAGE(UartSeqCheckMessage, 3 + 1 + 4);
+
+/**
+ * Baud rate probing (see BaudProbeRequest in master.cpp):
+ *  - MSG_BAUD_PROBE: the slaves switch to baud_rate for window_millis, then fall back to the current baud rate
+ *  - MSG_BAUD_PATTERN: sent 'frames' times by the master during the window, every slave counts the valid ones
+ *  - MSG_BAUD_REPORT: passed along all slaves (like UartPosRequest), every slave reports what it received
+ *  - MSG_BAUD_COMMIT: everyone switches to baud_rate for good
+ */
+struct UartBaudProbeMessage : public UartMessage
+{
+public:
+  LittleEndian<uint32_t> baud_rate;
+  LittleEndian<uint16_t> window_millis;
+  uint8_t frames;
+
+  UartBaudProbeMessage(uint32_t baud_rate, uint16_t window_millis, uint8_t frames) : UartMessage(-1, MSG_BAUD_PROBE), baud_rate(baud_rate), window_millis(window_millis), frames(frames) {}
+};
+WIRE_MESSAGE(UartBaudProbeMessage, 3 + 4 + 2 + 1);
+
+struct UartBaudPatternMessage : public UartMessage
+{
+public:
+  // long enough to catch bit slips, with long runs of 0/1 and alternating bits
+  static const uint8_t SIZE = 24;
+  uint8_t pattern[SIZE];
+
+  static uint8_t expected(uint8_t idx)
+  {
+    static const uint8_t base[] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC};
+    return base[idx & 7] ^ (idx >> 3);
+  }
+  bool valid() const
+  {
+    for (uint8_t idx = 0; idx < SIZE; ++idx)
+      if (pattern[idx] != expected(idx))
+        return false;
+    return true;
+  }
+
+  UartBaudPatternMessage() : UartMessage(-1, MSG_BAUD_PATTERN)
+  {
+    for (uint8_t idx = 0; idx < SIZE; ++idx)
+      pattern[idx] = expected(idx);
+  }
+};
+WIRE_MESSAGE(UartBaudPatternMessage, 3 + UartBaudPatternMessage::SIZE);
+
+struct UartBaudReportMessage : public UartMessage
+{
+public:
+  LittleEndian<uint32_t> baud_rate;
+  // of the sender: valid patterns, and the invalid ones plus receive errors
+  uint8_t received;
+  LittleEndian<uint16_t> errors;
+
+  UartBaudReportMessage(uint32_t baud_rate) : UartMessage(-1, MSG_BAUD_REPORT, 0), baud_rate(baud_rate), received(0), errors(0) {}
+  UartBaudReportMessage(u8 source_id, u8 destination_id, uint32_t baud_rate, uint8_t received, uint16_t errors) : UartMessage(source_id, MSG_BAUD_REPORT, destination_id), baud_rate(baud_rate), received(received), errors(errors) {}
+};
+WIRE_MESSAGE(UartBaudReportMessage, 3 + 4 + 1 + 2);
+
+struct UartBaudCommitMessage : public UartMessage
+{
+public:
+  LittleEndian<uint32_t> baud_rate;
+
+  UartBaudCommitMessage(uint32_t baud_rate) : UartMessage(-1, MSG_BAUD_COMMIT), baud_rate(baud_rate) {}
+};
+WIRE_MESSAGE(UartBaudCommitMessage, 3 + 4);
 
 struct UartBoolMessage : public UartMessage
 {
@@ -65,21 +246,137 @@ public:
   const bool value;
 
   UartBoolMessage(MsgType msgType, bool value) : UartMessage(-1, msgType), value(value) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartBoolMessage, 3 + 1);
 
 struct UartRgbForegroundLedsMessage : public UartMessage
 {
 public:
   oclock::RgbColorLeds leds;
   UartRgbForegroundLedsMessage(const oclock::RgbColorLeds &leds) : UartMessage(-1, MSG_FOREGROUND_RGB_LEDS), leds(leds) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_FRAME(UartRgbForegroundLedsMessage, 3 + 4 * LED_COUNT);
 
 struct UartRgbBackgroundLedsMessage : public UartMessage
 {
 public:
   oclock::RgbColorLeds leds;
   UartRgbBackgroundLedsMessage(const oclock::RgbColorLeds &leds) : UartMessage(-1, MSG_BACKGROUND_RGB_LEDS), leds(leds) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_FRAME(UartRgbBackgroundLedsMessage, 3 + 4 * LED_COUNT);
+
+/**
+ * The compact forms of UartRgbForegroundLedsMessage / UartRgbBackgroundLedsMessage, see Feature::CompactLeds:
+ *  - MSG_RGB16_LEDS: every led as a RgbColor16 (if RgbColor16::fits all of them)
+ *  - MSG_PALETTE_LEDS: the distinct colors once and a 4 bit index per led, exact
+ */
+struct UartRgb16LedsMessage : public UartMessage
+{
+public:
+  uint8_t foreground;
+  LittleEndian<uint16_t> leds[LED_COUNT];
+
+  static bool fits(const oclock::RgbColorLeds &leds)
+  {
+    for (int idx = 0; idx < LED_COUNT; ++idx)
+      if (!oclock::RgbColor16::fits(leds[idx]))
+        return false;
+    return true;
+  }
+
+  UartRgb16LedsMessage(bool foreground, const oclock::RgbColorLeds &leds) : UartMessage(-1, MSG_RGB16_LEDS), foreground(foreground)
+  {
+    for (int idx = 0; idx < LED_COUNT; ++idx)
+      this->leds[idx] = oclock::RgbColor16(leds[idx]).raw;
+  }
+
+  void decode(oclock::RgbColorLeds &leds) const
+  {
+    for (int idx = 0; idx < LED_COUNT; ++idx)
+      leds[idx] = oclock::RgbColor16(this->leds[idx]).color();
+  }
+};
+WIRE_MESSAGE(UartRgb16LedsMessage, 3 + 1 + 2 * LED_COUNT);
+
+struct UartPaletteLedsMessage : public UartMessage
+{
+public:
+  static const uint8_t MAX_COLORS = 16;
+
+  uint8_t foreground;
+  uint8_t count;
+  // 4 bits per led, the even ones in the low nibble
+  uint8_t indices[(LED_COUNT + 1) / 2];
+  // note: only the first count are sent, see size()
+  oclock::RgbColor palette[MAX_COLORS];
+
+  UartPaletteLedsMessage(bool foreground, const oclock::RgbColorLeds &leds) : UartMessage(-1, MSG_PALETTE_LEDS), foreground(foreground), count(0), indices{}
+  {
+    for (int idx = 0; idx < LED_COUNT; ++idx)
+    {
+      uint8_t color = 0;
+      while (color < count && palette[color] != leds[idx])
+        ++color;
+      if (color == count)
+        palette[count++] = leds[idx];
+      indices[idx >> 1] |= (idx & 1) ? color << 4 : color;
+    }
+  }
+
+  byte size() const { return sizeof(*this) - (MAX_COLORS - count) * sizeof(oclock::RgbColor); }
+  bool valid(byte length) const { return count <= MAX_COLORS && length >= size(); }
+
+  void decode(oclock::RgbColorLeds &leds) const
+  {
+    for (int idx = 0; idx < LED_COUNT; ++idx)
+    {
+      const uint8_t color = (indices[idx >> 1] >> ((idx & 1) << 2)) & 0x0F;
+      leds[idx] = color < count ? palette[color] : oclock::RgbColor();
+    }
+  }
+};
+WIRE_FRAME(UartPaletteLedsMessage, 3 + 1 + 1 + (LED_COUNT + 1) / 2 + 4 * UartPaletteLedsMessage::MAX_COLORS);
+static_assert(LED_COUNT <= UartPaletteLedsMessage::MAX_COLORS, "every led has to fit in the palette");
+
+// the protocol on the wire, bump it for a change older firmware can not ignore (otherwise add a Feature)
+#define PROTOCOL_VERSION 2
+// the firmware from before UartAcceptMessage::protocol
+#define LEGACY_PROTOCOL_VERSION 1
+
+/**
+ * Optional parts of the protocol, see UartAcceptMessage::features: the master only uses the ones every slave
+ * on the bus supports, so slaves can be updated one at a time.
+ */
+enum class Feature : uint8_t
+{
+  // sequence numbered envelopes, see MSG_SEQ_ENVELOPE
+  Reliable = 0,
+  // a position poll to the broadcast address is answered in time slots, see response_slot_offset
+  SlottedResponses = 1,
+  // see MSG_BAUD_PROBE
+  BaudProbe = 2,
+  // the positions (and receive errors) of all slaves in one frame, see MSG_STATUS
+  Status = 3,
+  // see MSG_RGB16_LEDS and MSG_PALETTE_LEDS
+  CompactLeds = 4,
+  // the REPEAT keys of the animations, see CmdSpecialMode
+  KeyRepeats = 5,
+  // more speeds than fit in the keys, see CmdSpecialMode::SPEED_BANK and MSG_SPEED_BANK
+  WideSpeeds = 6,
+  // the moves ramp up and down on the slave, see CmdSpecialMode::RAMP
+  Ramps = 7,
+  // see CmdSpecialMode::WAIT_UNTIL
+  Waits = 8,
+  // broadcasts go to ALL_SLAVES instead of LEGACY_ALL_SLAVES, see Broadcast
+  Broadcast = 9,
+};
+#define FEATURE_BIT(feature) (uint16_t(1) << uint8_t(feature))
+
+const uint16_t SUPPORTED_FEATURES = FEATURE_BIT(Feature::Reliable) | FEATURE_BIT(Feature::SlottedResponses) |
+                                    FEATURE_BIT(Feature::BaudProbe) | FEATURE_BIT(Feature::Status) |
+                                    FEATURE_BIT(Feature::CompactLeds) | FEATURE_BIT(Feature::KeyRepeats) |
+                                    FEATURE_BIT(Feature::WideSpeeds) | FEATURE_BIT(Feature::Ramps) |
+                                    FEATURE_BIT(Feature::Waits) | FEATURE_BIT(Feature::Broadcast);
 
 struct UartAcceptMessage : public UartMessage
 {
@@ -87,17 +384,51 @@ private:
   uint8_t assignedId;
 
 public:
+  // framings (see FRAMING_BIT) supported by the sender and everyone before it in the chain
+  uint8_t framings;
+  // receive capacity (see Credits): the frames the slowest slave is able to queue and the time it may need per frame
+  uint8_t rx_frames;
+  LittleEndian<uint16_t> frame_micros;
+  // the lowest protocol version and the features (see FEATURE_BIT) of the sender and everyone before it in the chain
+  uint8_t protocol;
+  LittleEndian<uint16_t> features;
+
+  // the legacy firmware (protocol 1) sends the assigned id only: nibble framing, no receive limit and no features
+  static const uint8_t LEGACY_SIZE = 3 + 1;
+  uint8_t framings_of(int length) const { return includes(length, framings) ? framings : FRAMING_BIT(Framing::Nibble); }
+  uint8_t rx_frames_of(int length) const { return includes(length, rx_frames) ? rx_frames : 0xFF; }
+  uint16_t frame_micros_of(int length) const { return includes(length, frame_micros) ? frame_micros.get() : 0; }
+  uint8_t protocol_of(int length) const { return includes(length, protocol) ? protocol : LEGACY_PROTOCOL_VERSION; }
+  uint16_t features_of(int length) const { return includes(length, features) ? features.get() : 0; }
+
+  // what the slave slave_id passes on: the capabilities it shares with everyone before it in the chain
+  UartAcceptMessage passed_on(int length, uint8_t slave_id) const
+  {
+    const uint8_t frames = rx_frames_of(length);
+    const uint16_t micros = frame_micros_of(length);
+    const uint8_t version = protocol_of(length);
+    return UartAcceptMessage(slave_id, slave_id + 2, framings_of(length) & SUPPORTED_FRAMINGS,
+                             frames < RX_QUEUE_FRAMES - 1 ? frames : RX_QUEUE_FRAMES - 1,
+                             micros > RX_FRAME_MICROS ? micros : RX_FRAME_MICROS,
+                             version < PROTOCOL_VERSION ? version : PROTOCOL_VERSION,
+                             features_of(length) & SUPPORTED_FEATURES);
+  }
+
   int getAssignedId() const { return assignedId; }
-  UartAcceptMessage(uint8_t source_id, uint8_t assignedId) : UartMessage(source_id, MSG_ID_ACCEPT), assignedId(assignedId) {}
-} __attribute__((packed, aligned(1)));
+  UartAcceptMessage(uint8_t source_id, uint8_t assignedId, uint8_t framings = SUPPORTED_FRAMINGS, uint8_t rx_frames = 0xFF, uint16_t frame_micros = 0,
+                    uint8_t protocol = PROTOCOL_VERSION, uint16_t features = SUPPORTED_FEATURES)
+      : UartMessage(source_id, MSG_ID_ACCEPT), assignedId(assignedId), framings(framings), rx_frames(rx_frames), frame_micros(frame_micros),
+        protocol(protocol), features(features) {}
+};
+WIRE_MESSAGE(UartAcceptMessage, UartAcceptMessage::LEGACY_SIZE + 1 + 1 + 2 + 1 + 2);
 
 struct UartSlaveConfigRequest : public UartMessage
 {
 public:
-  int16_t handle_offset0;
-  int16_t handle_offset1;
-  int16_t initial_ticks0;
-  int16_t initial_ticks1;
+  LittleEndian<int16_t> handle_offset0;
+  LittleEndian<int16_t> handle_offset1;
+  LittleEndian<int16_t> initial_ticks0;
+  LittleEndian<int16_t> initial_ticks1;
 
 public:
   UartSlaveConfigRequest(uint8_t destination_id,
@@ -108,17 +439,31 @@ public:
         initial_ticks0(initial_ticks0), initial_ticks1(initial_ticks1)
   {
   }
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartSlaveConfigRequest, 3 + 4 * 2);
 
 struct UartDoneMessage : public UartMessage
 {
 public:
   uint8_t assignedId;
-  uint32_t baud_rate;
+  LittleEndian<uint32_t> baud_rate;
+  // to be used after the baud rate is upgraded, see Framing
+  uint8_t framing;
+  // what the master settled on, see UartAcceptMessage
+  uint8_t protocol;
+  LittleEndian<uint16_t> features;
+
+  // the legacy firmware (protocol 1) sends the assigned id and the baud rate only: nibble framing and no features
+  static const uint8_t LEGACY_SIZE = 3 + 1 + 4;
+  Framing framing_of(int length) const { return includes(length, framing) ? Framing(framing) : Framing::Nibble; }
+  uint8_t protocol_of(int length) const { return includes(length, protocol) ? protocol : LEGACY_PROTOCOL_VERSION; }
+  uint16_t features_of(int length) const { return includes(length, features) ? features.get() : 0; }
 
 public:
-  UartDoneMessage(uint8_t source_id, uint8_t assignedId, uint32_t baud_rate) : UartMessage(source_id, MSG_ID_DONE), assignedId(assignedId), baud_rate(baud_rate) {}
-} __attribute__((packed, aligned(1)));
+  UartDoneMessage(uint8_t source_id, uint8_t assignedId, uint32_t baud_rate, Framing framing, uint8_t protocol, uint16_t features)
+      : UartMessage(source_id, MSG_ID_DONE), assignedId(assignedId), baud_rate(baud_rate), framing(uint8_t(framing)), protocol(protocol), features(features) {}
+};
+WIRE_MESSAGE(UartDoneMessage, UartDoneMessage::LEGACY_SIZE + 1 + 1 + 2);
 
 struct LedModeRequest : public UartMessage
 {
@@ -130,7 +475,8 @@ public:
   oclock::BackgroundEnum get_background_enum() const { return static_cast<oclock::BackgroundEnum>(raw_mode_); }
   LedModeRequest(oclock::BackgroundEnum mode) : UartMessage(-1, MSG_LED_MODE), raw_mode_(int(mode)), foreground(false) {}
   LedModeRequest(oclock::ForegroundEnum mode) : UartMessage(-1, MSG_LED_MODE), raw_mode_(int(mode)), foreground(true) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(LedModeRequest, 3 + 1 + 1);
 
 struct UartLogMessage : public UartMessage
 {
@@ -142,7 +488,23 @@ public:
   bool overflow;
 
   UartLogMessage(uint8_t source_id, uint8_t part, uint8_t total_parts, bool overflow) : UartMessage(source_id, MSG_LOG, -1), part(part), total_parts(total_parts), overflow(overflow) { buffer[0] = 0; }
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartLogMessage, 3 + 24 + 1 + 1 + 1);
+
+/**
+ * Slotted responses: a poll sent to the broadcast address (instead of to the first slave) is not passed along the chain,
+ * every slave answers the master directly in its own slot, (slave id / 2) slots after the poll was received.
+ */
+// covers the latency of the loop of the slave (see RX_FRAME_MICROS) and switching the gate
+#define SLOT_GUARD_MICROS (RX_FRAME_MICROS + 500)
+inline Micros response_slot_micros(const Channel &channel, byte length)
+{
+  return channel.frame_micros(length) + SLOT_GUARD_MICROS;
+}
+inline Micros response_slot_offset(const Channel &channel, byte length, int slave_id)
+{
+  return SLOT_GUARD_MICROS + (slave_id >> 1) * response_slot_micros(channel, length);
+}
 
 struct UartPosRequest : public UartMessage
 {
@@ -151,12 +513,53 @@ public:
   bool stop;
 
   bool initialized;
-  uint16_t pos0;
-  uint16_t pos1;
+  LittleEndian<uint16_t> pos0;
+  LittleEndian<uint16_t> pos1;
 
-  UartPosRequest(bool stop) : UartMessage(-1, MSG_POS_REQUEST, 0), stop(stop), initialized(true), pos0(0), pos1(0) {}
+  UartPosRequest(bool stop, u8 destination_id = 0) : UartMessage(-1, MSG_POS_REQUEST, destination_id), stop(stop), initialized(true), pos0(0), pos1(0) {}
   UartPosRequest(bool stop, u8 source_id, u8 destination_id, uint16_t pos0, uint16_t pos1, bool initialized) : UartMessage(source_id, MSG_POS_REQUEST, destination_id), stop(stop), initialized(initialized), pos0(pos0), pos1(pos1) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartPosRequest, 3 + 1 + 1 + 2 + 2);
+
+/**
+ * The state of the whole wall in one frame: passed along all slaves (like UartPosRequest), every slave fills in
+ * its own record (at slave id / 2) and passes on the grown frame, the last one sends it to the master.
+ * Only the records filled in so far are sent, see size().
+ */
+struct UartStatusMessage : public UartMessage
+{
+public:
+  // bits 0-9: pos0, 10-19: pos1 (ticks / STEP_MULTIPLIER, see UartPosRequest), 20: initialized,
+  // 21-31: receive errors of the slave (saturated)
+  class Record
+  {
+    LittleEndian<uint32_t> bits_;
+
+  public:
+    uint16_t pos0() const { return bits_ & 0x3FF; }
+    uint16_t pos1() const { return (bits_ >> 10) & 0x3FF; }
+    bool initialized() const { return (bits_ >> 20) & 1; }
+    uint16_t errors() const { return bits_ >> 21; }
+
+    void set(uint16_t pos0, uint16_t pos1, bool initialized, uint16_t errors)
+    {
+      bits_ = (uint32_t(pos0) & 0x3FF) | (uint32_t(pos1) & 0x3FF) << 10 | uint32_t(initialized) << 20 | uint32_t(errors) << 21;
+    }
+  };
+  static const uint8_t MAX_RECORDS = MAX_SLAVES;
+  static const uint16_t MAX_ERRORS = (1 << 11) - 1;
+
+  bool stop;
+  uint8_t count;
+  Record records[MAX_RECORDS];
+
+  uint8_t size() const { return sizeof(UartStatusMessage) - sizeof(records) + count * sizeof(Record); }
+
+  UartStatusMessage(bool stop) : UartStatusMessage(stop, -1, 0) {}
+  // note: the records start zeroed (see LittleEndian)
+  UartStatusMessage(bool stop, u8 source_id, u8 destination_id) : UartMessage(source_id, MSG_STATUS, destination_id), stop(stop), count(0) {}
+};
+WIRE_FRAME(UartStatusMessage, 3 + 1 + 1 + 4 * UartStatusMessage::MAX_RECORDS);
 
 struct UartDumpLogsRequest : public UartMessage
 {
@@ -164,20 +567,23 @@ public:
   bool dump_config;
   UartDumpLogsRequest(bool dump_config) : UartMessage(-1, MSG_DUMP_LOG_REQUEST, 0), dump_config(dump_config) {}
   UartDumpLogsRequest(bool dump_config, u8 source_id, u8 destination_id) : UartMessage(source_id, MSG_DUMP_LOG_REQUEST, destination_id), dump_config(dump_config) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartDumpLogsRequest, 3 + 1);
 
 struct UartInformToStopAnimationRequest : public UartMessage
 {
 public:
   UartInformToStopAnimationRequest() : UartMessage(-1, MSG_INFORM_STOP_ANIMATION) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartInformToStopAnimationRequest, 3);
 
 struct UartWaitUntilAnimationIsDoneRequest : public UartMessage
 {
 public:
   UartWaitUntilAnimationIsDoneRequest() : UartMessage(-1, MSG_WAIT_FOR_ANIMATION, 0) {}
   UartWaitUntilAnimationIsDoneRequest(u8 source_id, u8 destination_id) : UartMessage(source_id, MSG_WAIT_FOR_ANIMATION, destination_id) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartWaitUntilAnimationIsDoneRequest, 3);
 
 struct UartScaledBrightnessMessage : public UartMessage
 {
@@ -186,7 +592,8 @@ public:
   const uint8_t scaled_brightness;
 
   UartScaledBrightnessMessage(uint8_t scaled_brightness) : UartMessage(-1, MSG_BRIGHTNESS), scaled_brightness(scaled_brightness) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartScaledBrightnessMessage, 3 + 1);
 
 struct UartColorMessage : public UartMessage
 {
@@ -194,59 +601,27 @@ public:
   oclock::RgbColor color;
 
   UartColorMessage(const oclock::RgbColor &c) : UartMessage(-1, MSG_COLOR), color(c) {}
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartColorMessage, 3 + 4);
 
 class InteropStringifier
 {
 public:
   static const __FlashStringHelper *asF(const MsgType &type)
   {
-    switch (type)
-    {
-    case MSG_ID_RESET:
-      return F("ID_R");
-    case MSG_ID_START:
-      return F("ID_S");
-    case MSG_ID_ACCEPT:
-      return F("ID_A");
-    case MSG_ID_DONE:
-      return F("ID_D");
-    case MSG_POS_REQUEST:
-      return F("POS");
-    case MSG_BEGIN_KEYS:
-      return F("B_KS");
-    case MSG_SEND_KEYS:
-      return F("S_KS");
-    case MSG_END_KEYS:
-      return F("E_KS");
-    case MSG_CALIBRATE_START:
-      return F("C_S");
-    case MSG_CALIBRATE_END:
-      return F("C_E");
-    case MSG_COLOR:
-      return F("C");
-    case MSG_COLOR_ANIMATION:
-      return F("C_A");
-    case MSG_LOG:
-      return F("LOG");
-    case MSG_LED_MODE:
-      return F("L_M");
-    case MSG_DUMP_LOG_REQUEST:
-      return F("D_L");
-    case MSG_SLAVE_CONFIG:
-      return F("C");
-    case MSG_INFORM_STOP_ANIMATION:
-      return F("I_S_A");
-    case MSG_WAIT_FOR_ANIMATION:
-      return F("W_F_A");
-    default:
+    static const char names[MSG_TYPE_COUNT][MSG_NAME_SIZE] PROGMEM = {
+#define MSG_TYPE_NAME(type, name) name,
+        OCLOCK_MSG_TYPES(MSG_TYPE_NAME)
+#undef MSG_TYPE_NAME
+    };
+    if (uint8_t(type) >= MSG_TYPE_COUNT || pgm_read_byte(names[type]) == 0)
       return F("MSG?");
-    }
+    return reinterpret_cast<const __FlashStringHelper *>(names[type]);
   }
 
   static const __FlashStringHelper *asIdF(int id)
   {
-    if (id == ALL_SLAVES)
+    if (Broadcast::is(id))
       return F("*");
     if (id == 0xFF)
       return F("M");
@@ -310,17 +685,24 @@ public:
                   __VA_ARGS__)
 
     case MSG_ID_ACCEPT:
-      DEF_PRINT(">%S", asIdF(reinterpret_cast<const UartAcceptMessage *>(msg)->getAssignedId()));
-      break;
+    {
+      auto acceptMsg = reinterpret_cast<const UartAcceptMessage *>(msg);
+      DEF_PRINT(">%S framings=%d rx_frames=%d frame_micros=%d protocol=%d features=%04x", asIdF(acceptMsg->getAssignedId()), acceptMsg->framings, acceptMsg->rx_frames, int(acceptMsg->frame_micros),
+                acceptMsg->protocol_of(length), acceptMsg->features_of(length));
+    }
+    break;
 
     case MSG_ID_DONE:
-      DEF_PRINT(">%S", asIdF(reinterpret_cast<const UartDoneMessage *>(msg)->assignedId));
-      break;
+    {
+      auto doneMsg = reinterpret_cast<const UartDoneMessage *>(msg);
+      DEF_PRINT(">%S framing=%d protocol=%d features=%04x", asIdF(doneMsg->assignedId), doneMsg->framing, doneMsg->protocol_of(length), doneMsg->features_of(length));
+    }
+    break;
 
     case MSG_POS_REQUEST:
     {
       auto posMsg = reinterpret_cast<const UartPosRequest *>(msg);
-      DEF_PRINT(">(%d, %d)", posMsg->pos0, posMsg->pos1);
+      DEF_PRINT(">(%d, %d)", int(posMsg->pos0), int(posMsg->pos1));
     }
     break;
 
@@ -331,12 +713,54 @@ public:
     }
     break;
 
+    case MSG_SEQ_ENVELOPE:
+    {
+      auto envelopeMsg = reinterpret_cast<const UartSeqEnvelopeMessage *>(msg);
+      DEF_PRINT(" seq=%d", envelopeMsg->seq);
+    }
+    break;
+
+    case MSG_SEQ_CHECK:
+    {
+      auto checkMsg = reinterpret_cast<const UartSeqCheckMessage *>(msg);
+      DEF_PRINT(" next_seq=%d missing=%08lx", checkMsg->next_seq, (unsigned long)checkMsg->missing);
+    }
+    break;
+
+    case MSG_BAUD_PROBE:
+    {
+      auto probeMsg = reinterpret_cast<const UartBaudProbeMessage *>(msg);
+      DEF_PRINT(" baud=%ld window=%d frames=%d", (long)probeMsg->baud_rate, int(probeMsg->window_millis), probeMsg->frames);
+    }
+    break;
+
+    case MSG_BAUD_REPORT:
+    {
+      auto reportMsg = reinterpret_cast<const UartBaudReportMessage *>(msg);
+      DEF_PRINT(" baud=%ld received=%d errors=%d", (long)reportMsg->baud_rate, reportMsg->received, int(reportMsg->errors));
+    }
+    break;
+
+    case MSG_STATUS:
+    {
+      auto statusMsg = reinterpret_cast<const UartStatusMessage *>(msg);
+      DEF_PRINT(" stop=%d count=%d", statusMsg->stop, statusMsg->count);
+    }
+    break;
+
+    case MSG_BAUD_COMMIT:
+    {
+      auto commitMsg = reinterpret_cast<const UartBaudCommitMessage *>(msg);
+      DEF_PRINT(" baud=%ld", (long)commitMsg->baud_rate);
+    }
+    break;
+
     case MSG_SLAVE_CONFIG:
     {
       auto configMsg = reinterpret_cast<const UartSlaveConfigRequest *>(msg);
       DEF_PRINT(" handle_offset(%d, %d) initial_ticks(%d, %d)",
-                configMsg->handle_offset0, configMsg->handle_offset1,
-                configMsg->initial_ticks0, configMsg->initial_ticks1);
+                int(configMsg->handle_offset0), int(configMsg->handle_offset1),
+                int(configMsg->initial_ticks0), int(configMsg->initial_ticks1));
     }
     break;
 
@@ -348,23 +772,262 @@ public:
   }
 };
 
-#ifdef ESP8266
-typedef std::function<bool(const UartMessage *msg)> InteropRS485ReceiverFuncPtr;
-#else
-typedef bool (*InteropRS485ReceiverFuncPtr)(const UartMessage *msg);
+// returns false if the message is not accepted
+typedef bool (*MessageHandler)(const UartMessage *msg);
+
+struct MessageRoute
+{
+  MsgType type;
+  MessageHandler handler;
+};
+
+// adapts the handler of one message (e.g. do_color_request) to a MessageHandler that accepts it
+template <class M, void (*Do)(const M *)>
+bool handle(const UartMessage *msg)
+{
+  Do(reinterpret_cast<const M *>(msg));
+  return true;
+}
+
+template <void (*Do)()>
+bool handle(const UartMessage *)
+{
+  Do();
+  return true;
+}
+
+// the rows of every dispatch table, one per message type
+#define DISPATCH_TYPES 40
+static_assert(MSG_TYPE_COUNT <= DISPATCH_TYPES, "DISPATCH_TYPES is too small");
+
+#define DISPATCH_ROW(type) find(type, routes, N, fallback)
+#define DISPATCH_ROWS8(base)                                                  \
+  DISPATCH_ROW(base), DISPATCH_ROW(base + 1), DISPATCH_ROW(base + 2),         \
+      DISPATCH_ROW(base + 3), DISPATCH_ROW(base + 4), DISPATCH_ROW(base + 5), \
+      DISPATCH_ROW(base + 6), DISPATCH_ROW(base + 7)
+
+/**
+ * The message handlers of one lifecycle phase, indexed by MsgType.
+ *
+ * Built at compile time from a list of routes and kept in flash, so a dispatch is a bounds check and a load:
+ *
+ *   constexpr MessageRoute mainRoutes[] = {{MSG_COLOR, on_color}, ...};
+ *   constexpr DispatchTable mainTable PROGMEM = DispatchTable::make(mainRoutes);
+ *
+ * A type without a route (or out of range) goes to the fallback, if any.
+ */
+struct DispatchTable
+{
+  MessageHandler handlers[DISPATCH_TYPES];
+  MessageHandler fallback;
+
+  MessageHandler handler(uint8_t type) const
+  {
+    return reinterpret_cast<MessageHandler>(pgm_read_ptr(type < DISPATCH_TYPES ? handlers + type : &fallback));
+  }
+
+  template <size_t N>
+  static constexpr DispatchTable make(const MessageRoute (&routes)[N], MessageHandler fallback = nullptr)
+  {
+    return DispatchTable{{DISPATCH_ROWS8(0), DISPATCH_ROWS8(8), DISPATCH_ROWS8(16), DISPATCH_ROWS8(24), DISPATCH_ROWS8(32)}, fallback};
+  }
+
+private:
+  // note: a single return, so it is constexpr in C++11 as well (the slave)
+  static constexpr MessageHandler find(uint8_t type, const MessageRoute *routes, size_t count, MessageHandler fallback)
+  {
+    return count == 0 ? fallback : routes->type == type ? routes->handler
+                                                        : find(type, routes + 1, count - 1, fallback);
+  }
+};
+static_assert(DISPATCH_TYPES == 5 * 8, "DispatchTable::make has a row per type");
+#undef DISPATCH_ROW
+#undef DISPATCH_ROWS8
+
+#ifdef MASTER_MODE
+// max time a message waits in the envelope
+#define COALESCE_MILLIS 5
 #endif
 
+/**
+ * Receiving side of the reliable mode: keeps track of the sequenced envelopes that are missing.
+ *
+ * Envelopes are only processed in order: an envelope for us after a gap is deferred (reported missing as well),
+ * so the master only has to resend the missing ones. Bit (seq % SEQ_WINDOW) of missing_ is set if seq is missing,
+ * base_ is the oldest missing seq (or next_ if nothing is missing).
+ */
+class SequenceTracker
+{
+  bool synced_{false};
+  uint8_t base_{0}, next_{0};
+  uint32_t missing_{0};
+
+  static uint32_t bit(uint8_t seq) { return uint32_t(1) << (seq % SEQ_WINDOW); }
+
+  void advance()
+  {
+    while (base_ != next_ && !(missing_ & bit(base_)))
+      base_++;
+  }
+
+  // everything up to seq (exclusive) we did not see is missing, as long as that fits in window
+  void skip_to(uint8_t seq, uint8_t window = SEQ_WINDOW)
+  {
+    if (uint8_t(seq - base_) > window)
+    {
+      // too much missing, give up on all of them (up to and including seq - 1)
+      lost_++;
+      missing_ = 0;
+      base_ = next_ = seq;
+    }
+    for (; next_ != seq; next_++)
+      missing_ |= bit(next_);
+  }
+
+public:
+  // number of times the window was exceeded (so envelopes are lost)
+  uint16_t lost_{0};
+
+  void reset()
+  {
+    synced_ = false;
+    missing_ = 0;
+  }
+
+  // returns true if the envelope should be processed now
+  bool receive(uint8_t seq, bool for_me)
+  {
+    if (!synced_)
+    {
+      synced_ = true;
+      base_ = next_ = seq;
+    }
+    if (uint8_t(seq - next_) < 128)
+    {
+      // a new one, the ones before it we did not see are missing (this one has to fit in the window as well)
+      skip_to(seq, SEQ_WINDOW - 1);
+      missing_ |= bit(seq);
+      next_ = seq + 1;
+    }
+    else if (uint8_t(seq - base_) >= uint8_t(next_ - base_) || !(missing_ & bit(seq)))
+    {
+      // duplicate
+      return false;
+    }
+
+    if (seq == base_)
+    {
+      missing_ &= ~bit(seq);
+      advance();
+      return true;
+    }
+    // there is a gap before this one: wait for it, but only if it concerns us
+    if (!for_me)
+      missing_ &= ~bit(seq);
+    return false;
+  }
+
+  // the missing ones relative to next_seq (see UartSeqCheckMessage)
+  uint32_t report(uint8_t next_seq)
+  {
+    if (!synced_)
+      return 0;
+    if (uint8_t(next_seq - next_) < 128)
+      skip_to(next_seq);
+    uint32_t ret = 0;
+    for (uint8_t seq = base_; seq != next_; seq++)
+    {
+      const uint8_t idx = next_seq - 1 - seq;
+      if ((missing_ & bit(seq)) && idx < SEQ_WINDOW)
+        ret |= uint32_t(1) << idx;
+    }
+    return ret;
+  }
+};
+
+// the sizes of the messages in interop.keys.h (checked there), for wire_length
+#define KEYS_WIRE_SIZE (3 + 1 + 2 * 14)
+#define END_KEYS_WIRE_SIZE (3 + 4 + 1 + 1 + 8 + 8)
+#define SPEED_BANK_WIRE_SIZE (3 + 1 + 8)
+
+// the shortest and longest a message of one type is on the wire (envelopes are checked by their content)
+struct WireLength
+{
+  uint8_t min, max;
+
+  bool fits(byte length) const { return min <= length && length <= max; }
+};
+
+inline WireLength wire_length(MsgType type)
+{
+  switch (type)
+  {
+  case MSG_ID_ACCEPT:
+    return {UartAcceptMessage::LEGACY_SIZE, sizeof(UartAcceptMessage)};
+  case MSG_ID_DONE:
+    return {UartDoneMessage::LEGACY_SIZE, sizeof(UartDoneMessage)};
+  case MSG_POS_REQUEST:
+    return {sizeof(UartPosRequest), sizeof(UartPosRequest)};
+  case MSG_SEND_KEYS:
+    return {KEYS_WIRE_SIZE, KEYS_WIRE_SIZE};
+  case MSG_END_KEYS:
+    return {END_KEYS_WIRE_SIZE, END_KEYS_WIRE_SIZE};
+  case MSG_LOG:
+    return {sizeof(UartLogMessage), sizeof(UartLogMessage)};
+  case MSG_COLOR:
+    return {sizeof(UartColorMessage), sizeof(UartColorMessage)};
+  case MSG_LED_MODE:
+    return {sizeof(LedModeRequest), sizeof(LedModeRequest)};
+  case MSG_DUMP_LOG_REQUEST:
+    return {sizeof(UartDumpLogsRequest), sizeof(UartDumpLogsRequest)};
+  case MSG_SLAVE_CONFIG:
+    return {sizeof(UartSlaveConfigRequest), sizeof(UartSlaveConfigRequest)};
+  case MSG_BRIGHTNESS:
+    return {sizeof(UartScaledBrightnessMessage), sizeof(UartScaledBrightnessMessage)};
+  case MSG_BOOL_DEBUG_LED_LAYER:
+    return {sizeof(UartBoolMessage), sizeof(UartBoolMessage)};
+  case MSG_FOREGROUND_RGB_LEDS:
+    return {sizeof(UartRgbForegroundLedsMessage), sizeof(UartRgbForegroundLedsMessage)};
+  case MSG_BACKGROUND_RGB_LEDS:
+    return {sizeof(UartRgbBackgroundLedsMessage), sizeof(UartRgbBackgroundLedsMessage)};
+  case MSG_SEQ_CHECK:
+    return {sizeof(UartSeqCheckMessage), sizeof(UartSeqCheckMessage)};
+  case MSG_BAUD_PROBE:
+    return {sizeof(UartBaudProbeMessage), sizeof(UartBaudProbeMessage)};
+  case MSG_BAUD_PATTERN:
+    return {sizeof(UartBaudPatternMessage), sizeof(UartBaudPatternMessage)};
+  case MSG_BAUD_REPORT:
+    return {sizeof(UartBaudReportMessage), sizeof(UartBaudReportMessage)};
+  case MSG_BAUD_COMMIT:
+    return {sizeof(UartBaudCommitMessage), sizeof(UartBaudCommitMessage)};
+  case MSG_STATUS:
+    return {sizeof(UartStatusMessage) - sizeof(UartStatusMessage::records), sizeof(UartStatusMessage)};
+  case MSG_RGB16_LEDS:
+    return {sizeof(UartRgb16LedsMessage), sizeof(UartRgb16LedsMessage)};
+  case MSG_PALETTE_LEDS:
+    return {sizeof(UartPaletteLedsMessage) - sizeof(oclock::RgbColor) * UartPaletteLedsMessage::MAX_COLORS, sizeof(UartPaletteLedsMessage)};
+  case MSG_SPEED_BANK:
+    return {SPEED_BANK_WIRE_SIZE, SPEED_BANK_WIRE_SIZE};
+  default:
+    // the header only (e.g. MSG_ID_RESET, MSG_BEGIN_KEYS)
+    return {sizeof(UartMessage), sizeof(UartMessage)};
+  }
+}
+// a tripwire for a new type without its length
+static_assert(MSG_TYPE_COUNT == MSG_SPEED_BANK + 1, "wire_length has to know the length of a new message type");
+
 class InteropRS485 : public Channel
 {
 private:
   /**
    * owner_id:
    * if -1/0xFF accept all messages: NB: filtering should be done by the listener ( master )
-   * if ALL_SLAVES broadcast address
+   * if ALL_SLAVES not assigned yet (only broadcasts)
    * otherwise
    */
   uint8_t owner_id_{ALL_SLAVES};
-  InteropRS485ReceiverFuncPtr listener_{nullptr};
+  const DispatchTable *table_{nullptr};
+  byte dispatchLength_{0};
 
   inline bool for_me(int destination_id) const
   {
@@ -375,7 +1038,7 @@ private:
     if (destination_id == owner_id_)
       return true;
     // broad cast?
-    if (destination_id == ALL_SLAVES)
+    if (Broadcast::is(destination_id))
       return true;
     // slave responses also to the sub handle
     if (destination_id >= 0 && destination_id == owner_id_ + 1)
@@ -384,55 +1047,400 @@ private:
   }
 
 protected:
+  // note: called by the receiver, so no logging here
+  bool accept(const byte *bytes, const byte length) const override
+  {
+    auto msg = (const UartMessage *)bytes;
+    // ignore mine (echo) and the ones not for me
+    return msg->getSourceId() != owner_id_ && for_me(msg->getDstId());
+  }
+
+  // see Channel::plausible, note: called by the receiver as well: a known type with its length on the wire
+  bool plausible(const byte *bytes, const byte length) const override
+  {
+    auto msg = (const UartMessage *)bytes;
+    if (length < sizeof(UartMessage) || uint8_t(msg->getMsgType()) >= MSG_TYPE_COUNT)
+      return false;
+    switch (msg->getMsgType())
+    {
+    case MsgType::MSG_ENVELOPE:
+      return plausible_payload(bytes, sizeof(UartMessage), length);
+    case MsgType::MSG_SEQ_ENVELOPE:
+      return plausible_payload(bytes, sizeof(UartSeqEnvelopeMessage) - UartSeqEnvelopeMessage::MAX_PAYLOAD, length);
+    default:
+      return wire_length(msg->getMsgType()).fits(length);
+    }
+  }
+
+  // the sub-messages of an envelope (see unpack) fill it exactly and are plausible themselves
+  bool plausible_payload(const byte *bytes, byte idx, const byte length) const
+  {
+    if (idx >= length)
+      return false;
+    while (idx < length)
+    {
+      const byte subLength = bytes[idx++];
+      if (idx + subLength > length || !plausible(bytes + idx, subLength))
+        return false;
+      idx += subLength;
+    }
+    return true;
+  }
+
   void process(const byte *bytes, const byte length) override
   {
     auto msg = (const UartMessage *)bytes;
-    if (msg->getSourceId() == owner_id_)
+    switch (msg->getMsgType())
+    {
+    case MsgType::MSG_ENVELOPE:
+      unpack(msg, sizeof(UartMessage), length, true);
+      break;
+
+    case MsgType::MSG_SEQ_ENVELOPE:
     {
-      LOG_MESSAGED("IGN (mine)", msg, length);
+      const auto seq = reinterpret_cast<const UartSeqEnvelopeMessage *>(msg)->seq;
+      // first check, then dispatch
+      const bool for_me = unpack(msg, sizeof(UartSeqEnvelopeMessage) - UartSeqEnvelopeMessage::MAX_PAYLOAD, length, false);
+      if (sequence_tracker_.receive(seq, for_me))
+        unpack(msg, sizeof(UartSeqEnvelopeMessage) - UartSeqEnvelopeMessage::MAX_PAYLOAD, length, true);
+      else
+        LOG_MESSAGED("DEFER", msg, length);
     }
-    else if (!for_me(msg->getDstId())) //(owner_id_ != 0xFF) && (msg->getDstId() != owner_id_) && (msg->getDstId() != ALL_SLAVES))
+    break;
+
+    default:
+      dispatch(msg, length);
+      break;
+    }
+  }
+
+  // returns true if there is a sub-message for us, note: the envelope itself is accepted, so check every sub-message
+  bool unpack(const UartMessage *msg, byte idx, const byte length, bool do_dispatch)
+  {
+    auto bytes = (const byte *)msg;
+    bool ret = false;
+    while (idx < length)
     {
-      LOG_MESSAGED("IGN (not for me)", msg, length);
+      const byte subLength = bytes[idx++];
+      if (subLength < sizeof(UartMessage) || idx + subLength > length)
+      {
+        LOG_MESSAGEW("BAD ENV", msg, length);
+        return ret;
+      }
+      if (accept(bytes + idx, subLength))
+      {
+        ret = true;
+        if (do_dispatch)
+          dispatch((const UartMessage *)(bytes + idx), subLength);
+      }
+      idx += subLength;
     }
+    return ret;
+  }
+
+  void dispatch(const UartMessage *msg, const byte length)
+  {
+    LOG_MESSAGED("do", msg, length);
+    dispatchLength_ = length;
+    const MessageHandler handler = table_ ? table_->handler(msg->getMsgType()) : nullptr;
+    bool accepted = handler ? handler(msg) : false;
+    if (!accepted)
+      LOG_MESSAGEW("NOT ACCEPT", msg, length);
+  }
+
+  SequenceTracker sequence_tracker_;
+
+#ifdef MASTER_MODE
+  // messages waiting to be sent as one frame
+  UartEnvelopeMessage envelope_;
+  uint8_t envelopeLength_{0};
+  Millis envelopeStart_{0};
+
+  // reliable mode: every envelope gets a sequence number and is kept for a retransmit
+  bool reliable_{false};
+  uint8_t next_seq_{0};
+  std::vector<UartSeqEnvelopeMessage> sent_;
+  uint8_t sent_lengths_[SEQ_WINDOW] = {};
+  uint32_t resent_{0};
+
+  uint8_t max_payload() const { return reliable_ ? UartSeqEnvelopeMessage::MAX_PAYLOAD : UartEnvelopeMessage::MAX_PAYLOAD; }
+
+  void flush_pending() override
+  {
+    if (envelopeLength_ == 0)
+      return;
+
+    const uint8_t length = envelopeLength_;
+    envelopeLength_ = 0;
+    if (reliable_)
+    {
+      const uint8_t seq = next_seq_++;
+      auto &frame = sent_[seq % SEQ_WINDOW];
+      frame = UartSeqEnvelopeMessage(seq);
+      memcpy(frame.payload, envelope_.payload, length);
+      sent_lengths_[seq % SEQ_WINDOW] = sizeof(UartSeqEnvelopeMessage) - UartSeqEnvelopeMessage::MAX_PAYLOAD + length;
+      _send((const byte *)&frame, sent_lengths_[seq % SEQ_WINDOW]);
+    }
+    else if (envelope_.payload[0] + 1 == length)
+      // only one, no need for an envelope
+      _send(envelope_.payload + 1, envelope_.payload[0]);
     else
     {
-      if (msg->getMsgType() == MsgType::MSG_LOG || msg->getMsgType() == MsgType::MSG_DUMP_LOG_REQUEST)
-        LOG_MESSAGED("do", msg, length);
-      else
-        LOG_MESSAGED("do", msg, length);
-      bool accepted = listener_ ? listener_(msg) : false;
-      if (!accepted)
-        LOG_MESSAGEW("NOT ACCEPT", msg, length);
+      // to the broadcast address of now, see set_broadcast
+      static_cast<UartMessage &>(envelope_) = UartMessage(-1, MSG_ENVELOPE);
+      _send((const byte *)&envelope_, sizeof(UartMessage) + length);
     }
   }
+#endif
 
 public:
   InteropRS485(uint8_t owner_id, Gate &gate, Buffer &buffer) : Channel(gate, buffer), owner_id_(owner_id) {}
 
   void setOwnerId(int id) { owner_id_ = id; }
 
+  // see Broadcast: the messages sent so far keep the old address
+  void set_broadcast(bool wide)
+  {
+    flush_pending();
+    Broadcast::set_wide(wide);
+  }
+
   void send_raw(const UartMessage *msg, int bytes)
   {
     if (msg->getMsgType() == MsgType::MSG_DUMP_LOG_REQUEST)
       LOG_MESSAGED("S", msg, bytes);
     else
       LOG_MESSAGEI("S", msg, bytes);
+#ifdef MASTER_MODE
+    // coalesce, the envelope will be sent when full, before receiving or after COALESCE_MILLIS (see loop_coalescer)
+    if (bytes < max_payload())
+    {
+      if (envelopeLength_ + 1 + bytes > max_payload())
+        flush_pending();
+      if (envelopeLength_ == 0)
+        envelopeStart_ = millis();
+      envelope_.payload[envelopeLength_++] = bytes;
+      memcpy(envelope_.payload + envelopeLength_, msg, bytes);
+      envelopeLength_ += bytes;
+      return;
+    }
+    flush_pending();
+#endif
     _send((byte *)msg, bytes);
   }
 
+#ifdef MASTER_MODE
+  void loop_coalescer(Millis now)
+  {
+    if (envelopeLength_ > 0 && now - envelopeStart_ >= COALESCE_MILLIS)
+      flush_pending();
+  }
+
+  void set_reliable(bool value)
+  {
+    flush_pending();
+    reliable_ = value;
+    if (reliable_)
+      sent_.resize(SEQ_WINDOW, UartSeqEnvelopeMessage(0));
+  }
+  bool is_reliable() const { return reliable_; }
+  // see WireEstimate
+  uint8_t coalesce_limit() const { return max_payload(); }
+  uint8_t envelope_overhead() const { return reliable_ ? sizeof(UartSeqEnvelopeMessage) - UartSeqEnvelopeMessage::MAX_PAYLOAD : sizeof(UartMessage); }
+  uint32_t get_resent() const { return resent_; }
+
+  // the slaves will report what they are missing (see MSG_SEQ_CHECK)
+  void send_sequence_check()
+  {
+    flush_pending();
+    UartSeqCheckMessage msg(next_seq_);
+    LOG_MESSAGEI("S", &msg, sizeof(msg));
+    _send(msg);
+  }
+
+  // sent as is: not coalesced and without a sequence number (e.g. while probing baud rates)
+  template <class M>
+  void send_direct(const M &msg)
+  {
+    flush_pending();
+    LOG_MESSAGED("S", &msg, sizeof(M));
+    _send(msg);
+  }
+
+  // see TxPriority: written before the queued frames, not coalesced and without a sequence number
+  void send_control(const UartMessage *msg, byte length)
+  {
+    LOG_MESSAGEI("C", msg, length);
+    _send((const byte *)msg, length, TxPriority::Control);
+  }
+
+  // returns the number of envelopes sent again
+  int resend_missing(const UartSeqCheckMessage *msg)
+  {
+    int count = 0;
+    // oldest first
+    for (int idx = SEQ_WINDOW - 1; idx >= 0; --idx)
+    {
+      if (!(msg->missing & (uint32_t(1) << idx)))
+        continue;
+      const uint8_t seq = msg->next_seq - 1 - idx;
+      if (!reliable_ || uint8_t(next_seq_ - seq) > SEQ_WINDOW || uint8_t(next_seq_ - seq) == 0)
+      {
+        ESP_LOGE(TAG, "seq=%d no longer available", seq);
+        continue;
+      }
+      ESP_LOGW(TAG, "resend seq=%d", seq);
+      _send((const byte *)&sent_[seq % SEQ_WINDOW], sent_lengths_[seq % SEQ_WINDOW]);
+      count++;
+    }
+    resent_ += count;
+    return count;
+  }
+#endif
+
+  // see UartSeqCheckMessage
+  uint32_t missing_sequences(uint8_t next_seq) { return sequence_tracker_.report(next_seq); }
+  void reset_sequence()
+  {
+    sequence_tracker_.reset();
+#ifdef MASTER_MODE
+    set_reliable(false);
+    next_seq_ = 0;
+#endif
+  }
+
   template <class M>
   void send(const M &msg)
   {
     send_raw(&msg, sizeof(M));
   }
 
-  void set_listener(InteropRS485ReceiverFuncPtr listener)
+  // the length of the message being dispatched, e.g. the shorter UartAcceptMessage of older firmware
+  byte dispatch_length() const { return dispatchLength_; }
+
+  // the handlers of the current phase, note: the table has to outlive the phase (e.g. a constexpr in flash)
+  void set_dispatch(const DispatchTable &table)
+  {
+    table_ = &table;
+  }
+};
+
+#ifdef MASTER_MODE
+/**
+ * The wire time of a run of messages, sent the way InteropRS485::send_raw will send them: small ones are coalesced
+ * into envelopes and every frame costs its framing at the current baud rate or, with flow control, at least the
+ * frame time of the slaves (see Credits).
+ */
+class WireEstimate
+{
+  const InteropRS485 &channel_;
+  // coalesced bytes (length prefixes included) and the length of the first message
+  uint8_t envelope_{0}, first_{0};
+  uint16_t frames_{0};
+  Micros micros_{0};
+
+  void frame(byte length)
+  {
+    Micros micros = channel_.frame_micros(length);
+    const auto &credits = channel_.tx_queue().credits();
+    if (credits.capacity() > 0 && credits.frame_micros() > micros)
+      micros = credits.frame_micros();
+    micros_ += micros;
+    frames_++;
+  }
+
+  void flush()
+  {
+    if (envelope_ == 0)
+      return;
+    if (!channel_.is_reliable() && first_ + 1 == envelope_)
+      // only one, no need for an envelope
+      frame(first_);
+    else
+      frame(channel_.envelope_overhead() + envelope_);
+    envelope_ = 0;
+  }
+
+public:
+  explicit WireEstimate(const InteropRS485 &channel) : channel_(channel) {}
+
+  // see InteropRS485::send_raw
+  void add(int bytes)
   {
-    listener_ = listener;
+    const uint8_t max_payload = channel_.coalesce_limit();
+    if (bytes < max_payload)
+    {
+      if (envelope_ + 1 + bytes > max_payload)
+        flush();
+      if (envelope_ == 0)
+        first_ = bytes;
+      envelope_ += 1 + bytes;
+      return;
+    }
+    flush();
+    frame(bytes);
+  }
+
+  template <class M>
+  void add() { add(sizeof(M)); }
+
+  // see InteropRS485::send_sequence_check
+  void add_sequence_check()
+  {
+    if (!channel_.is_reliable())
+      return;
+    flush();
+    frame(sizeof(UartSeqCheckMessage));
+  }
+
+  uint16_t frames()
+  {
+    flush();
+    return frames_;
+  }
+
+  // until the gate is turned around after the last frame
+  Micros micros(Micros turnaround)
+  {
+    flush();
+    return micros_ + turnaround;
   }
 };
 
+// on top of the slots, the poll itself might still be queued
+#define SLOTTED_MARGIN_MILLIS 50
+
+/**
+ * The master side of slotted responses (see response_slot_offset): the number of responses still expected to a poll
+ * sent to the broadcast address and until when they may come.
+ */
+struct SlottedPoll
+{
+  int pending{0};
+  Millis deadline{0};
+
+  // a poll of every slave (up to slave_ids, the next id to assign) is about to be queued, returns its destination
+  uint8_t arm(const InteropRS485 &channel, byte response_length, int slave_ids, Millis now)
+  {
+    const Micros slots = response_slot_offset(channel, response_length, slave_ids);
+    const Micros queued = channel.tx_queue().size() * 10 * 1000000UL / channel.get_baud_rate();
+    pending = slave_ids >> 1;
+    deadline = now + (queued + slots) / 1000 + SLOTTED_MARGIN_MILLIS;
+    return Broadcast::id();
+  }
+
+  bool armed() const { return pending > 0; }
+  // true for the last (or only) response
+  bool last_response()
+  {
+    if (!armed())
+      return true;
+    return --pending == 0;
+  }
+  bool expired(Millis now) const { return armed() && long(now - deadline) > 0; }
+};
+#endif
+
 #ifdef ESP8266
 namespace oclock
 {
@@ -449,9 +1457,12 @@ namespace oclock
   class ChannelRequest
   {
   private:
-    void send_raw(const UartMessage *msg, const byte length);
     const std::string alias_;
 
+  protected:
+    // e.g. for a message with a variable size
+    void send_raw(const UartMessage *msg, const byte length);
+
   public:
     ChannelRequest(const std::string &alias) : alias_(alias) {}
     template <typename M>
@@ -471,6 +1482,9 @@ namespace oclock
   public:
     // 'execute' is called when the slaves are initialized
     virtual void execute() = 0;
+    // 'step' is called after 'execute' and then every loop until it returns true, for a request that has to wait
+    // (e.g. until the slaves switched the baud rate): it must not block, nothing else is sent in the meantime
+    virtual bool step(Millis now) { return true; }
   };
 
   class BroadcastRequest : public ChannelRequest
@@ -481,6 +1495,8 @@ namespace oclock
   public:
     // 'execute' is called when the slaves are initialized
     virtual void execute() = 0;
+    // see ExecuteRequest::step, the response is waited for once it returns true
+    virtual bool step(Millis now) { return true; }
 
     // 'finalize' is called only if broadcast is completed
     virtual void finalize(){
@@ -492,6 +1508,19 @@ namespace oclock
 
   void queue(ExecuteRequest *request);
   void queue(BroadcastRequest *request);
+  // in reliable mode: let the slaves report missing envelopes, so they will be resent
+  void queue_sequence_check();
+  // asks all slaves for their positions: one UartStatusMessage along the chain or slotted UartPosRequest responses,
+  // note: call it from BroadcastRequest::execute, the broadcast is done when all positions are in
+  void poll_positions(bool stop);
+  // supported by every slave on the bus, see UartAcceptMessage::features
+  bool bus_supports(Feature feature);
+  // sends a control message (see TxPriority) right away if the bus is ours, otherwise it is the next request executed
+  void send_control_raw(const UartMessage *msg, byte length);
+  template <class M>
+  void send_control(const M &msg) { send_control_raw(&msg, sizeof(M)); }
+  // the wire time of the messages added by fill, including the turnaround of the gate (see WireEstimate)
+  Micros estimate_wire_micros(const std::function<void(WireEstimate &estimate)> &fill);
 
   template <class M>
   void queue_message(const M &msg)
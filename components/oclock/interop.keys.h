@@ -10,11 +10,11 @@
 
 struct UartKeysMessage : public UartMessage
 {
-    // it would be tempting to use: Cmd cmds[MAX_ANIMATION_KEYS_PER_MESSAGE] ={}; but padding is messed up between esp and uno :()
-    // note we control the bits better ;P
+    // it would be tempting to use: Cmd cmds[MAX_ANIMATION_KEYS_PER_MESSAGE] ={}; but the bit fields are up to the compiler,
+    // so the keys go on the wire as InflatedCmdKey::raw (see wire.h)
 private:
     uint8_t _size;
-    uint16_t cmds[MAX_ANIMATION_KEYS_PER_MESSAGE] = {};
+    LittleEndian<uint16_t> cmds[MAX_ANIMATION_KEYS_PER_MESSAGE];
 
 public:
     UartKeysMessage(uint8_t destination_id, uint8_t _size) : UartMessage(-1, MSG_SEND_KEYS, destination_id), _size(_size)
@@ -34,7 +34,9 @@ public:
     {
         return cmds[idx];
     }
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartKeysMessage, 3 + 1 + 2 * MAX_ANIMATION_KEYS_PER_MESSAGE);
+static_assert(sizeof(UartKeysMessage) == KEYS_WIRE_SIZE, "UartKeysMessage: see wire_length");
 
 /***
  *
@@ -47,13 +49,13 @@ public:
 struct UartEndKeysMessage : public UartMessage
 {
 public:
-    uint32_t number_of_millis_left;
+    LittleEndian<uint32_t> number_of_millis_left;
     uint8_t turn_speed, turn_steps;
     uint8_t speed_map[8];
-    uint64_t speed_detection;
+    LittleEndian<uint64_t> speed_detection;
 
     UartEndKeysMessage(const uint8_t turn_speed, const uint8_t turn_steps, const uint8_t (&speed_map)[8], uint64_t _speed_detection, uint32_t number_of_millis_left)
-        : UartMessage(-1, MSG_END_KEYS, ALL_SLAVES),
+        : UartMessage(-1, MSG_END_KEYS, Broadcast::id()),
           number_of_millis_left(number_of_millis_left),
           turn_speed(turn_speed),
           turn_steps(turn_steps),
@@ -64,4 +66,29 @@ public:
             this->speed_map[idx] = speed_map[idx];
         }
     }
-} __attribute__((packed, aligned(1)));
+};
+WIRE_MESSAGE(UartEndKeysMessage, 3 + 4 + 1 + 1 + 8 + 8);
+static_assert(sizeof(UartEndKeysMessage) == END_KEYS_WIRE_SIZE, "UartEndKeysMessage: see wire_length");
+
+/**
+ * The speeds of the keys after a SPEED_BANK key (the ones of bank 0 are in UartEndKeysMessage),
+ * sent between MSG_BEGIN_KEYS and MSG_END_KEYS when the keys use them, see Feature::WideSpeeds.
+ */
+struct UartSpeedBankMessage : public UartMessage
+{
+public:
+    uint8_t bank;
+    uint8_t speed_map[8];
+
+    UartSpeedBankMessage(const uint8_t bank, const uint8_t (&speed_map)[8])
+        : UartMessage(-1, MSG_SPEED_BANK, Broadcast::id()),
+          bank(bank)
+    {
+        for (int idx = 0; idx < 8; ++idx)
+        {
+            this->speed_map[idx] = speed_map[idx];
+        }
+    }
+};
+WIRE_MESSAGE(UartSpeedBankMessage, 3 + 1 + 8);
+static_assert(sizeof(UartSpeedBankMessage) == SPEED_BANK_WIRE_SIZE, "UartSpeedBankMessage: see wire_length");
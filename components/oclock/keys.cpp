@@ -1,28 +1,191 @@
 #include "oclock.h"
 #include "keys.h"
 
+#ifdef MASTER_MODE
+#include <algorithm>
+#include <limits>
+#endif
+
 CmdSpeedUtil cmdSpeedUtil;
 
-const CmdSpeedUtil::Speeds &CmdSpeedUtil::get_speeds() const { return speeds; }
+const CmdSpeedUtil::Speeds &CmdSpeedUtil::get_speeds(uint8_t bank) const { return speeds[bank]; }
 
-void CmdSpeedUtil::set_speeds(const CmdSpeedUtil::Speeds &speeds)
+void CmdSpeedUtil::set_speeds(const CmdSpeedUtil::Speeds &speeds, uint8_t bank)
 {
+    if (bank >= SPEED_BANKS)
+        return;
     for (int idx = 0; idx <= max_inflated_speed; ++idx)
     {
         auto value = speeds[idx];
-        this->speeds[idx] = value;
+        this->speeds[bank][idx] = value;
     }
-    ESP_LOGD(TAG, "Speeds(%d,%d,%d,%d,%d,%d,%d,%d)", speeds[0], speeds[1], speeds[2], speeds[3], speeds[4], speeds[5], speeds[6], speeds[7]);
+    ESP_LOGD(TAG, "Speeds%d(%d,%d,%d,%d,%d,%d,%d,%d)", bank, speeds[0], speeds[1], speeds[2], speeds[3], speeds[4], speeds[5], speeds[6], speeds[7]);
 }
 
-uint8_t CmdSpeedUtil::inflate_speed(const uint8_t value) const
+uint8_t CmdSpeedUtil::inflate_speed(const int value) const
 {
-    uint8_t inflated_speed = max_inflated_speed;
-    while (inflated_speed > 0)
+    // |1/a - 1/v| < |1/b - 1/v| without the divisions
+    const uint32_t speed = value < 1 ? 1 : value;
+    uint8_t best = 0;
+    uint32_t best_speed = speeds[0][0];
+    for (uint8_t idx = 1; idx < SPEED_BANKS * SPEEDS_PER_BANK; ++idx)
+    {
+        const uint32_t candidate = speeds[idx / SPEEDS_PER_BANK][idx % SPEEDS_PER_BANK];
+        const uint32_t delta = candidate > speed ? candidate - speed : speed - candidate;
+        const uint32_t best_delta = best_speed > speed ? best_speed - speed : speed - best_speed;
+        if (delta * best_speed < best_delta * candidate)
+        {
+            best = idx;
+            best_speed = candidate;
+        }
+    }
+    return best;
+}
+
+#ifdef MASTER_MODE
+// how many times the 'length' keys from 'start' follow again right after them
+static int repeats_of(const std::vector<uint16_t> &keys, size_t start, size_t length)
+{
+    int times = 0;
+    size_t next = start + length;
+    while (times < MAX_REPEAT_TIMES && next + length <= keys.size() &&
+           std::equal(keys.begin() + start, keys.begin() + start + length, keys.begin() + next))
+    {
+        times++;
+        next += length;
+    }
+    return times;
+}
+
+int fold_repeats(std::vector<uint16_t> &keys)
+{
+    std::vector<uint16_t> folded;
+    folded.reserve(keys.size());
+    size_t idx = 0;
+    while (idx < keys.size())
+    {
+        // the run that saves the most keys, note: the keys repeated never contain a REPEAT (they are not nested)
+        size_t best_length = 0;
+        int best_times = 0;
+        int best_saved = 0;
+        for (size_t length = 1; length <= MAX_REPEAT_KEYS && idx + 2 * length <= keys.size(); ++length)
+        {
+            const int times = repeats_of(keys, idx, length);
+            const int saved = int(length) * times - 1;
+            if (saved > best_saved)
+            {
+                best_length = length;
+                best_times = times;
+                best_saved = saved;
+            }
+        }
+        if (best_saved == 0)
+        {
+            folded.push_back(keys[idx++]);
+            continue;
+        }
+        folded.insert(folded.end(), keys.begin() + idx, keys.begin() + idx + best_length);
+        folded.push_back(InflatedCmdKey::repeat(best_length, best_times).raw);
+        idx += best_length * (best_times + 1);
+    }
+    const int saved = keys.size() - folded.size();
+    keys.swap(folded);
+    return saved;
+}
+#endif
+
+#ifdef MASTER_MODE
+/**
+ * The speeds in time per step (1 / speed, ascending) with the steps at each, and what quantizing a run of them
+ * costs: all of them done at the weighted median of the run, the best speed for an absolute error.
+ */
+class SpeedRuns
+{
+public:
+    std::vector<int> speeds;
+    // prefix sums of the steps and the steps * time per step
+    std::vector<double> steps{0}, times{0};
+
+    explicit SpeedRuns(const std::map<int, uint32_t> &steps_per_speed)
     {
-        if (value >= speeds[inflated_speed])
-            return inflated_speed;
-        inflated_speed--;
+        for (auto it = steps_per_speed.rbegin(); it != steps_per_speed.rend(); ++it)
+        {
+            // the speeds on the wire are bytes
+            const int speed = std::max(1, std::min(it->first, 255));
+            if (!speeds.empty() && speeds.back() == speed)
+            {
+                steps.back() += it->second;
+                times.back() += it->second / double(speed);
+                continue;
+            }
+            speeds.push_back(speed);
+            steps.push_back(steps.back() + it->second);
+            times.push_back(times.back() + it->second / double(speed));
+        }
     }
-    return 0;
+
+    int size() const { return speeds.size(); }
+
+    // the speed for the run [from, to)
+    int median(int from, int to) const
+    {
+        const double half = (steps[from] + steps[to]) / 2;
+        const auto it = std::lower_bound(steps.begin() + from + 1, steps.begin() + to, half);
+        return it - steps.begin() - 1;
+    }
+
+    double cost(int from, int to) const
+    {
+        const int mid = median(from, to);
+        const double time = 1.0 / speeds[mid];
+        return time * (steps[mid] - steps[from]) - (times[mid] - times[from]) +
+               (times[to] - times[mid + 1]) - time * (steps[to] - steps[mid + 1]);
+    }
+};
+
+double CmdSpeedUtil::quantize_speeds(const std::map<int, uint32_t> &steps_per_speed, uint8_t banks)
+{
+    const SpeedRuns runs(steps_per_speed);
+    const int count = runs.size();
+    const int size = std::min<int>(std::max<int>(1, banks), SPEED_BANKS) * SPEEDS_PER_BANK;
+    const int groups = std::min(size, count);
+
+    // best[g][to]: the least error of [0, to) in g runs (only two rows are kept), start[g][to]: where the last run starts
+    std::vector<double> previous(count + 1, std::numeric_limits<double>::infinity()), current(count + 1);
+    std::vector<std::vector<uint8_t>> start(groups + 1, std::vector<uint8_t>(count + 1, 0));
+    previous[0] = 0;
+    for (int group = 1; group <= groups; ++group)
+    {
+        std::fill(current.begin(), current.end(), std::numeric_limits<double>::infinity());
+        for (int to = group; to <= count; ++to)
+            for (int from = group - 1; from < to; ++from)
+            {
+                const double error = previous[from] + runs.cost(from, to);
+                if (error < current[to])
+                {
+                    current[to] = error;
+                    start[group][to] = from;
+                }
+            }
+        previous.swap(current);
+    }
+
+    // from the slowest to the fastest, the rest is the fastest again
+    uint8_t palette[SPEED_BANKS * SPEEDS_PER_BANK];
+    int to = count;
+    for (int group = groups; group > 0; --group)
+    {
+        const int from = start[group][to];
+        palette[groups - group] = runs.speeds[runs.median(from, to)];
+        to = from;
+    }
+    if (groups == 0)
+        palette[0] = 1;
+    for (int idx = std::max(groups, 1); idx < SPEED_BANKS * SPEEDS_PER_BANK; ++idx)
+        palette[idx] = palette[idx - 1];
+
+    for (uint8_t bank = 0; bank < SPEED_BANKS; ++bank)
+        set_speeds(*reinterpret_cast<const Speeds *>(palette + bank * SPEEDS_PER_BANK), bank);
+    return groups == 0 ? 0 : previous[count];
 }
+#endif
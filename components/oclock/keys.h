@@ -1,5 +1,10 @@
 #pragma once
 
+#ifdef MASTER_MODE
+#include <map>
+#include <vector>
+#endif
+
 enum CmdEnum
 {
     NONE = 0,
@@ -26,6 +31,38 @@ typedef uint16_t CmdInt;
 #define MODE_MASK ((1 << MODE_WIDTH) - 1)
 #define SPEED_MASK ((1 << SPEED_WIDTH) - 1)
 
+// extended keys: the special mode (see CmdSpecialMode) is in the lowest bits of the steps, the rest is its argument
+#define SPECIAL_MODE_WIDTH 3
+#define SPECIAL_ARGUMENT_WIDTH 10
+// the argument of a REPEAT: the number of keys (5 bits) and how many times more (5 bits)
+#define REPEAT_KEYS_WIDTH 5
+#define MAX_REPEAT_KEYS ((1 << REPEAT_KEYS_WIDTH) - 1)
+#define MAX_REPEAT_TIMES ((1 << (SPECIAL_ARGUMENT_WIDTH - REPEAT_KEYS_WIDTH)) - 1)
+// the speed of a key is an index in the speeds of the current bank, see CmdSpecialMode::SPEED_BANK
+#define SPEED_BANKS 2
+#define SPEEDS_PER_BANK (1 << SPEED_WIDTH)
+// the argument of a RAMP, in revs per minute per second
+#define MAX_RAMP_ACCELERATION ((1 << SPECIAL_ARGUMENT_WIDTH) - 1)
+// the deadline of a WAIT_UNTIL: 12 bits (the argument, then the clockwise and the ghost bit) of 16 millis
+#define WAIT_UNTIL_UNIT_MILLIS 16
+#define WAIT_UNTIL_WIDTH (SPECIAL_ARGUMENT_WIDTH + 2)
+#define MAX_WAIT_UNTIL_UNITS ((1 << WAIT_UNTIL_WIDTH) - 1)
+
+enum CmdSpecialMode
+{
+    FOLLOW_SECONDS_DISCRETE = 1,
+    FOLLOW_SECONDS = 2,
+    // execute the previous keys again, without them being sent (and stored) again, see Feature::KeyRepeats
+    REPEAT = 3,
+    // the next keys use the speeds of the bank in the argument (bank 0 at the start), see Feature::WideSpeeds
+    SPEED_BANK = 4,
+    // the next moves ramp up and down with the acceleration in the argument (0: speed detection), see Ramp
+    // and Feature::Ramps
+    RAMP = 5,
+    // stand still until the deadline (in millis after the start of the animation), see Feature::Waits
+    WAIT_UNTIL = 6,
+};
+
 union InflatedCmdKey
 {
     struct
@@ -42,7 +79,9 @@ union InflatedCmdKey
     struct
     {
         uint16_t : 2,
-            extended : 1, : 13;
+            extended : 1,
+            mode : SPECIAL_MODE_WIDTH,
+            argument : SPECIAL_ARGUMENT_WIDTH;
     } extended_value;
     uint16_t raw;
     uint16_t mode_ : MODE_WIDTH;
@@ -58,12 +97,55 @@ union InflatedCmdKey
         raw = _raw;
     }
 
+    // the previous 'keys' keys are executed 'times' times more
+    static InflatedCmdKey repeat(uint8_t keys, uint8_t times)
+    {
+        InflatedCmdKey key;
+        key.extended_value.extended = true;
+        key.extended_value.mode = CmdSpecialMode::REPEAT;
+        key.extended_value.argument = (times << REPEAT_KEYS_WIDTH) | keys;
+        return key;
+    }
+
+    static InflatedCmdKey ramp(uint16_t acceleration)
+    {
+        InflatedCmdKey key;
+        key.extended_value.extended = true;
+        key.extended_value.mode = CmdSpecialMode::RAMP;
+        key.extended_value.argument = acceleration;
+        return key;
+    }
+
+    // note: rounded up, a wait is never shorter, but clamped to MAX_WAIT_UNTIL_UNITS (see Instructions::wait_until)
+    static InflatedCmdKey wait_until(uint32_t millis)
+    {
+        uint32_t units = (millis + WAIT_UNTIL_UNIT_MILLIS - 1) / WAIT_UNTIL_UNIT_MILLIS;
+        if (units > MAX_WAIT_UNTIL_UNITS)
+            units = MAX_WAIT_UNTIL_UNITS;
+        InflatedCmdKey key;
+        key.extended_value.extended = true;
+        key.extended_value.mode = CmdSpecialMode::WAIT_UNTIL;
+        key.extended_value.argument = units & ((1 << SPECIAL_ARGUMENT_WIDTH) - 1);
+        key.value.clockwise = (units >> SPECIAL_ARGUMENT_WIDTH) & 1;
+        key.value.ghost = units >> (SPECIAL_ARGUMENT_WIDTH + 1);
+        return key;
+    }
+
+    static InflatedCmdKey speed_bank(uint8_t bank)
+    {
+        InflatedCmdKey key;
+        key.extended_value.extended = true;
+        key.extended_value.mode = CmdSpecialMode::SPEED_BANK;
+        key.extended_value.argument = bank;
+        return key;
+    }
+
 #ifdef ESP8266
     void dump(const char *extra) const
     {
         if (extended())
         {
-            ESP_LOGE(TAG, "%s: ex=%s", extra, YESNO(extended()));
+            ESP_LOGE(TAG, "%s: ex=%s, mode=%d, arg=%d", extra, YESNO(extended()), extended_value.mode, extended_value.argument);
         }
         else
         {
@@ -88,6 +170,53 @@ union InflatedCmdKey
         return value.extended;
     }
 
+    inline bool repeat() const
+    {
+        return extended() && extended_value.mode == CmdSpecialMode::REPEAT;
+    }
+
+    inline uint8_t repeat_keys() const
+    {
+        return extended_value.argument & MAX_REPEAT_KEYS;
+    }
+
+    inline uint8_t repeat_times() const
+    {
+        return extended_value.argument >> REPEAT_KEYS_WIDTH;
+    }
+
+    inline bool ramp() const
+    {
+        return extended() && extended_value.mode == CmdSpecialMode::RAMP;
+    }
+
+    inline uint16_t acceleration() const
+    {
+        return extended_value.argument;
+    }
+
+    inline bool waits() const
+    {
+        return extended() && extended_value.mode == CmdSpecialMode::WAIT_UNTIL;
+    }
+
+    inline uint32_t wait_until_millis() const
+    {
+        const uint32_t units = (uint32_t(value.ghost) << (SPECIAL_ARGUMENT_WIDTH + 1)) |
+                               (uint32_t(value.clockwise) << SPECIAL_ARGUMENT_WIDTH) | extended_value.argument;
+        return units * WAIT_UNTIL_UNIT_MILLIS;
+    }
+
+    inline bool switches_bank() const
+    {
+        return extended() && extended_value.mode == CmdSpecialMode::SPEED_BANK;
+    }
+
+    inline uint8_t bank() const
+    {
+        return extended_value.argument;
+    }
+
     inline bool ghost() const
     {
         return value.ghost;
@@ -114,27 +243,25 @@ union InflatedCmdKey
     }
 };
 
-enum CmdSpecialMode
-{
-    FOLLOW_SECONDS_DISCRETE = 1,
-    FOLLOW_SECONDS = 2
-};
-
 class CmdSpeedUtil
 {
 public:
-    typedef uint8_t Speeds[8];
+    typedef uint8_t Speeds[SPEEDS_PER_BANK];
     const uint8_t max_inflated_speed = 7;
 
-    Speeds speeds = {
-        1,  // 0
-        2,  // 1
-        4,  // 2
-        8,  // 3
-        12, // 4
-        16, // 5
-        32, // 6
-        64, // 7
+    Speeds speeds[SPEED_BANKS] = {
+        {
+            1,  // 0
+            2,  // 1
+            4,  // 2
+            8,  // 3
+            12, // 4
+            16, // 5
+            32, // 6
+            64, // 7
+        },
+        // only used after a SPEED_BANK key
+        {64, 64, 64, 64, 64, 64, 64, 64},
     };
 
     void reset()
@@ -142,19 +269,29 @@ public:
         set_speeds({1, 2, 4, 8, 12, 16, 32, 64});
     }
 
-    const Speeds &get_speeds() const;
-    void set_speeds(const Speeds &speeds);
+    const Speeds &get_speeds(uint8_t bank = 0) const;
+    void set_speeds(const Speeds &speeds, uint8_t bank = 0);
 
-    uint8_t inflate_speed(const uint8_t value) const;
-    inline uint8_t deflate_speed(const uint8_t value) const
+    // the index (over all banks) of the closest speed in time, see quantize_speeds
+    uint8_t inflate_speed(const int value) const;
+    inline uint8_t deflate_speed(const uint8_t value, const uint8_t bank = 0) const
     {
-        if ((value & SPEED_MASK) != value)
+        if ((value & SPEED_MASK) != value || bank >= SPEED_BANKS)
         {
-            ESP_LOGE(TAG, "Invalid!? inflated_speed=%d", value);
-            return speeds[0];
+            ESP_LOGE(TAG, "Invalid!? inflated_speed=%d, bank=%d", value, bank);
+            return speeds[0][0];
         }
-        return speeds[value];
+        return speeds[bank][value];
     }
+
+#ifdef MASTER_MODE
+    /**
+     * Picks the speeds of 'banks' banks that change the timing of the keys the least: 'steps_per_speed' holds the
+     * steps done at each speed, a step done at speed q instead of s is |1/q - 1/s| off.
+     * Returns that total error (in steps per rpm), 0 when every speed fits.
+     */
+    double quantize_speeds(const std::map<int, uint32_t> &steps_per_speed, uint8_t banks);
+#endif
 }
 // TODO: do static :S
 extern cmdSpeedUtil;
@@ -187,10 +324,19 @@ public:
         ret.mode_ = mode_;
         ret.value.steps = fatKey.steps;
         if (!extended())
-            ret.value.speed = cmdSpeedUtil.inflate_speed(fatKey.speed);
+            ret.value.speed = cmdSpeedUtil.inflate_speed(fatKey.speed) % SPEEDS_PER_BANK;
+        else
+            // the rest of the argument
+            ret.value.speed = fatKey.speed & SPEED_MASK;
         return ret;
     }
 
+    // the bank of the speed of asInflatedCmdKey
+    uint8_t speed_bank() const
+    {
+        return extended() ? 0 : cmdSpeedUtil.inflate_speed(fatKey.speed) / SPEEDS_PER_BANK;
+    }
+
 #ifdef ESP8266
     void dump(const char *extra) const
     {
@@ -203,6 +349,15 @@ public:
         raw = 0;
     }
 
+    // an extended key as it goes on the wire, see CmdSpecialMode
+    explicit DeflatedCmdKey(const InflatedCmdKey &special)
+    {
+        raw = 0;
+        mode_ = special.mode_;
+        fatKey.steps = special.value.steps;
+        fatKey.speed = special.value.speed;
+    }
+
     DeflatedCmdKey(int _mode, u16 _steps, u8 _speed)
     {
         mode_ = (uint8_t)_mode;
@@ -265,4 +420,10 @@ public:
         return static_cast<double>(fatKey.steps * 60) / abs(static_cast<double>(fatKey.speed)) / static_cast<double>(NUMBER_OF_STEPS);
     }
 };
+
+/**
+ * Folds the runs of repeated keys of a handle (inflated, as they go on the wire) into REPEAT keys.
+ * Returns the number of keys saved.
+ */
+int fold_repeats(std::vector<uint16_t> &keys);
 #endif
\ No newline at end of file
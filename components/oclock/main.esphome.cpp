@@ -307,7 +307,6 @@ void light_callback()
     if (number->has_state())                    \
     {                                           \
         callback(number->state);                \
-        esphome::delay(1); /* FIX CRC ERRORS */ \
     }
 
 #define init_number(number, callback) \
@@ -318,13 +317,11 @@ void light_callback()
     if (select->has_state())                    \
     {                                           \
         callback(select->state, 0);             \
-        esphome::delay(1); /* FIX CRC ERRORS */ \
     }
 
 #define init_light(light, callback)                         \
     light->add_new_target_state_reached_callback(callback); \
-    callback();                                             \
-    esphome::delay(1); /* FIX CRC ERRORS */
+    callback();
 
 void update_from_components()
 {
@@ -3,10 +3,13 @@
 #include "master.h"
 #include "async.h"
 #include "requests.h"
+#include "stats.h"
+#include "capture.h"
 
 #include "esphome/core/application.h"
 #include "esphome/core/preferences.h"
 #include "esphome/components/output/float_output.h"
+#include "esphome/components/sensor/sensor.h"
 #include "esphome/components/light/light_state.h"
 #include "esphome/components/template/number/template_number.h"
 
@@ -154,6 +157,27 @@ namespace oclock
         }
     };
 
+    // note: stays on while capturing
+    class CaptureSwitch : public esphome::switch_::Switch
+    {
+    public:
+        virtual void write_state(bool state) override
+        {
+            frameCapture.set_enabled(state);
+            publish_state(state);
+        }
+    };
+
+    class DumpCaptureSwitch : public esphome::switch_::Switch
+    {
+    public:
+        virtual void write_state(bool state) override
+        {
+            publish_state(false);
+            oclock::master.dump_capture();
+        }
+    };
+
     class DumpConfigSlavesSwitch : public esphome::switch_::Switch
     {
     public:
@@ -184,6 +208,68 @@ namespace oclock
         }
     };
 
+    /**
+     * Publishes one figure of the transportStats, see stats.h
+     */
+    class TransportSensor : public sensor::Sensor, public PollingComponent
+    {
+    public:
+        enum Kind
+        {
+            RX_FRAMES,
+            TX_FRAMES,
+            RX_ERRORS,
+            DECODE_P95,
+            TURNAROUND_P95,
+            BROADCAST_P95,
+        };
+
+    private:
+        const Kind kind_;
+
+    public:
+        explicit TransportSensor(Kind kind) : PollingComponent(60000), kind_(kind)
+        {
+            set_accuracy_decimals(0);
+            set_unit_of_measurement(kind < DECODE_P95 ? "" : "us");
+        }
+
+        virtual void update() override
+        {
+            switch (kind_)
+            {
+            case RX_FRAMES:
+                publish_state(transportStats.rx_frames());
+                break;
+            case TX_FRAMES:
+                publish_state(transportStats.tx_frames());
+                break;
+            case RX_ERRORS:
+                publish_state(transportStats.rx_errors());
+                break;
+            case DECODE_P95:
+                publish_state(transportStats.decode.percentile(95));
+                break;
+            case TURNAROUND_P95:
+                publish_state(transportStats.turnaround.percentile(95));
+                break;
+            case BROADCAST_P95:
+                publish_state(transportStats.broadcast.percentile(95));
+                break;
+            }
+        }
+    };
+
+    class ResetTransportStatsSwitch : public esphome::switch_::Switch
+    {
+    public:
+        virtual void write_state(bool state) override
+        {
+            publish_state(false);
+            transportStats.reset();
+        }
+    };
+
     class EspComponents
     {
     public:
@@ -9,29 +9,139 @@
 #include <deque>
 #include "async.h"
 #include "time_tracker.h"
+#include "stats.h"
+#include "capture.h"
+#include "requests.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 
 using namespace oclock;
 
 void update_from_components();
+uint32_t boot_baud_rate();
+void queue_baud_probe();
+void watch_baud_rate(Millis now);
 
 AnimationController animationController;
 
 oclock::Master oclock::master;
 bool scanForError = false;
 int slaveIdCounter = -2;
+// number of envelopes resent after the last MSG_SEQ_CHECK
+int lastResendCount = 0;
+#define MAX_SEQUENCE_CHECKS 3
+// the fastest framing all slaves support (see MSG_ID_ACCEPT)
+Framing negotiatedFraming = Framing::Nibble;
+// the lowest protocol version and the features (see FEATURE_BIT) all slaves support (see MSG_ID_ACCEPT)
+uint8_t busProtocol = LEGACY_PROTOCOL_VERSION;
+uint16_t busFeatures = 0;
+
+bool oclock::bus_supports(Feature feature)
+{
+    return (busFeatures & FEATURE_BIT(feature)) != 0;
+}
+
+// switched on and supported by every slave
+bool use_feature(Feature feature, bool enabled)
+{
+    return enabled && oclock::bus_supports(feature);
+}
+
+// on a legacy bus (see Feature::Broadcast) the 17th slave has the broadcast address, so no slot of its own
+bool slotted_responses_fit()
+{
+    return Broadcast::is_wide() || slaveIdCounter <= LEGACY_ALL_SLAVES;
+}
+
+bool use_slotted_responses()
+{
+    return use_feature(Feature::SlottedResponses, master.is_slotted_responses()) && slotted_responses_fit();
+}
+
+// baud rate probing (see BaudProbeRequest), from slow to fast
+const uint32_t BAUD_CANDIDATES[] = {9600, 19200, 38400, 57600, 76800, 115200, 250000, 500000};
+const int BAUD_CANDIDATE_COUNT = sizeof(BAUD_CANDIDATES) / sizeof(BAUD_CANDIDATES[0]);
+#define BAUD_PROBE_FRAMES 16
+// time for everyone to switch
+#define BAUD_PROBE_SETTLE_MILLIS 20
+// back off when the receive errors climb by this much within BAUD_WATCH_MILLIS
+#define BAUD_BACKOFF_ERRORS 5
+#define BAUD_WATCH_MILLIS 60000
+
+// the last baud rate that passed a probe, stored for the next boot
+ESPPreferenceObject baudPreference;
+uint32_t probedBaudRate = 0;
+
+// what the slaves reported for the current probe
+struct BaudProbeResult
+{
+    uint32_t baud_rate{0};
+    int slaves{0};
+    int missing{0};
+    int errors{0};
+
+    bool clean() const { return slaves > 0 && missing == 0 && errors == 0; }
+} baudProbeResult;
+
+// slotted responses, see poll_destination
+SlottedPoll slottedPoll;
+
+// the receive errors of every slave, as reported by the last MSG_STATUS
+uint16_t slaveErrors[MAX_SLAVES] = {};
+
+// see BAUD_BACKOFF_ERRORS: the receive errors of the master and the ones the slaves reported
+Millis baudWatchStart = 0;
+unsigned long baudWatchErrors = 0;
+unsigned long baudWatchSlaveErrors = 0;
 
 std::string current_broadcast_request = "None";
+// the request waiting for its response(s), see MasterLifecycle::change_to_broadcasting
+oclock::BroadcastRequest *broadcastRequest = nullptr;
+// see TransportStats::broadcast
+Micros broadcastStart = 0;
 
-byte receiverBufferBytes[RECEIVER_BUFFER_SIZE];
-auto receiverBuffer = Buffer(receiverBufferBytes, RECEIVER_BUFFER_SIZE);
+byte receiverBufferBytes[RX_QUEUE_SIZE];
+auto receiverBuffer = Buffer(receiverBufferBytes, RX_QUEUE_SIZE);
 RS485Gate<RS485_DE_PIN, RS485_RE_PIN> gate;
 InteropRS485 uart(0xFF, gate, receiverBuffer);
+// keep looping at full speed while there are bytes to write
+HighFrequencyLoopRequester txLoopRequester;
+
+unsigned long slave_error_count()
+{
+    unsigned long sum = 0;
+    for (int idx = 0; idx < MAX_SLAVES; ++idx)
+        sum += slaveErrors[idx];
+    return sum;
+}
+
+// errors from now on count, see watch_baud_rate
+void restart_baud_watch(Millis now)
+{
+    baudWatchStart = now;
+    baudWatchErrors = uart.error_count();
+    baudWatchSlaveErrors = slave_error_count();
+}
+
+// everything queued left the UART (the gate turned around), see BaudProbeRequest::step
+bool tx_idle()
+{
+    return !uart.tx_pending() && !uart.turnaround_pending();
+}
 
 class MasterLifecycle
 {
 public:
-    typedef std::function<void(Millis)> LoopFunc;
-    static LoopFunc loopFunc_;
+    static LoopFuncPtr loopFunc_;
+
+    // who owns the bus, see oclock::send_control_raw
+    enum class State
+    {
+        Init,
+        Serving,
+        Broadcasting,
+    };
+    static State state_;
 
     // all steps before the master is ready
     static void change_to_init();
@@ -43,7 +153,8 @@ public:
     static void change_to_broadcasting(oclock::BroadcastRequest *request);
 };
 
-MasterLifecycle::LoopFunc MasterLifecycle::loopFunc_{};
+LoopFuncPtr MasterLifecycle::loopFunc_{nullptr};
+MasterLifecycle::State MasterLifecycle::state_{MasterLifecycle::State::Init};
 
 void oclock::ChannelRequest::send_raw(const UartMessage *msg, const byte length)
 {
@@ -71,6 +182,10 @@ void oclock::Master::setup()
     uart.setup();
     uart.setOwnerId(0xFF);
 
+    baudPreference = global_preferences->make_preference<uint32_t>(fnv1_hash("oclock_baud_rate"));
+    if (!baudPreference.load(&probedBaudRate))
+        probedBaudRate = 0;
+
     // we ignore errors
     scanForError = false;
     // reset slaveIdCounter (every clock takes 2 ids so that is why it is -2)
@@ -90,6 +205,20 @@ void oclock::Master::setup()
 
 void oclock::Master::loop()
 {
+    uart.loop_coalescer(::millis());
+    if (uart.tx_pending() || uart.turnaround_pending())
+    {
+        txLoopRequester.start();
+        uart.drain(tx_budget);
+    }
+    else
+    {
+        txLoopRequester.stop();
+    }
+
+    if (use_feature(Feature::BaudProbe, baud_probe))
+        watch_baud_rate(::millis());
+
     if (MasterLifecycle::loopFunc_)
     {
         MasterLifecycle::loopFunc_(::millis());
@@ -99,6 +228,17 @@ void oclock::Master::loop()
 void MasterLifecycle::change_to_init()
 {
     ESP_LOGI(TAG, "change_to_init");
+    state_ = State::Init;
+
+    // slaves will start listening at the initial baud rate (and framing)
+    uart.downgrade_baud_rate();
+    uart.reset_sequence();
+    // the slaves may run the legacy firmware, see Feature::Broadcast
+    uart.set_broadcast(false);
+    // no limit until the slaves told us their receive capacity
+    uart.set_credits(0, 0);
+    // errors while reinitializing do not count, see watch_baud_rate
+    restart_baud_watch(::millis());
 
     // force a reset, set line to high ( error mode )
     // so everyone will do the same
@@ -118,6 +258,7 @@ void MasterLifecycle::change_to_init()
 
     // all slaves will stop their work and put Sync to low
     uart.send(UartMessage(-1, MsgType::MSG_ID_RESET));
+    uart.flush();
     while (Sync::read() == HIGH)
     {
         // wait while slave is high
@@ -190,75 +331,102 @@ bool processLog(UartLogMessage *msg)
     }
     return true;
 }
-/***
- *
- * While accepting we expect only to receive MSG_ID_ACCEPT
- */
-void MasterLifecycle::change_to_accepting()
+bool on_log(const UartMessage *msg)
 {
-    ESP_LOGI(TAG, "change_to_accepting");
-    // uart
-    auto listener = [](const UartMessage *msg)
+    return processLog((UartLogMessage *)msg);
+}
+
+bool on_id_accept(const UartMessage *msg)
+{
+    bool sync = Sync::read();
+
+    if (!sync)
     {
-        if (msg->getMessageType() == MsgType::MSG_LOG)
-        {
-            return processLog((UartLogMessage *)msg);
-        }
-        bool sync = Sync::read();
-        if (msg->getMessageType() != MsgType::MSG_ID_ACCEPT)
-            return false;
+        // ignore for now
+        ESP_LOGI(TAG, "Still waiting for some slaves: sync=LOW");
+        return true;
+    }
 
-        if (!sync)
+    auto acceptMsg = reinterpret_cast<const UartAcceptMessage *>(msg);
+    slaveIdCounter = acceptMsg->getAssignedId();
+    // older slaves send a shorter message (see UartAcceptMessage::LEGACY_SIZE)
+    const int length = uart.dispatch_length();
+    const uint8_t framings = acceptMsg->framings_of(length);
+    negotiatedFraming = (framings & SUPPORTED_FRAMINGS & FRAMING_BIT(Framing::Cobs)) ? Framing::Cobs : Framing::Nibble;
+    busProtocol = acceptMsg->protocol_of(length);
+    busFeatures = acceptMsg->features_of(length) & SUPPORTED_FEATURES;
+    ESP_LOGI(TAG, "Done waiting for all slaves: sync=HIGH and slaveIdCounter=%d framings=%d protocol=%d features=%04x",
+             slaveIdCounter, framings, busProtocol, busFeatures);
+    if (busProtocol < PROTOCOL_VERSION)
+        ESP_LOGW(TAG, "Some slaves run protocol %d (instead of %d): features missing on the bus %04x",
+                 busProtocol, PROTOCOL_VERSION, SUPPORTED_FEATURES & ~busFeatures);
+    // from now on, pace the frames so the receive queues of the slaves never overflow
+    uart.set_credits(acceptMsg->rx_frames_of(length), acceptMsg->frame_micros_of(length));
+
+    // send config
+    for (int idx = 0; idx < MAX_SLAVES; ++idx)
+    {
+        const auto &s = oclock::master.slave(idx);
+        if (s.animator_id == -1)
         {
-            // ignore for now
-            ESP_LOGI(TAG, "Still waiting for some slaves: sync=LOW");
-            return true;
+            ESP_LOGW(TAG, "Slave not mapped: S%d", idx);
+            continue;
         }
+        animationController.remap(s.animator_id, idx);
+        auto request = UartSlaveConfigRequest(idx << 1,
+                                              s.handles[0].magnet_offset, s.handles[1].magnet_offset,
+                                              s.handles[0].initial_ticks, s.handles[1].initial_ticks);
+        uart.send(request);
+    }
 
-        slaveIdCounter = ((UartAcceptMessage *)msg)->getAssignedId();
-        ESP_LOGI(TAG, "Done waiting for all slaves: sync=HIGH and slaveIdCounter=%d", slaveIdCounter);
+    // send DONE
+    Sync::write(LOW);
+    delay(100);
+    const uint32_t baudRate = boot_baud_rate();
+    uart.send(UartDoneMessage(-1, slaveIdCounter, baudRate, negotiatedFraming, busProtocol, busFeatures));
+    uart.flush();
+    while (Sync::read() == HIGH)
+    {
+        // wait while slave is high
+        ::delay(200);
+        ESP_LOGI(TAG, "change_to_accepting: Wating while sync is HIGH...");
+    }
 
-        // send config
-        for (int idx = 0; idx < MAX_SLAVES; ++idx)
-        {
-            const auto &s = oclock::master.slave(idx);
-            if (s.animator_id == -1)
-            {
-                ESP_LOGW(TAG, "Slave not mapped: S%d", idx);
-                continue;
-            }
-            animationController.remap(s.animator_id, idx);
-            auto request = UartSlaveConfigRequest(idx << 1,
-                                                  s.handles[0].magnet_offset, s.handles[1].magnet_offset,
-                                                  s.handles[0].initial_ticks, s.handles[1].initial_ticks);
-            uart.send(request);
-        }
+    delay(500);
+    uart.upgrade_baud_rate(baudRate);
+    uart.set_framing(negotiatedFraming);
+    uart.set_broadcast(oclock::bus_supports(Feature::Broadcast));
+    if (use_feature(Feature::SlottedResponses, master.is_slotted_responses()) && !slotted_responses_fit())
+        ESP_LOGW(TAG, "slotted responses off: %d slaves on a bus with the legacy broadcast address", slaveIdCounter >> 1);
+    uart.set_reliable(use_feature(Feature::Reliable, master.is_reliable()));
+    delay(100);
 
-        // send DONE
-        Sync::write(LOW);
-        delay(100);
-        uart.send(UartDoneMessage(-1, slaveIdCounter, master.get_baud_rate()));
-        while (Sync::read() == HIGH)
-        {
-            // wait while slave is high
-            ::delay(200);
-            ESP_LOGI(TAG, "change_to_accepting: Wating while sync is HIGH...");
-        }
+    // accept errors
+    scanForError = true;
+    ESP_LOGI(TAG, "change_to_accepting: Sync::read()=%s", Sync::read() ? "HIGH" : "LOW");
 
-        delay(500);
-        uart.upgrade_baud_rate(master.get_baud_rate());
-        delay(100);
+    update_from_components();
+    MasterLifecycle::change_to_serving();
+    if (use_feature(Feature::BaudProbe, master.is_baud_probe()) && probedBaudRate == 0)
+        queue_baud_probe();
 
-        // accept errors
-        scanForError = true;
-        ESP_LOGI(TAG, "change_to_accepting: Sync::read()=%s", Sync::read() ? "HIGH" : "LOW");
+    return true;
+}
 
-        update_from_components();
-        change_to_serving();
+/***
+ *
+ * While accepting we expect only to receive MSG_ID_ACCEPT
+ */
+constexpr MessageRoute acceptingRoutes[] = {
+    {MSG_LOG, on_log},
+    {MSG_ID_ACCEPT, on_id_accept},
+};
+constexpr DispatchTable acceptingTable PROGMEM = DispatchTable::make(acceptingRoutes);
 
-        return true;
-    };
-    uart.set_listener(listener);
+void MasterLifecycle::change_to_accepting()
+{
+    ESP_LOGI(TAG, "change_to_accepting");
+    uart.set_dispatch(acceptingTable);
 
     // our loop func
     loopFunc_ = [](Millis t)
@@ -268,89 +436,408 @@ void MasterLifecycle::change_to_accepting()
     };
 }
 
-void MasterLifecycle::change_to_broadcasting(oclock::BroadcastRequest *request)
+// the response the request waited for is in (or it never will be), back to serving
+void finish_broadcast()
 {
-    current_broadcast_request = request->get_alias();
-#define FINAL_REQUEST()                       \
-    {                                         \
-        if (request)                          \
-        {                                     \
-            request->finalize();              \
-            delete request;                   \
-        }                                     \
-        current_broadcast_request = "None";   \
-        MasterLifecycle::change_to_serving(); \
+    if (broadcastRequest)
+    {
+        broadcastRequest->finalize();
+        delete broadcastRequest;
+        broadcastRequest = nullptr;
     }
+    slottedPoll.pending = 0;
+    transportStats.broadcast.add(micros() - broadcastStart);
+    current_broadcast_request = "None";
+    MasterLifecycle::change_to_serving();
+}
 
-    uart.start_receiving();
-    ESP_LOGI(TAG, "change_to_broadcasting");
+bool on_dump_log_done(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF)
+    {
+        ESP_LOGI(TAG, "Done dumping logs request! > %d", msg->getDstId());
+        finish_broadcast();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Waiting before dumping logs request! > %d", msg->getDstId());
+    }
+    return true;
+}
 
-    // note: we copy by value since the stack will invalid at the point we need it!
-    auto listener = [request](const UartMessage *msg)
+bool on_animation_done(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF)
     {
-        switch (msg->getMessageType())
-        {
-        case MsgType::MSG_LOG:
-            return processLog((UartLogMessage *)msg);
+        ESP_LOGI(TAG, "Done MSG_WAIT_FOR_ANIMATION request! > %d ", msg->getDstId());
+        finish_broadcast();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Waiting before MSG_WAIT_FOR_ANIMATION request! > %d ", msg->getDstId());
+    }
+    return true;
+}
 
-        case MsgType::MSG_DUMP_LOG_REQUEST:
-            if (msg->getDstId() == 0xFF)
-            {
-                ESP_LOGI(TAG, "Done dumping logs request! > %d", msg->getDstId());
-                FINAL_REQUEST()
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Waiting before dumping logs request! > %d", msg->getDstId());
-            }
-            return true;
+bool on_sequence_check(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF)
+    {
+        auto check_msg = reinterpret_cast<const UartSeqCheckMessage *>(msg);
+        ESP_LOGI(TAG, "Done MSG_SEQ_CHECK request! missing=%08lx", (unsigned long)check_msg->missing);
+        lastResendCount = uart.resend_missing(check_msg);
+        finish_broadcast();
+    }
+    return true;
+}
 
-        case MsgType::MSG_WAIT_FOR_ANIMATION:
-            if (msg->getDstId() == 0xFF)
-            {
-                ESP_LOGI(TAG, "Done MSG_WAIT_FOR_ANIMATION request! > %d ", msg->getDstId());
-                FINAL_REQUEST()
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Waiting before MSG_WAIT_FOR_ANIMATION request! > %d ", msg->getDstId());
-            }
-            return true;
+bool on_baud_report(const UartMessage *msg)
+{
+    auto report_msg = reinterpret_cast<const UartBaudReportMessage *>(msg);
+    if (msg->getSourceId() != 0xFF && report_msg->baud_rate == baudProbeResult.baud_rate)
+    {
+        ESP_LOGI(TAG, "S%d @ %ld baud: received=%d/%d errors=%d", msg->getSourceId() >> 1, (long)report_msg->baud_rate,
+                 report_msg->received, BAUD_PROBE_FRAMES, int(report_msg->errors));
+        baudProbeResult.slaves++;
+        baudProbeResult.missing += BAUD_PROBE_FRAMES - report_msg->received;
+        baudProbeResult.errors += report_msg->errors;
+    }
+    if (msg->getDstId() == 0xFF)
+        finish_broadcast();
+    return true;
+}
 
-        case MsgType::MSG_POS_REQUEST:
+bool on_status(const UartMessage *msg)
+{
+    // only the frame of the last slave counts, it has the records of all
+    if (msg->getDstId() == 0xFF)
+    {
+        auto status_msg = reinterpret_cast<const UartStatusMessage *>(msg);
+        ESP_LOGI(TAG, "Done MSG_STATUS request! count=%d", status_msg->count);
+        for (int idx = 0; idx < status_msg->count && idx < UartStatusMessage::MAX_RECORDS; ++idx)
         {
-            auto pos_msg = reinterpret_cast<const UartPosRequest *>(msg);
-            ESP_LOGI(TAG, "Store pos request! %d %d (%d, %d)", msg->getSourceId(), slaveIdCounter, pos_msg->pos0, pos_msg->pos1);
-            animationController.set_handles(msg->getSourceId(), pos_msg->pos0, pos_msg->pos1);
-            if (msg->getDstId() == 0xFF)
-            {
-                ESP_LOGI(TAG, "Done retrieving pos request! > %d ", msg->getDstId());
-                FINAL_REQUEST()
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Waiting before retrieving pos request! > %d ", msg->getDstId());
-            }
+            const auto &record = status_msg->records[idx];
+            animationController.set_handles(idx << 1, record.pos0(), record.pos1());
+            if (record.errors() != slaveErrors[idx])
+                ESP_LOGW(TAG, "S%d: receive errors %d -> %d", idx, slaveErrors[idx], int(record.errors()));
+            slaveErrors[idx] = record.errors();
         }
-            return true;
+        finish_broadcast();
+    }
+    return true;
+}
 
-        default:
-            return false;
-        }
-#undef FINAL_REQUEST
-    };
-    uart.set_listener(listener);
+bool on_position(const UartMessage *msg)
+{
+    auto pos_msg = reinterpret_cast<const UartPosRequest *>(msg);
+    ESP_LOGI(TAG, "Store pos request! %d %d (%d, %d)", msg->getSourceId(), slaveIdCounter, int(pos_msg->pos0), int(pos_msg->pos1));
+    animationController.set_handles(msg->getSourceId(), pos_msg->pos0, pos_msg->pos1);
+    if (msg->getDstId() == 0xFF && slottedPoll.last_response())
+    {
+        ESP_LOGI(TAG, "Done retrieving pos request! > %d ", msg->getDstId());
+        finish_broadcast();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Waiting before retrieving pos request! > %d ", msg->getDstId());
+    }
+    return true;
+}
+
+constexpr MessageRoute broadcastingRoutes[] = {
+    {MSG_LOG, on_log},
+    {MSG_DUMP_LOG_REQUEST, on_dump_log_done},
+    {MSG_WAIT_FOR_ANIMATION, on_animation_done},
+    {MSG_SEQ_CHECK, on_sequence_check},
+    {MSG_BAUD_REPORT, on_baud_report},
+    {MSG_STATUS, on_status},
+    {MSG_POS_REQUEST, on_position},
+};
+constexpr DispatchTable broadcastingTable PROGMEM = DispatchTable::make(broadcastingRoutes);
+
+void MasterLifecycle::change_to_broadcasting(oclock::BroadcastRequest *request)
+{
+    current_broadcast_request = request->get_alias();
+    // note: the request lives until finish_broadcast
+    broadcastRequest = request;
+    broadcastStart = micros();
+    state_ = State::Broadcasting;
+    uart.start_receiving();
+    ESP_LOGI(TAG, "change_to_broadcasting");
+    uart.set_dispatch(broadcastingTable);
 
     // our loop func
     loopFunc_ = [](Millis now)
     {
         AsyncRegister::loop(now);
         uart.loop();
+        if (slottedPoll.expired(now))
+        {
+            ESP_LOGW(TAG, "slotted poll: %d response(s) missing", slottedPoll.pending);
+            finish_broadcast();
+            return;
+        }
         ::yield();
     };
 }
 
 std::deque<oclock::ExecuteRequest *> open_requests;
+// the request that is not done yet, see ExecuteRequest::step
+oclock::ExecuteRequest *steppingRequest = nullptr;
+
+class SequenceCheckRequest final : public oclock::BroadcastRequest
+{
+    const int attempt_;
+
+public:
+    SequenceCheckRequest(int attempt) : BroadcastRequest("SequenceCheckRequest"), attempt_(attempt) {}
+
+    virtual void execute() override final
+    {
+        uart.send_sequence_check();
+    }
+
+    virtual void finalize() override final
+    {
+        if (lastResendCount == 0)
+            return;
+        if (attempt_ >= MAX_SEQUENCE_CHECKS)
+        {
+            ESP_LOGE(TAG, "still missing envelopes after %d checks", attempt_);
+            return;
+        }
+        // check again, resent ones could be lost as well
+        oclock::queue(new SequenceCheckRequest(attempt_ + 1));
+    }
+};
+
+void oclock::queue_sequence_check()
+{
+    if (uart.is_reliable())
+        oclock::queue(new SequenceCheckRequest(1));
+}
+
+// the destination of a poll: the broadcast address for slotted responses, otherwise the first slave
+uint8_t poll_destination(byte response_length)
+{
+    if (!use_slotted_responses())
+        return 0;
+    return slottedPoll.arm(uart, response_length, slaveIdCounter, ::millis());
+}
+
+void oclock::poll_positions(bool stop)
+{
+    if (use_slotted_responses() || !use_feature(Feature::Status, true))
+    {
+        uart.send(UartPosRequest(stop, poll_destination(sizeof(UartPosRequest))));
+        return;
+    }
+    UartStatusMessage msg(stop);
+    uart.send_raw(&msg, msg.size());
+}
+
+Micros oclock::estimate_wire_micros(const std::function<void(WireEstimate &estimate)> &fill)
+{
+    WireEstimate estimate(uart);
+    fill(estimate);
+    return estimate.micros(transportStats.turnaround.percentile(95));
+}
+
+void store_baud_rate(uint32_t value)
+{
+    ESP_LOGI(TAG, "remember %ld baud", long(value));
+    probedBaudRate = value;
+    baudPreference.save(&probedBaudRate);
+}
+
+// the baud rate to send with MSG_ID_DONE
+uint32_t boot_baud_rate()
+{
+    if (!use_feature(Feature::BaudProbe, master.is_baud_probe()))
+        return master.get_baud_rate();
+    // passed a probe before (and still allowed)?
+    if (probedBaudRate != 0 && probedBaudRate <= master.get_baud_rate())
+        return probedBaudRate;
+    // will be probed, see queue_baud_probe
+    probedBaudRate = 0;
+    return initial_baud_rate;
+}
+
+// long enough for BAUD_PROBE_FRAMES (nibble framing being the worst case) and switching twice
+uint16_t probe_window_millis(uint32_t baud_rate)
+{
+    const uint32_t frame_bits = 2 * (sizeof(UartBaudPatternMessage) + 2) * 10;
+    const uint32_t frame_micros = frame_bits * 1000000UL / baud_rate + uart.tx_queue().credits().frame_micros();
+    return 2 * BAUD_PROBE_SETTLE_MILLIS + BAUD_PROBE_FRAMES * frame_micros / 1000 + 1;
+}
+
+/**
+ * Switches every slave (and then the master) to baud_rate: after a clean probe or, slower, as a fallback (see
+ * watch_baud_rate).
+ */
+class BaudCommitRequest final : public oclock::ExecuteRequest
+{
+    const uint32_t baud_rate_;
+    // the commit left (at sent_), the slaves switch
+    bool settling_{false};
+    Millis sent_{0};
+
+public:
+    BaudCommitRequest(uint32_t baud_rate) : ExecuteRequest("BaudCommitRequest"), baud_rate_(baud_rate) {}
+
+    virtual void execute() override final
+    {
+        uart.send_direct(UartBaudCommitMessage(baud_rate_));
+    }
+
+    virtual bool step(Millis now) override final
+    {
+        if (!settling_)
+        {
+            settling_ = tx_idle();
+            sent_ = now;
+            return false;
+        }
+        if (now - sent_ < BAUD_PROBE_SETTLE_MILLIS)
+            return false;
+
+        uart.upgrade_baud_rate(baud_rate_);
+        store_baud_rate(baud_rate_);
+        // the errors at the previous baud rate do not count
+        restart_baud_watch(now);
+        return true;
+    }
+};
+
+/**
+ * Lets the slaves count the patterns they receive at BAUD_CANDIDATES[candidate], the report is collected
+ * at the current baud rate. If not clean, the next slower candidate will be probed.
+ */
+class BaudProbeRequest final : public oclock::BroadcastRequest
+{
+    const int candidate_;
+    uint32_t current_{0};
+    uint16_t window_{0};
+
+    enum class Step
+    {
+        // the probe is being sent
+        Probe,
+        // the slaves switch to the probed baud rate
+        Settle,
+        // the patterns are being sent, the slaves fall back once their window is over
+        Window,
+    };
+    Step step_{Step::Probe};
+    // the probe left, the window of the slaves started
+    Millis start_{0};
+
+public:
+    BaudProbeRequest(int candidate) : BroadcastRequest("BaudProbeRequest"), candidate_(candidate) {}
+
+    virtual void execute() override final
+    {
+        current_ = uart.get_baud_rate();
+        const uint32_t probe = BAUD_CANDIDATES[candidate_];
+        window_ = probe_window_millis(probe);
+        ESP_LOGI(TAG, "probing %ld baud (window: %d millis)", long(probe), window_);
+
+        uart.send_direct(UartBaudProbeMessage(probe, window_, BAUD_PROBE_FRAMES));
+        step_ = Step::Probe;
+    }
+
+    virtual bool step(Millis now) override final
+    {
+        const uint32_t probe = BAUD_CANDIDATES[candidate_];
+        switch (step_)
+        {
+        case Step::Probe:
+            if (!tx_idle())
+                return false;
+            start_ = now;
+            step_ = Step::Settle;
+            return false;
+
+        case Step::Settle:
+            if (now - start_ < BAUD_PROBE_SETTLE_MILLIS)
+                return false;
+            uart.upgrade_baud_rate(probe);
+            for (int idx = 0; idx < BAUD_PROBE_FRAMES; ++idx)
+                uart.send_direct(UartBaudPatternMessage());
+            step_ = Step::Window;
+            return false;
+
+        case Step::Window:
+            if (now - start_ < Millis(window_ + BAUD_PROBE_SETTLE_MILLIS))
+                return false;
+            break;
+        }
+        uart.upgrade_baud_rate(current_);
+
+        baudProbeResult = BaudProbeResult();
+        baudProbeResult.baud_rate = probe;
+        uart.send_direct(UartBaudReportMessage(probe));
+        return true;
+    }
+
+    virtual void finalize() override final
+    {
+        const auto &result = baudProbeResult;
+        if (result.clean())
+        {
+            ESP_LOGI(TAG, "%ld baud is clean for %d slaves", long(result.baud_rate), result.slaves);
+            oclock::queue(new BaudCommitRequest(result.baud_rate));
+            return;
+        }
+        ESP_LOGW(TAG, "%ld baud failed: slaves=%d missing=%d errors=%d", long(result.baud_rate), result.slaves, result.missing, result.errors);
+        if (candidate_ > 0 && BAUD_CANDIDATES[candidate_ - 1] > uart.get_baud_rate())
+            oclock::queue(new BaudProbeRequest(candidate_ - 1));
+        else
+            // nothing faster works, stay where we are
+            store_baud_rate(uart.get_baud_rate());
+    }
+};
+
+void queue_baud_probe()
+{
+    // the fastest candidate allowed first, see BaudProbeRequest::finalize for the slower ones
+    for (int idx = BAUD_CANDIDATE_COUNT - 1; idx >= 0; --idx)
+    {
+        if (BAUD_CANDIDATES[idx] > master.get_baud_rate())
+            continue;
+        if (BAUD_CANDIDATES[idx] > uart.get_baud_rate())
+            oclock::queue(new BaudProbeRequest(idx));
+        else
+            store_baud_rate(uart.get_baud_rate());
+        return;
+    }
+}
+
+// falls back to a slower candidate when the receive errors (of the master and the slaves) climb
+void watch_baud_rate(Millis now)
+{
+    if (now - baudWatchStart < BAUD_WATCH_MILLIS)
+        return;
+
+    const unsigned long climbed = uart.error_count() - baudWatchErrors;
+    // the slaves count from 0 again after a reset
+    const unsigned long slaveErrorCount = slave_error_count();
+    const unsigned long slavesClimbed = slaveErrorCount >= baudWatchSlaveErrors ? slaveErrorCount - baudWatchSlaveErrors : slaveErrorCount;
+    restart_baud_watch(now);
+
+    const uint32_t current = uart.get_baud_rate();
+    if (climbed + slavesClimbed < BAUD_BACKOFF_ERRORS || current <= initial_baud_rate)
+        return;
+
+    uint32_t slower = initial_baud_rate;
+    for (int idx = 0; idx < BAUD_CANDIDATE_COUNT; ++idx)
+        if (BAUD_CANDIDATES[idx] > slower && BAUD_CANDIDATES[idx] < current)
+            slower = BAUD_CANDIDATES[idx];
+
+    ESP_LOGW(TAG, "%ld receive errors (slaves: %ld) within %d millis, backing off: %ld -> %ld baud",
+             climbed + slavesClimbed, slavesClimbed, BAUD_WATCH_MILLIS, long(current), long(slower));
+    oclock::queue(new BaudCommitRequest(slower));
+}
 
 void dump_open_requests()
 {
@@ -361,27 +848,37 @@ void dump_open_requests()
     }
 }
 
+bool on_unexpected(const UartMessage *msg)
+{
+    LOG_MESSAGEW("should not happen!?", msg, -1);
+    return false;
+}
+
+constexpr MessageRoute servingRoutes[] = {
+    {MSG_LOG, on_unexpected},
+    {MSG_POS_REQUEST, on_unexpected},
+};
+constexpr DispatchTable servingTable PROGMEM = DispatchTable::make(servingRoutes);
+
 void MasterLifecycle::change_to_serving()
 {
     ESP_LOGI(TAG, "change_to_serving");
+    state_ = State::Serving;
     uart.start_receiving();
-    auto listener = [](const UartMessage *msg)
-    {
-        switch (msg->getMessageType())
-        {
-        case MsgType::MSG_LOG:
-        case MsgType::MSG_POS_REQUEST:
-            LOG_MESSAGEW("should not happen!?", msg, -1);
-            return false;
-
-        default:
-            return false;
-        }
-    };
-    uart.set_listener(listener);
+    uart.set_dispatch(servingTable);
 
     loopFunc_ = [](Millis now)
     {
+        if (steppingRequest)
+        {
+            // the rest waits
+            if (steppingRequest->step(now))
+            {
+                delete steppingRequest;
+                steppingRequest = nullptr;
+            }
+            return;
+        }
         if (!open_requests.empty())
         {
             oclock::ExecuteRequest *request = open_requests.front();
@@ -390,7 +887,10 @@ void MasterLifecycle::change_to_serving()
             dump_open_requests();
             // execute
             request->execute();
-            delete request;
+            if (request->step(now))
+                delete request;
+            else
+                steppingRequest = request;
             // jump from the loop
             return;
         }
@@ -410,6 +910,15 @@ void oclock::Master::dump_config()
         ESP_LOGI(TAG, "               -- %s", (*it)->get_alias().c_str());
     }
     ESP_LOGI(tag, "  brightness: %d", brightness_);
+    ESP_LOGI(tag, "  tx budget: %ld micros", long(tx_budget));
+    ESP_LOGI(tag, "  protocol: %d (features: %04x of %04x)", busProtocol, busFeatures, SUPPORTED_FEATURES);
+    ESP_LOGI(tag, "  reliable: %s (resent: %ld)", YESNO(uart.is_reliable()), long(uart.get_resent()));
+    ESP_LOGI(tag, "  slotted responses: %s", YESNO(slotted_responses));
+    for (int idx = 0; idx < MAX_SLAVES; ++idx)
+        if (slaveErrors[idx] > 0)
+            ESP_LOGI(tag, "  S%d receive errors: %d", idx, slaveErrors[idx]);
+    ESP_LOGI(tag, "  baud probe: %s (max: %ld, probed: %ld)", YESNO(baud_probe), long(baud_rate), long(probedBaudRate));
+    oclock::requests::uploadBudget.dump_config(tag);
     ESP_LOGI(tag, "  time trackers:");
     oclock::time_tracker::realTimeTracker.dump_config(tag);
     oclock::time_tracker::testTimeTracker.dump_config(tag);
@@ -420,6 +929,11 @@ void oclock::Master::dump_config()
     animationController.dump_config(tag);
 }
 
+void oclock::Master::dump_capture()
+{
+    frameCapture.dump(TAG, uart.get_baud_rate(), uint8_t(uart.get_framing()));
+}
+
 void oclock::queue(ExecuteRequest *request)
 {
     open_requests.push_back(request);
@@ -444,22 +958,63 @@ void oclock::queue(oclock::BroadcastRequest *request)
         void execute()
         {
             org_request_->execute();
+        }
+
+        bool step(Millis now)
+        {
+            if (!org_request_->step(now))
+                return false;
             MasterLifecycle::change_to_broadcasting(org_request_);
             org_request_ = nullptr;
+            return true;
         }
     };
 
     queue(new CallbackRequest(request));
 }
 
+void oclock::send_control_raw(const UartMessage *msg, byte length)
+{
+    // while broadcasting the slaves might be answering, unless we are still writing the request
+    const auto state = MasterLifecycle::state_;
+    if ((state == MasterLifecycle::State::Serving && steppingRequest == nullptr) ||
+        (state == MasterLifecycle::State::Broadcasting && uart.tx_pending()))
+    {
+        uart.send_control(msg, length);
+        return;
+    }
+
+    class ControlRequest final : public oclock::ExecuteRequest
+    {
+        std::vector<byte> bytes_;
+
+    public:
+        ControlRequest(const UartMessage *msg, byte length)
+            : ExecuteRequest("ControlRequest"), bytes_((const byte *)msg, (const byte *)msg + length) {}
+
+        void execute()
+        {
+            uart.send_control((const UartMessage *)bytes_.data(), bytes_.size());
+        }
+    };
+
+    // ahead of everything else
+    open_requests.push_front(new ControlRequest(msg, length));
+    dump_open_requests();
+}
+
 void oclock::Master::reset()
 {
     AsyncRegister::byName("time_tracker", nullptr);
+    // what is not on the wire yet is of no use anymore
+    uart.discard_bulk();
     while (!open_requests.empty())
     {
         delete open_requests.back();
         open_requests.pop_back();
     }
+    delete steppingRequest;
+    steppingRequest = nullptr;
     MasterLifecycle::change_to_init();
 }
 
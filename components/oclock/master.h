@@ -33,6 +33,14 @@ namespace oclock
     class Master
     {
         uint32_t baud_rate = 9600;
+        // max micros per loop spent on writing queued bytes
+        uint32_t tx_budget = 2000;
+        // sequence numbered envelopes with retransmits, see MSG_SEQ_CHECK
+        bool reliable = false;
+        // probe for the fastest baud rate (up to baud_rate) that works, see MSG_BAUD_PROBE
+        bool baud_probe = false;
+        // every slave answers a poll in its own time slot, see poll_destination
+        bool slotted_responses = false;
         SlaveConfig slaves_[24];
         BackgroundEnum background_led_mode_{BackgroundEnum::First};
         ForegroundEnum foreground_led_mode_{ForegroundEnum::First};
@@ -64,6 +72,18 @@ namespace oclock
         void set_baud_rate(uint32_t value) { baud_rate = value; }
         uint32_t get_baud_rate() const { return baud_rate; }
 
+        void set_tx_budget(uint32_t value) { tx_budget = value; }
+        uint32_t get_tx_budget() const { return tx_budget; }
+
+        void set_reliable(bool value) { reliable = value; }
+        bool is_reliable() const { return reliable; }
+
+        void set_baud_probe(bool value) { baud_probe = value; }
+        bool is_baud_probe() const { return baud_probe; }
+
+        void set_slotted_responses(bool value) { slotted_responses = value; }
+        bool is_slotted_responses() const { return slotted_responses; }
+
         int get_base_speed() const { return base_speed; }
         void set_base_speed(int value) { base_speed = value; }
 
@@ -102,6 +122,8 @@ namespace oclock
         void setup();
         void loop();
         void dump_config();
+        // dumps the captured frames over the logger (see capture.h)
+        void dump_capture();
     };
 
     extern Master master;
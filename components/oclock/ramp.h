@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+
+// the motor steps per revolution, the steps of a key are 4 of them (see STEP_MULTIPLIER of the slave)
+#define RAMP_STEP_MULTIPLIER 4
+#define RAMP_STEPS_PER_REVOLUTION (720 * RAMP_STEP_MULTIPLIER)
+
+/**
+ * A trapezoidal speed profile of one key: from standing still up to its speed with a constant acceleration, and
+ * down again to stand still at its last step (a triangle when the key is too short to reach its speed).
+ *
+ * The delays of the steps follow D. Austin, "Generate stepper-motor speed profiles in real time":
+ * step n of the ramp up takes c(n) = c(n - 1) - 2 c(n - 1) / (4n + 1), with c(0) = 0.676 sqrt(2 / a).
+ * Only integers (the delays in 1/256 micros): the master does the same arithmetic as the slave, so it knows
+ * how long a key takes to the micro (see micros).
+ */
+class Ramp
+{
+private:
+    // 0.676 * sqrt(2 * 60 / RAMP_STEPS_PER_REVOLUTION) * 1e6 * 256 * 16, divided by sqrt(acceleration * 256)
+    static const uint32_t FIRST_DELAY = 565198528UL;
+    // 60e6 * 256 / RAMP_STEPS_PER_REVOLUTION, divided by the speed
+    static const uint32_t SPEED_DELAY = 5333333UL;
+
+    uint16_t steps_{0}, left_{0};
+    // the steps speeding up and the ones slowing down
+    uint16_t up_{0}, down_{0};
+    // the delay of the last step (see next) and the one at full speed
+    uint32_t delay_{0}, min_delay_{0};
+
+    static uint32_t isqrt(uint32_t value)
+    {
+        uint32_t root = 0;
+        uint32_t bit = uint32_t(1) << 30;
+        while (bit > value)
+            bit >>= 2;
+        while (bit != 0)
+        {
+            if (value >= root + bit)
+            {
+                value -= root + bit;
+                root = (root >> 1) + bit;
+            }
+            else
+                root >>= 1;
+            bit >>= 2;
+        }
+        return root;
+    }
+
+public:
+    // 'speed' in revs per minute, 'acceleration' in revs per minute per second (at least 1)
+    void start(uint16_t steps, uint8_t speed, uint16_t acceleration)
+    {
+        if (speed == 0)
+            speed = 1;
+        if (acceleration == 0)
+            acceleration = 1;
+        steps_ = left_ = steps;
+        min_delay_ = SPEED_DELAY / speed;
+        delay_ = FIRST_DELAY / isqrt(uint32_t(acceleration) << 8);
+        if (delay_ < min_delay_)
+            delay_ = min_delay_;
+
+        // the steps from standing still to full speed: v^2 / 2a
+        const uint32_t full = uint32_t(speed) * speed * (RAMP_STEPS_PER_REVOLUTION / 120) / acceleration;
+        if (2 * full >= steps)
+        {
+            up_ = steps / 2;
+            down_ = steps - up_;
+        }
+        else
+        {
+            up_ = full;
+            down_ = full;
+        }
+    }
+
+    bool done() const { return left_ == 0; }
+
+    // the delay before the next step, in micros
+    uint32_t next()
+    {
+        if (left_ == 0)
+            return delay_ >> 8;
+        const uint16_t step = steps_ - left_;
+        left_--;
+        if (step == 0)
+            // c(0), see start
+            ;
+        else if (left_ < down_)
+            // the way back: c(n - 1) = c(n) + 2 c(n) / (4n - 1), n - 1 the steps after this one
+            delay_ += 2 * delay_ / (4 * uint32_t(left_ + 1) - 1);
+        else if (step < up_)
+        {
+            delay_ -= 2 * delay_ / (4 * uint32_t(step) + 1);
+            if (delay_ < min_delay_)
+                delay_ = min_delay_;
+        }
+        else
+            delay_ = min_delay_;
+        return delay_ >> 8;
+    }
+
+    // slows down to stand still after the step that is due, returns the steps that takes
+    uint16_t stop()
+    {
+        if (left_ <= down_)
+            return left_;
+        // the step that is due is step 'done - 1' of the ramp up (or at full speed), from there back to c(0)
+        const uint16_t done = steps_ - left_;
+        const uint16_t down = done == 0 ? 0 : (done - 1 < up_ ? done - 1 : up_);
+        up_ = 0;
+        steps_ = done + down;
+        left_ = down_ = down;
+        return left_;
+    }
+
+    // how long a key takes, see next
+    static uint32_t micros(uint16_t steps, uint8_t speed, uint16_t acceleration)
+    {
+        Ramp ramp;
+        ramp.start(steps, speed, acceleration);
+        uint32_t total = 0;
+        while (!ramp.done())
+            total += ramp.next();
+        return total;
+    }
+};
@@ -2,43 +2,66 @@
 
 #include "requests.h"
 
+oclock::requests::UploadBudget oclock::requests::uploadBudget;
+
+void oclock::requests::UploadBudget::dump_config(const char *tag) const
+{
+    ESP_LOGI(tag, "  upload budget: upload %ld + execution %ld of %ld millis", long(upload_millis), long(execution_millis), long(millis_left));
+    ESP_LOGI(tag, "    plans: full=%ld no_in_between=%ld direct=%ld", long(plans[0]), long(plans[1]), long(plans[2]));
+}
+
 // UartColorMessage uartColorMessage;
 //  UartColorMessage sendUartColorMessage;
 
-class RgbBackgroundLedsRequest final : public oclock::ExecuteRequest
+/**
+ * The leds of a layer in the smallest message the content and the bus allow (see Feature::CompactLeds):
+ * a palette if there are few distinct colors, RgbColor16 if all colors fit, otherwise 4 bytes per led.
+ */
+class RgbLedsRequest final : public oclock::ExecuteRequest
 {
+    const bool foreground_;
     oclock::RgbColorLeds leds;
 
     virtual void execute() override
     {
-        send(UartRgbBackgroundLedsMessage(leds));
+        if (oclock::bus_supports(Feature::CompactLeds))
+        {
+            const UartPaletteLedsMessage palette(foreground_, leds);
+            const bool rgb16 = UartRgb16LedsMessage::fits(leds);
+            // note: on a tie the palette, it is exact
+            const byte rgb16_size = rgb16 ? sizeof(UartRgb16LedsMessage) : 0xFF;
+            if (palette.size() <= rgb16_size && palette.size() < sizeof(UartRgbForegroundLedsMessage))
+            {
+                send_raw(&palette, palette.size());
+                return;
+            }
+            if (rgb16)
+            {
+                send(UartRgb16LedsMessage(foreground_, leds));
+                return;
+            }
+        }
+        if (foreground_)
+            send(UartRgbForegroundLedsMessage(leds));
+        else
+            send(UartRgbBackgroundLedsMessage(leds));
     }
 
 public:
-    RgbBackgroundLedsRequest(const oclock::RgbColorLeds &leds) : ExecuteRequest("RgbBackgroundLedsRequest"), leds(leds) {}
-};
-
-class RgbForegroundLedsRequest final : public oclock::ExecuteRequest
-{
-    oclock::RgbColorLeds leds;
-
-    virtual void execute() override
+    RgbLedsRequest(bool foreground, const oclock::RgbColorLeds &leds) : ExecuteRequest(foreground ? "RgbForegroundLedsRequest" : "RgbBackgroundLedsRequest"), foreground_(foreground)
     {
-        send(UartRgbForegroundLedsMessage(leds));
+        memcpy(this->leds, leds, sizeof(this->leds));
     }
-
-public:
-    RgbForegroundLedsRequest(const oclock::RgbColorLeds &leds) : ExecuteRequest("RgbForegroundLedsRequest"), leds(leds) {}
 };
 
 void oclock::requests::publish_background_rgb_leds(const oclock::RgbColorLeds &leds)
 {
-    oclock::queue(new RgbBackgroundLedsRequest(leds));
+    oclock::queue(new RgbLedsRequest(false, leds));
 };
 
 void oclock::requests::publish_foreground_rgb_leds(const oclock::RgbColorLeds &leds)
 {
-    oclock::queue(new RgbForegroundLedsRequest(leds));
+    oclock::queue(new RgbLedsRequest(true, leds));
 };
 
 bool ledColorRequestIsQueued = false;
@@ -60,33 +83,14 @@ public:
     }
 };
 
-class SetScaledBrightnessRequest final : public oclock::ExecuteRequest
-{
-public:
-    SetScaledBrightnessRequest(int brightness) : oclock::ExecuteRequest("SetScaledBrightnessRequest")
-    {
-        // we immediatelly update the brightness, in case we increase it again before sending to the slaves
-        if (brightness < 0)
-            brightness = 0;
-        else if (brightness > 5)
-            brightness = 5;
-        else
-            brightness = brightness;
-        oclock::master.set_brightness(brightness);
-    }
-
-    virtual void execute() override final
-    {
-        // just send latests
-        send(UartScaledBrightnessMessage(oclock::master.get_brightness()));
-    }
-};
-
 void oclock::requests::publish_brightness(const int value)
 {
     if (value == oclock::master.get_brightness())
         return;
-    oclock::queue(new SetScaledBrightnessRequest(value));
+    const int brightness = value < 0 ? 0 : value > 5 ? 5 : value;
+    oclock::master.set_brightness(brightness);
+    // does not wait for a running upload, see TxPriority
+    oclock::send_control(UartScaledBrightnessMessage(brightness));
 }
 
 void oclock::requests::publish_background_color_h(int h)
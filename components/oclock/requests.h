@@ -1,6 +1,6 @@
 #pragma once
 
-#include <set>
+#include <map>
 
 #include "interop.h"
 #include "master.h"
@@ -20,28 +20,50 @@ namespace oclock
 
         void publish_background_color_h(int h);
 
+        // from rich to cheap: the animations are degraded until the upload and its execution fit before the next minute
+        enum class UploadPlan
+        {
+            Full,
+            // no in-between animation
+            NoInBetween,
+            // straight to the goal over the shortest distance, the fewest keys
+            Direct,
+        };
+#define UPLOAD_PLANS 3
+// kept free before the next minute
+#define UPLOAD_MARGIN_MILLIS 250
+
+        // the estimates of the last upload and how often each plan was chosen (see TrackTimeRequest)
+        struct UploadBudget
+        {
+            Millis upload_millis{0}, execution_millis{0}, millis_left{0};
+            uint32_t plans[UPLOAD_PLANS] = {};
+
+            void dump_config(const char *tag) const;
+        };
+        extern UploadBudget uploadBudget;
+
         class AnimationRequest : public oclock::BroadcastRequest
         {
         protected:
             AnimationRequest() : BroadcastRequest("AnimationRequest") {}
-            void sendCommandsForHandle(int animatorHandleId, const std::vector<DeflatedCmdKey> &commands)
+            void sendCommandsForHandle(int animatorHandleId, const uint16_t *keys, std::size_t nmbrOfCommands)
             {
                 auto physicalHandleId = animationController.mapAnimatorHandle2PhysicalHandleId(animatorHandleId);
-                if (physicalHandleId < 0 || commands.empty())
+                if (physicalHandleId < 0 || nmbrOfCommands == 0)
                     // ignore
                     return;
 
-                auto nmbrOfCommands = commands.size();
                 UartKeysMessage msg(physicalHandleId, (u8)nmbrOfCommands);
                 for (std::size_t idx = 0; idx < nmbrOfCommands; ++idx)
                 {
-                    msg.set_key(idx, commands[idx].asInflatedCmdKey().raw);
+                    msg.set_key(idx, keys[idx]);
                 }
 
                 if (true)
                 {
                     ESP_LOGI(TAG, "send(S%02d, A%d->PA%d size: %d",
-                             animatorHandleId >> 1, animatorHandleId, physicalHandleId, commands.size());
+                             animatorHandleId >> 1, animatorHandleId, physicalHandleId, nmbrOfCommands);
 
                     if (false)
                     {
@@ -50,8 +72,7 @@ namespace oclock
                             const auto cmd = InflatedCmdKey(msg.get_key(idx));
                             if (cmd.extended())
                             {
-                                const auto extended_cmd = cmd.steps();
-                                ESP_LOGI(TAG, "Cmd: extended_cmd=%d", int(extended_cmd));
+                                ESP_LOGI(TAG, "Cmd: extended_cmd=%d, arg=%d", int(cmd.extended_value.mode), int(cmd.extended_value.argument));
                             }
                             else
                             {
@@ -69,47 +90,52 @@ namespace oclock
                 send(msg);
             }
 
-            void sendAndClear(int handleId, std::vector<DeflatedCmdKey> &selected)
-            {
-                if (selected.size() > 0)
-                {
-                    sendCommandsForHandle(handleId, selected);
-                    selected.clear();
-                }
-            }
-
-            void sendCommands(std::vector<HandleCmd> &cmds)
+            // the keys of every handle as they go on the wire, in order (folded when every slave knows REPEAT keys)
+            static void collectKeys(std::vector<HandleCmd> &cmds, std::vector<uint16_t> (&keys)[MAX_HANDLES])
             {
                 std::sort(std::begin(cmds), std::end(cmds), [](const HandleCmd &a, const HandleCmd &b)
                           { return a.handleId == b.handleId ? a.orderId < b.orderId : a.handleId < b.handleId; });
-                std::vector<DeflatedCmdKey> selected;
-                int lastHandleId = -1;
-                int lastHandleMessages = 0;
-                for (auto it = std::begin(cmds); it != std::end(cmds); ++it)
+                // every handle starts with bank 0
+                uint8_t banks[MAX_HANDLES] = {};
+                for (const auto &handleCmd : cmds)
                 {
-                    const auto &handleCmd = *it;
                     if (handleCmd.ignorable())
-                    {
                         // ignore ('deleted')
                         continue;
-                    }
-                    if (handleCmd.handleId != lastHandleId)
-                    {
-                        sendAndClear(lastHandleId, selected);
-                        ESP_LOGW(TAG, "H%d : %d messages", lastHandleId, lastHandleMessages);
-
-                        lastHandleId = handleCmd.handleId;
-                        lastHandleMessages = 0;
-                    }
-                    lastHandleMessages++;
-                    selected.push_back(handleCmd.cmd);
-                    if (selected.size() == MAX_ANIMATION_KEYS_PER_MESSAGE)
+                    auto &handleKeys = keys[handleCmd.handleId];
+                    const auto bank = handleCmd.cmd.speed_bank();
+                    if (!handleCmd.cmd.extended() && bank != banks[handleCmd.handleId])
                     {
-                        sendAndClear(lastHandleId, selected);
+                        handleKeys.push_back(InflatedCmdKey::speed_bank(bank).raw);
+                        banks[handleCmd.handleId] = bank;
                     }
+                    handleKeys.push_back(handleCmd.cmd.asInflatedCmdKey().raw);
+                }
+                const auto acceleration = Instructions::ramp_acceleration();
+                if (acceleration > 0)
+                    for (auto &handleKeys : keys)
+                        if (!handleKeys.empty())
+                            handleKeys.insert(handleKeys.begin(), InflatedCmdKey::ramp(acceleration).raw);
+                if (!oclock::bus_supports(Feature::KeyRepeats))
+                    return;
+                for (auto &handleKeys : keys)
+                    fold_repeats(handleKeys);
+            }
+
+            void sendCommands(std::vector<HandleCmd> &cmds)
+            {
+                std::vector<uint16_t> keys[MAX_HANDLES];
+                collectKeys(cmds, keys);
+                for (int handleId = 0; handleId < MAX_HANDLES; ++handleId)
+                {
+                    const auto &handleKeys = keys[handleId];
+                    if (handleKeys.empty())
+                        continue;
+                    for (std::size_t sent = 0; sent < handleKeys.size(); sent += MAX_ANIMATION_KEYS_PER_MESSAGE)
+                        sendCommandsForHandle(handleId, handleKeys.data() + sent,
+                                              std::min<std::size_t>(handleKeys.size() - sent, MAX_ANIMATION_KEYS_PER_MESSAGE));
+                    ESP_LOGW(TAG, "H%d : %d keys", handleId, handleKeys.size());
                 }
-                sendAndClear(lastHandleId, selected);
-                ESP_LOGW(TAG, "H%d : %d messages", lastHandleId, lastHandleMessages);
                 cmds.clear();
             }
 
@@ -133,45 +159,72 @@ namespace oclock
                 // state.debug();
             }
 
-            void updateSpeeds(const Instructions &instructions)
+            // the speeds of the keys, the ones that change their timing the least when there are too many of them
+            // returns the number of banks used (see Feature::WideSpeeds)
+            static uint8_t updateSpeeds(const Instructions &instructions)
             {
-                // gather speeds
-                std::set<int> new_speeds_as_set{1};
+                std::map<int, uint32_t> steps_per_speed;
                 for (const auto &cmd : instructions.cmds)
                 {
-                    if (cmd.ignorable() || cmd.ghost_or_alike())
+                    if (cmd.ignorable() || cmd.cmd.extended())
                         continue;
-                    new_speeds_as_set.insert(cmd.speed());
+                    // note: the ghosts are delays, their timing counts too
+                    steps_per_speed[cmd.speed()] += cmd.cmd.steps();
                 }
 
-                if (new_speeds_as_set.size() > cmdSpeedUtil.max_inflated_speed)
-                {
-                    ESP_LOGE(TAG, "Array!? size=%d, id=%d",
-                             new_speeds_as_set.size(), cmdSpeedUtil.max_inflated_speed);
-                    return;
-                }
+                const uint8_t banks = oclock::bus_supports(Feature::WideSpeeds) && steps_per_speed.size() > SPEEDS_PER_BANK ? SPEED_BANKS : 1;
+                const double error = cmdSpeedUtil.quantize_speeds(steps_per_speed, banks);
+                if (error > 0)
+                    ESP_LOGW(TAG, "speeds: %d in %d bank(s), off by %.2f steps per rpm",
+                             steps_per_speed.size(), banks, error);
+                return banks;
+            }
 
-                CmdSpeedUtil::Speeds speeds;
-                int last_speed = 1;
-                int idx = 0;
-                for (auto speed : new_speeds_as_set)
-                {
-                    speeds[idx++] = speed;
-                    last_speed = speed;
-                }
-                for (; idx <= cmdSpeedUtil.max_inflated_speed; ++idx)
-                {
-                    speeds[idx] = last_speed;
-                }
-                cmdSpeedUtil.set_speeds(speeds);
+            // the wire time of sendInstructions(instructions), mirrors sendCommands
+            // note: the keys are inflated with the speeds of the previous upload, the REPEATs may differ a little
+            static Micros estimate_upload_micros(const Instructions &instructions)
+            {
+                auto cmds = instructions.cmds;
+                std::vector<uint16_t> keys[MAX_HANDLES];
+                collectKeys(cmds, keys);
+
+                return oclock::estimate_wire_micros(
+                    [&](WireEstimate &estimate)
+                    {
+                        estimate.add<UartMessage>();
+                        // (at most)
+                        if (oclock::bus_supports(Feature::WideSpeeds))
+                            estimate.add<UartSpeedBankMessage>();
+                        for (int handleId = 0; handleId < MAX_HANDLES; ++handleId)
+                        {
+                            if (animationController.mapAnimatorHandle2PhysicalHandleId(handleId) < 0)
+                                continue;
+                            for (std::size_t sent = 0; sent < keys[handleId].size(); sent += MAX_ANIMATION_KEYS_PER_MESSAGE)
+                                estimate.add<UartKeysMessage>();
+                        }
+                        estimate.add<UartEndKeysMessage>();
+                        estimate.add_sequence_check();
+                    });
+            }
+
+            // how long the slowest handle will be busy
+            static Millis estimate_execution_millis(const Instructions &instructions)
+            {
+                double seconds = 0;
+                for (int handleId = 0; handleId < MAX_HANDLES; ++handleId)
+                    if (instructions.valid_handle(handleId))
+                        seconds = max(seconds, instructions.time_at(handleId));
+                return seconds * 1000;
             }
 
             void sendInstructions(Instructions &instructions, u32 millisLeft = u32(-1))
             {
-                updateSpeeds(instructions);
+                const auto banks = updateSpeeds(instructions);
 
                 // lets start transmitting
                 send(UartMessage(-1, MsgType::MSG_BEGIN_KEYS));
+                for (uint8_t bank = 1; bank < banks; ++bank)
+                    send(UartSpeedBankMessage(bank, cmdSpeedUtil.get_speeds(bank)));
 
                 // send instructions
                 sendCommands(instructions.cmds);
@@ -184,13 +237,14 @@ namespace oclock
                     instructions.get_speed_detection(),
                     millisLeft));
                 ESP_LOGI(TAG, "millisLeft=%ld", long(millisLeft));
+                oclock::queue_sequence_check();
             }
 
         public:
             virtual void execute() override final
             {
                 animationController.reset_handles();
-                send(UartPosRequest(false));
+                oclock::poll_positions(false);
             }
         };
 
@@ -459,6 +513,38 @@ namespace oclock
                 }
             }
 
+            void instruct(Instructions &instructions, UploadPlan plan, const HandlesState &goal, int speed, bool act_as_second_handle)
+            {
+                // final animation
+                auto distanceCalculator = plan == UploadPlan::Direct ? DistanceCalculators::shortest : selectDistanceCalculator();
+                auto finalAnimator = plan == UploadPlan::Direct ? HandlesAnimations::instructUsingStepCalculator : selectFinalAnimator();
+
+                // inbetween
+                if (plan == UploadPlan::Full)
+                    selectInBetweenAnimation()(instructions, speed);
+                finalAnimator(instructions, speed, goal, distanceCalculator);
+
+                // lets wait for all...
+                InBetweenAnimations::instructDelayUntilAllAreReady(instructions, 32);
+                if (act_as_second_handle)
+                    instructions.iterate_handle_ids(
+                        [&](int handle_id)
+                        {
+                            if (!goal.visibilityFlags[handle_id])
+                                instructions.follow_seconds(handle_id, true);
+                        });
+            }
+
+            bool fits(const Instructions &instructions, UploadPlan plan, float millis_left)
+            {
+                uploadBudget.upload_millis = estimate_upload_micros(instructions) / 1000;
+                uploadBudget.execution_millis = estimate_execution_millis(instructions);
+                uploadBudget.millis_left = millis_left;
+                ESP_LOGI(TAG, "budget(plan=%d): upload %ld + execution %ld of %ld millis", int(plan),
+                         long(uploadBudget.upload_millis), long(uploadBudget.execution_millis), long(millis_left));
+                return uploadBudget.upload_millis + uploadBudget.execution_millis + UPLOAD_MARGIN_MILLIS <= millis_left;
+            }
+
         public:
             TrackTimeRequest(const oclock::time_tracker::TextTracker &tracker) : tracker(tracker) {}
 
@@ -474,9 +560,8 @@ namespace oclock
                 copyTo(clockChars, goal);
                 bool act_as_second_handle = true;
 
-                Instructions instructions;
                 if (act_as_second_handle)
-                    instructions.iterate_handle_ids(
+                    Instructions().iterate_handle_ids(
                         [&](int handle_id)
                         {
                             if (!goal.visibilityFlags[handle_id])
@@ -484,31 +569,27 @@ namespace oclock
                                 goal.set_ticks(handle_id, 0);
                         });
 
-                // final animation
-
-                // inbetween
-                auto inBetweenAnimation = selectInBetweenAnimation();
-                auto distanceCalculator = selectDistanceCalculator();
-                auto finalAnimator = selectFinalAnimator();
-
                 auto speed = tracker.get_speed_multiplier() * oclock::master.get_base_speed();
-
-                selectInBetweenAnimation()(instructions, speed);
-                selectFinalAnimator()(instructions, speed, goal, distanceCalculator);
-
-                // lets wait for all...
-                InBetweenAnimations::instructDelayUntilAllAreReady(instructions, 32);
                 float millis_left = text.millis_left;
                 ESP_LOGI(TAG, "millis_left: %f", millis_left);
-                if (act_as_second_handle)
-                    instructions.iterate_handle_ids(
-                        [&](int handle_id)
-                        {
-                            if (!goal.visibilityFlags[handle_id])
-                                instructions.follow_seconds(handle_id, true);
-                        });
 
-                sendInstructions(instructions, millis_left);
+                for (int idx = 0; idx < UPLOAD_PLANS; ++idx)
+                {
+                    const auto plan = UploadPlan(idx);
+                    Instructions instructions;
+                    instruct(instructions, plan, goal, speed, act_as_second_handle);
+                    const bool fitting = fits(instructions, plan, millis_left);
+                    // the cheapest one is sent anyway
+                    if (!fitting && idx + 1 < UPLOAD_PLANS)
+                        continue;
+                    if (!fitting)
+                        ESP_LOGW(TAG, "plan=%d does not fit in %ld millis", idx, long(millis_left));
+                    else if (plan != UploadPlan::Full)
+                        ESP_LOGW(TAG, "degraded to plan=%d to fit in %ld millis", idx, long(millis_left));
+                    uploadBudget.plans[idx]++;
+                    sendInstructions(instructions, millis_left);
+                    return;
+                }
             }
         };
 
@@ -522,7 +603,7 @@ namespace oclock
             virtual void execute() override final
             {
                 animationController.reset_handles();
-                send(UartPosRequest(stop_));
+                oclock::poll_positions(stop_);
             }
         };
 
@@ -594,14 +675,18 @@ namespace oclock
         public:
             virtual void execute() override final
             {
-                // inform that we will stop
-                send(UartInformToStopAnimationRequest());
+                // inform that we will stop (again, something might be started in the meantime)
+                oclock::send_control(UartInformToStopAnimationRequest());
                 // wait until stopped
                 send(UartWaitUntilAnimationIsDoneRequest());
             }
 
         public:
-            WaitUntilAnimationIsDoneRequest() : BroadcastRequest("WaitUntilAnimationIsDoneRequest") {}
+            WaitUntilAnimationIsDoneRequest() : BroadcastRequest("WaitUntilAnimationIsDoneRequest")
+            {
+                // stop right away, not after the requests queued before us (see TxPriority)
+                oclock::send_control(UartInformToStopAnimationRequest());
+            }
         };
 
         class DumpSlaveLogsRequest : public BroadcastRequest
@@ -11,6 +11,8 @@ SlaveSettings slave_settings;
 bool forwardPulse = false;
 int8_t slaveId = -2;
 int8_t nextSlaveId = -2;
+// the features (see FEATURE_BIT) the master enabled for the whole bus, see MSG_ID_DONE
+uint16_t busFeatures = 0;
 
 #include "pins.h"
 
@@ -40,8 +42,8 @@ public:
 
 #include "interop.h"
 
-byte receiverBufferBytes[RECEIVER_BUFFER_SIZE];
-auto receiverBuffer = Buffer(receiverBufferBytes, RECEIVER_BUFFER_SIZE);
+byte receiverBufferBytes[RX_QUEUE_SIZE];
+auto receiverBuffer = Buffer(receiverBufferBytes, RX_QUEUE_SIZE);
 RS485Gate<RS485_DE_PIN, RS485_RE_PIN> gate;
 InteropRS485 uart(ALL_SLAVES, gate, receiverBuffer);
 
@@ -340,9 +342,9 @@ void do_slave_config_request(const UartSlaveConfigRequest *msg)
     change = preMain1.set_initial_ticks(msg->initial_ticks1) || change;
 
     ESP_LOGI(TAG, "handle_off(%d, %d)",
-             msg->handle_offset0, msg->handle_offset1);
+             int(msg->handle_offset0), int(msg->handle_offset1));
     ESP_LOGI(TAG, "initial_ticks(%d, %d)",
-             msg->initial_ticks0, msg->initial_ticks1);
+             int(msg->initial_ticks0), int(msg->initial_ticks1));
     // if (change)
     {
         preMain0.reset();
@@ -350,6 +352,110 @@ void do_slave_config_request(const UartSlaveConfigRequest *msg)
     }
 }
 
+// see UartBaudProbeMessage
+struct BaudProbe
+{
+    bool active{false};
+    uint32_t baud_rate{0};
+    // the baud rate to return to after the window
+    uint32_t fallback{0};
+    Millis start{0};
+    uint16_t window_millis{0};
+    uint8_t received{0};
+    uint16_t errors{0};
+    unsigned long error_count{0};
+} baudProbe;
+
+// a position request sent to the broadcast address, answered in our own slot (see response_slot_offset)
+struct SlottedResponse
+{
+    bool pending{false};
+    bool stop{false};
+    Micros due{0};
+} slottedResponse;
+
+bool on_id_reset(const UartMessage *msg)
+{
+    LedUtil::debug(3);
+    Sync::write(LOW);
+
+    LedUtil::debug(4);
+    return true;
+}
+
+bool on_id_accept(const UartMessage *msg)
+{
+    LedUtil::debug(3);
+    LedUtil::debug(6);
+    if (Sync::read() == HIGH && slaveId == -2)
+    {
+        LedUtil::debug(8);
+        auto acceptMsg = reinterpret_cast<const UartAcceptMessage *>(msg);
+        slaveId = acceptMsg->getAssignedId();
+        nextSlaveId = slaveId + 2;
+        uart.setOwnerId(slaveId);
+        Sync::write(HIGH);
+
+        pushLogs();
+        // only pass on what we (and all before us) support: framings, receive capacity, protocol version and features
+        uart.send(acceptMsg->passed_on(uart.dispatch_length(), slaveId));
+        uart.start_receiving();
+
+        LedUtil::debug(9);
+    }
+    else
+    {
+        LedUtil::debug(7);
+    }
+    return true;
+}
+
+bool on_id_done(const UartMessage *msg)
+{
+    LedUtil::debug(3);
+    // wait until premains are done
+    while (preMain0.busy() || preMain1.busy())
+    {
+        auto now = ::micros();
+        preMain0.loop(now);
+        preMain1.loop(now);
+    }
+
+    LedUtil::debug(10);
+    auto doneMsg = reinterpret_cast<const UartDoneMessage *>(msg);
+    if (doneMsg->assignedId == nextSlaveId)
+        nextSlaveId = -1;
+
+    uart.upgrade_baud_rate(doneMsg->baud_rate);
+    uart.set_framing(doneMsg->framing_of(uart.dispatch_length()));
+    busFeatures = doneMsg->features_of(uart.dispatch_length());
+    uart.set_broadcast(busFeatures & FEATURE_BIT(Feature::Broadcast));
+    uart.start_receiving();
+    Sync::write(LOW);
+
+    delay(50);
+
+    LedUtil::debug(11);
+    internalResetChecker.enable();
+    changeToMainTask();
+    return true;
+}
+
+bool on_init_unexpected(const UartMessage *msg)
+{
+    LedUtil::debug(3);
+    LedUtil::debug(5);
+    return false;
+}
+
+constexpr MessageRoute initRoutes[] = {
+    {MSG_ID_RESET, on_id_reset},
+    {MSG_ID_ACCEPT, on_id_accept},
+    {MSG_SLAVE_CONFIG, handle<UartSlaveConfigRequest, do_slave_config_request>},
+    {MSG_ID_DONE, on_id_done},
+};
+constexpr DispatchTable initTable PROGMEM = DispatchTable::make(initRoutes, on_init_unexpected);
+
 void change_to_init()
 {
     LedUtil::debug(2);
@@ -357,80 +463,15 @@ void change_to_init()
 
     cmdSpeedUtil.reset();
     StepExecutors::reset();
+    uart.reset_sequence();
+    uart.set_broadcast(false);
+    baudProbe.active = false;
+    slottedResponse.pending = false;
 
     Sync::write(HIGH);
     slaveId = -2;
 
-    auto listener = [](const UartMessage *msg)
-    {
-        LedUtil::debug(3);
-        switch (msg->getMessageType())
-        {
-        case MsgType::MSG_ID_RESET:
-            Sync::write(LOW);
-
-            LedUtil::debug(4);
-            return true;
-
-        case MsgType::MSG_ID_ACCEPT:
-            LedUtil::debug(6);
-            if (Sync::read() == HIGH && slaveId == -2)
-            {
-                LedUtil::debug(8);
-                slaveId = ((UartAcceptMessage *)msg)->getAssignedId();
-                nextSlaveId = slaveId + 2;
-                uart.setOwnerId(slaveId);
-                Sync::write(HIGH);
-
-                pushLogs();
-                uart.send(UartAcceptMessage(slaveId, slaveId + 2));
-                uart.start_receiving();
-
-                LedUtil::debug(9);
-            }
-            else
-            {
-                LedUtil::debug(7);
-            }
-            return true;
-
-        case MSG_SLAVE_CONFIG:
-            do_slave_config_request(reinterpret_cast<const UartSlaveConfigRequest *>(msg));
-            return true;
-
-        case MsgType::MSG_ID_DONE:
-        {
-            // wait until premains are done
-            while (preMain0.busy() || preMain1.busy())
-            {
-                auto now = ::micros();
-                preMain0.loop(now);
-                preMain1.loop(now);
-            }
-
-            LedUtil::debug(10);
-            auto doneMsg = reinterpret_cast<const UartDoneMessage *>(msg);
-            if (doneMsg->assignedId == nextSlaveId)
-                nextSlaveId = -1;
-
-            uart.upgrade_baud_rate(doneMsg->baud_rate);
-            uart.start_receiving();
-            Sync::write(LOW);
-
-            delay(50);
-
-            LedUtil::debug(11);
-            internalResetChecker.enable();
-            changeToMainTask();
-            return true;
-        }
-
-        default:
-            LedUtil::debug(5);
-            return false;
-        };
-    };
-    uart.set_listener(listener);
+    uart.set_dispatch(initTable);
     uart.start_receiving();
 }
 
@@ -438,6 +479,7 @@ void dump_config()
 {
     auto tag = F("");
     ESP_LOGI(tag, "slave: S%d", slaveId >> 1);
+    ESP_LOGI(tag, " protocol: %d (features: %04x of %04x)", PROTOCOL_VERSION, busFeatures, SUPPORTED_FEATURES);
     ESP_LOGI(tag, " steppers:");
     stepper0.dump_config(tag);
     stepper1.dump_config(tag);
@@ -454,11 +496,67 @@ void do_wait_for_animation()
     {
         loop();
     }
-    delay(5); // FIX CRC ERRORS?
     uart.send(UartWaitUntilAnimationIsDoneRequest(slaveId, nextSlaveId));
     uart.start_receiving();
 }
 
+void do_sequence_check(const UartSeqCheckMessage *msg)
+{
+    const auto missing = msg->missing | uart.missing_sequences(msg->next_seq);
+    uart.send(UartSeqCheckMessage(slaveId, nextSlaveId, msg->next_seq, missing));
+    uart.start_receiving();
+}
+
+void do_baud_probe(const UartBaudProbeMessage *msg)
+{
+    baudProbe.active = true;
+    baudProbe.baud_rate = msg->baud_rate;
+    baudProbe.fallback = uart.get_baud_rate();
+    baudProbe.start = millis();
+    baudProbe.window_millis = msg->window_millis;
+    baudProbe.received = 0;
+    baudProbe.errors = 0;
+
+    uart.upgrade_baud_rate(msg->baud_rate);
+    uart.start_receiving();
+    baudProbe.error_count = uart.error_count();
+}
+
+void do_baud_pattern(const UartBaudPatternMessage *msg)
+{
+    if (!baudProbe.active)
+        return;
+    if (msg->valid())
+        baudProbe.received++;
+    else
+        baudProbe.errors++;
+}
+
+void loop_baud_probe(Millis now)
+{
+    if (!baudProbe.active || now - baudProbe.start < baudProbe.window_millis)
+        return;
+
+    baudProbe.active = false;
+    baudProbe.errors += uart.error_count() - baudProbe.error_count;
+    uart.upgrade_baud_rate(baudProbe.fallback);
+    uart.start_receiving();
+}
+
+void do_baud_report(const UartBaudReportMessage *msg)
+{
+    // nothing received if we never switched to this baud rate
+    const bool probed = baudProbe.baud_rate == msg->baud_rate;
+    uart.send(UartBaudReportMessage(slaveId, nextSlaveId, msg->baud_rate, probed ? baudProbe.received : 0, probed ? baudProbe.errors : 0));
+    uart.start_receiving();
+}
+
+void do_baud_commit(const UartBaudCommitMessage *msg)
+{
+    uart.upgrade_baud_rate(msg->baud_rate);
+    uart.start_receiving();
+}
+
 void do_dump_logs_request(const UartDumpLogsRequest *msg)
 {
     auto alsoConfig = msg->dump_config;
@@ -472,6 +570,60 @@ void do_dump_logs_request(const UartDumpLogsRequest *msg)
     uart.start_receiving();
 }
 
+void current_positions(uint16_t &pos0, uint16_t &pos1, bool &initialized)
+{
+    auto busy = preMain0.busy() || preMain1.busy();
+    auto stepper0Ticks = preMain0.busy() ? Ticks::normalize(-stepper0.get_offset_steps()) : stepper0.ticks();
+    auto stepper1Ticks = preMain1.busy() ? Ticks::normalize(-stepper1.get_offset_steps()) : stepper1.ticks();
+
+    pos0 = stepper0Ticks / STEP_MULTIPLIER;
+    pos1 = stepper1Ticks / STEP_MULTIPLIER;
+    initialized = !busy;
+}
+
+void send_position(bool stop, u8 destination_id)
+{
+    uint16_t pos0, pos1;
+    bool initialized;
+    current_positions(pos0, pos1, initialized);
+
+    uart.send(UartPosRequest(stop, slaveId, destination_id, pos0, pos1, initialized));
+    uart.start_receiving();
+}
+
+void do_status_request(const UartStatusMessage *msg)
+{
+    const bool stop = msg->stop;
+    if (stop)
+    {
+        preMain0.stop();
+        preMain1.stop();
+    }
+
+    // copy what the slaves before us filled in
+    UartStatusMessage status(stop, slaveId, nextSlaveId);
+    const uint8_t count = msg->count < UartStatusMessage::MAX_RECORDS ? msg->count : UartStatusMessage::MAX_RECORDS;
+    memcpy(status.records, msg->records, count * sizeof(UartStatusMessage::Record));
+    status.count = count;
+
+    const uint8_t idx = slaveId >> 1;
+    if (idx < UartStatusMessage::MAX_RECORDS)
+    {
+        uint16_t pos0, pos1;
+        bool initialized;
+        current_positions(pos0, pos1, initialized);
+
+        const unsigned long errors = uart.error_count();
+        status.records[idx].set(pos0, pos1, initialized, errors < UartStatusMessage::MAX_ERRORS ? errors : UartStatusMessage::MAX_ERRORS);
+        if (status.count <= idx)
+            status.count = idx + 1;
+    }
+
+    pushLogs();
+    uart.send_raw(&status, status.size());
+    uart.start_receiving();
+}
+
 void do_position_request(const UartMessage *msg)
 {
     LedUtil::debug(12);
@@ -483,26 +635,70 @@ void do_position_request(const UartMessage *msg)
         preMain1.stop();
     }
 
-    auto busy = preMain0.busy() || preMain1.busy();
-    auto stepper0Ticks = preMain0.busy() ? Ticks::normalize(-stepper0.get_offset_steps()) : stepper0.ticks();
-    auto stepper1Ticks = preMain1.busy() ? Ticks::normalize(-stepper1.get_offset_steps()) : stepper1.ticks();
+    if (Broadcast::is(msg->getDstId()))
+    {
+        // no logs, they would not fit in our slot
+        slottedResponse.pending = true;
+        slottedResponse.stop = stop;
+        slottedResponse.due = uart.received_at() + response_slot_offset(uart, sizeof(UartPosRequest), slaveId);
+        return;
+    }
 
     pushLogs();
-    delay(5); // FIX CRC ERRORS?
-    uart.send(UartPosRequest(stop, slaveId, nextSlaveId, stepper0Ticks / STEP_MULTIPLIER, stepper1Ticks / STEP_MULTIPLIER, !busy));
-    uart.start_receiving();
+    send_position(stop, nextSlaveId);
+}
+
+void loop_slotted_response(Micros now)
+{
+    if (!slottedResponse.pending || long(now - slottedResponse.due) < 0)
+        return;
+
+    slottedResponse.pending = false;
+    send_position(slottedResponse.stop, 0xFF);
+}
+
+void set_rgb_leds(bool foreground, const oclock::RgbColorLeds &leds)
+{
+    if (foreground)
+    {
+        rgbLedForegroundLayer(leds);
+        slave_settings.set_foreground_mode(oclock::ForegroundEnum::RgbColors);
+    }
+    else
+    {
+        rgbLedBackgroundLayer(leds);
+        slave_settings.set_background_mode(oclock::BackgroundEnum::RgbColors);
+    }
 }
 
 void do_rgb_leds(const UartRgbBackgroundLedsMessage *msg)
 {
-    rgbLedBackgroundLayer(msg->leds);
-    slave_settings.set_background_mode(oclock::BackgroundEnum::RgbColors);
+    set_rgb_leds(false, msg->leds);
 }
 
 void do_rgb_leds(const UartRgbForegroundLedsMessage *msg)
 {
-    rgbLedForegroundLayer(msg->leds);
-    slave_settings.set_foreground_mode(oclock::ForegroundEnum::RgbColors);
+    set_rgb_leds(true, msg->leds);
+}
+
+void do_rgb16_leds(const UartRgb16LedsMessage *msg)
+{
+    oclock::RgbColorLeds leds;
+    msg->decode(leds);
+    set_rgb_leds(msg->foreground, leds);
+}
+
+bool on_palette_leds(const UartMessage *msg)
+{
+    auto paletteMsg = reinterpret_cast<const UartPaletteLedsMessage *>(msg);
+    // only the colors in use are sent
+    if (!paletteMsg->valid(uart.dispatch_length()))
+        return false;
+
+    oclock::RgbColorLeds leds;
+    paletteMsg->decode(leds);
+    set_rgb_leds(paletteMsg->foreground, leds);
+    return true;
 }
 
 void do_led_background_mode_request(const LedModeRequest *msg)
@@ -620,85 +816,50 @@ void SlaveSettings::set_scaled_brightness(int value)
     ledAsync.updateLeds();
 }
 
-auto uartMainListener = [](const UartMessage *msg)
+void do_debug_led_layer(const UartBoolMessage *msg)
 {
-    switch (msg->getMessageType())
-    {
-    case MsgType::MSG_BRIGHTNESS:
-        do_brightness_request(reinterpret_cast<const UartScaledBrightnessMessage *>(msg));
-        return true;
-
-    case MsgType::MSG_BOOL_DEBUG_LED_LAYER:
-        if (reinterpret_cast<const UartBoolMessage *>(msg)->value)
-        {
-            ledAsync.set_foreground_led_layer(&debugLedLayer());
-        }
-        else
-        {
-            ledAsync.set_foreground_led_layer(nullptr);
-        }
-        return true;
-
-    case MsgType::MSG_COLOR:
-        do_color_request(reinterpret_cast<const UartColorMessage *>(msg));
-        return true;
-
-    case MsgType::MSG_CALIBRATE_START:
-        do_calibrate(true);
-        return true;
-
-    case MsgType::MSG_CALIBRATE_END:
-        do_calibrate(false);
-        return true;
-
-    case MsgType::MSG_BEGIN_KEYS:
-        StepExecutors::process_begin_keys(msg);
-        return true;
-
-    case MsgType::MSG_SEND_KEYS:
-        StepExecutors::process_add_keys(reinterpret_cast<const UartKeysMessage *>(msg));
-        return true;
-
-    case MsgType::MSG_END_KEYS:
-        StepExecutors::process_end_keys(slaveId, reinterpret_cast<const UartEndKeysMessage *>(msg));
-        return true;
-
-    case MSG_POS_REQUEST:
-        do_position_request(msg);
-        return true;
-
-    case MSG_DUMP_LOG_REQUEST:
-        do_dump_logs_request(reinterpret_cast<const UartDumpLogsRequest *>(msg));
-        return true;
-
-    case MSG_WAIT_FOR_ANIMATION:
-        do_wait_for_animation();
-        return true;
-
-    case MSG_INFORM_STOP_ANIMATION:
-        do_inform_stop_animation();
-        return true;
-
-    case MSG_LED_MODE:
-        do_led_mode_request(reinterpret_cast<const LedModeRequest *>(msg));
-        return true;
+    ledAsync.set_foreground_led_layer(msg->value ? &debugLedLayer() : nullptr);
+}
 
-    case MSG_BACKGROUND_RGB_LEDS:
-        do_rgb_leds(reinterpret_cast<const UartRgbBackgroundLedsMessage *>(msg));
-        return true;
+void do_calibrate_start() { do_calibrate(true); }
+void do_calibrate_end() { do_calibrate(false); }
 
-    case MSG_FOREGROUND_RGB_LEDS:
-        do_rgb_leds(reinterpret_cast<const UartRgbForegroundLedsMessage *>(msg));
-        return true;
+void do_end_keys(const UartEndKeysMessage *msg)
+{
+    StepExecutors::process_end_keys(slaveId, msg);
+}
 
-    default:
-        return false;
-    }
+constexpr MessageRoute mainRoutes[] = {
+    {MSG_BRIGHTNESS, handle<UartScaledBrightnessMessage, do_brightness_request>},
+    {MSG_BOOL_DEBUG_LED_LAYER, handle<UartBoolMessage, do_debug_led_layer>},
+    {MSG_COLOR, handle<UartColorMessage, do_color_request>},
+    {MSG_CALIBRATE_START, handle<do_calibrate_start>},
+    {MSG_CALIBRATE_END, handle<do_calibrate_end>},
+    {MSG_BEGIN_KEYS, handle<UartMessage, StepExecutors::process_begin_keys>},
+    {MSG_SEND_KEYS, handle<UartKeysMessage, StepExecutors::process_add_keys>},
+    {MSG_END_KEYS, handle<UartEndKeysMessage, do_end_keys>},
+    {MSG_SPEED_BANK, handle<UartSpeedBankMessage, StepExecutors::process_speed_bank>},
+    {MSG_POS_REQUEST, handle<UartMessage, do_position_request>},
+    {MSG_STATUS, handle<UartStatusMessage, do_status_request>},
+    {MSG_DUMP_LOG_REQUEST, handle<UartDumpLogsRequest, do_dump_logs_request>},
+    {MSG_WAIT_FOR_ANIMATION, handle<do_wait_for_animation>},
+    {MSG_SEQ_CHECK, handle<UartSeqCheckMessage, do_sequence_check>},
+    {MSG_BAUD_PROBE, handle<UartBaudProbeMessage, do_baud_probe>},
+    {MSG_BAUD_PATTERN, handle<UartBaudPatternMessage, do_baud_pattern>},
+    {MSG_BAUD_REPORT, handle<UartBaudReportMessage, do_baud_report>},
+    {MSG_BAUD_COMMIT, handle<UartBaudCommitMessage, do_baud_commit>},
+    {MSG_INFORM_STOP_ANIMATION, handle<do_inform_stop_animation>},
+    {MSG_LED_MODE, handle<LedModeRequest, do_led_mode_request>},
+    {MSG_BACKGROUND_RGB_LEDS, handle<UartRgbBackgroundLedsMessage, do_rgb_leds>},
+    {MSG_FOREGROUND_RGB_LEDS, handle<UartRgbForegroundLedsMessage, do_rgb_leds>},
+    {MSG_RGB16_LEDS, handle<UartRgb16LedsMessage, do_rgb16_leds>},
+    {MSG_PALETTE_LEDS, on_palette_leds},
 };
+constexpr DispatchTable mainTable PROGMEM = DispatchTable::make(mainRoutes);
 
 void changeToMainTask()
 {
-    uart.set_listener(uartMainListener);
+    uart.set_dispatch(mainTable);
     uart.start_receiving();
 }
 
@@ -765,6 +926,8 @@ void loop()
 
     // this way the motors will be able to use speed 64
     uart.loop();
+    loop_slotted_response(micros());
+    loop_baud_probe(millis());
     internalResetChecker.loop(now);
     ledAsync.loop(now);
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <FastGPIO.h>
 #define USE_FAST_GPIO
 
+#include "ramp.h"
+
 typedef unsigned long Micros;
 
 typedef uint8_t PinValue;
@@ -39,6 +41,10 @@ public:
   int16_t step_current = 0;
   bool pulsing = false; // currently pulsing
   bool behind = false;
+  // the steps of a ramp are due at fixed times (instead of a delay after the previous one), see start_ramp
+  bool ramping = false;
+  TrackTime ramp_due = 0;
+  Ramp ramp;
   SpeedInRevsPerMinuteInt speed_in_revs_per_minute = 1;
 
   inline bool get_magnet_pin() const // __attribute__((always_inline))
@@ -122,6 +128,25 @@ public:
     defecting = false;
   }
 
+  // 'steps' from standing still to standing still, right after the previous ramp when chained
+  void start_ramp(uint16_t steps, uint8_t speed, uint16_t acceleration, Micros now, bool chained)
+  {
+    ramp.start(steps, speed, acceleration);
+    ramping = true;
+    ramp_due = (chained ? ramp_due : TrackTime(now)) + ramp.next();
+  }
+
+  // returns the steps left to stand still
+  uint16_t stop_ramp()
+  {
+    return ramp.stop();
+  }
+
+  void end_ramp()
+  {
+    ramping = false;
+  }
+
   bool is_magnet_tick()
   {
     auto isCenterPinLow = get_magnet_pin();
@@ -217,7 +242,14 @@ public:
       return false;
     }
 
-    if (diff < (speed_up ? step_current : step_delay))
+    if (ramping)
+    {
+      if (TrackTime(now) - ramp_due < 0)
+        return false;
+      if (!ramp.done())
+        ramp_due += ramp.next();
+    }
+    else if (diff < (speed_up ? step_current : step_delay))
     {
       // we need to wait
       return false;
@@ -227,7 +259,7 @@ public:
     next_step_time += defecting ? defecting_delay : step_delay;
     pulsing = true;
 
-    if (speed_up)
+    if (speed_up && !ramping)
     {
       // previous was faster
       // bool too_fast = last_step_time < next_step_time;
@@ -296,6 +328,7 @@ public:
   void sync()
   {
     this->defecting = false;
+    this->ramping = false;
     this->step_current = 0;
     this->last_step_time = 0;
     this->first_step_time = 0;
@@ -1,5 +1,7 @@
 #include "steps_executor.h"
 
+static_assert(RAMP_STEPS_PER_REVOLUTION == NUMBER_OF_STEPS, "Ramp is off");
+
 enum class StepMode
 {
     // we are speeding up the handle  honour the key request
@@ -41,19 +43,22 @@ public:
 
     void addAll(const AnimationKeys &keys)
     {
-        for (int i = 0; i < keys.size(); ++i)
+        for (int i = 0; i < keys.size() && idx < MAX_ANIMATION_KEYS; ++i)
             cmds[idx++] = keys.cmds[i];
     }
 
     void addAll(const UartKeysMessage &msg)
     {
-        for (int i = 0; i < msg.size(); ++i)
+        for (int i = 0; i < msg.size() && idx < MAX_ANIMATION_KEYS; ++i)
             cmds[idx++] = InflatedCmdKey(msg.get_key(i));
     }
 };
 
 uint16_t reverse_steps = 5;
 
+// see Animator::last
+#define NO_KEY 0xFF
+
 template <class S>
 class Animator final
 {
@@ -63,9 +68,21 @@ public:
     S *stepperPtr;
     AnimationKeys *keysPtr = nullptr;
     uint8_t idx = 0;
+    // the key executed before the current one (after a REPEAT it is not idx - 1)
+    uint8_t last = NO_KEY;
+    // the passes left of the REPEAT at hand, 0 when it is not started yet
+    uint8_t repeats = 0;
+    // see CmdSpecialMode::SPEED_BANK
+    uint8_t bank = 0;
+    // see CmdSpecialMode::RAMP, 0 for speed detection
+    uint16_t acceleration = 0;
+    // the previous key ramped, the next one starts right after its last step
+    bool ramped = false;
     uint8_t turning = 0;
     StepMode step_mode = StepMode::SPEED_DOWN;
     uint16_t steps = 0;
+    // the steps of the current key, less the ones to speed up / down (the keys are executed again with a REPEAT)
+    uint16_t key_steps = 0;
     bool special = false;
     bool speed_detection = false;
     bool speed_up = false;
@@ -81,6 +98,12 @@ public:
         {
             return;
         }
+        if (stepperPtr->ramping)
+        {
+            if (steps > 0)
+                steps = min(steps, stepperPtr->stop_ramp() + 1);
+            return;
+        }
         if (step_mode == StepMode::CLOCKWISE || step_mode == StepMode::ANTI_CLOCKWISE)
         {
             // actually we do not care what the intended speed was
@@ -111,6 +134,30 @@ public:
             stepperPtr->tryToStep(now);
     }
 
+    // the key executed after the one at 'index', following a REPEAT and past the SPEED_BANK keys
+    uint8_t next_index(uint8_t index) const
+    {
+        const auto &keys = *keysPtr;
+        uint8_t next = index + 1;
+        // only the first REPEAT ahead can be in progress
+        uint8_t left = repeats;
+        for (uint8_t hops = 0; next < keys.size() && hops < MAX_ANIMATION_KEYS; ++hops)
+        {
+            const auto &cmd = keys[next];
+            if (cmd.switches_bank() || cmd.ramp())
+            {
+                next++;
+                continue;
+            }
+            if (!cmd.repeat())
+                break;
+            const bool again = left > 1 || (left == 0 && cmd.repeat_times() > 0);
+            left = 0;
+            next = again ? next - cmd.repeat_keys() : next + 1;
+        }
+        return next;
+    }
+
     inline bool fast_enough(int speed) __attribute__((always_inline))
     {
         return speed > stepperPtr->turn_speed_in_revs_per_minute;
@@ -124,15 +171,15 @@ public:
 
         const auto &keys = *keysPtr;
         const auto &cur = keys[idx];
-        const auto cur_speed = cmdSpeedUtil.deflate_speed(cur.inflated_speed());
+        const auto cur_speed = cmdSpeedUtil.deflate_speed(cur.inflated_speed(), bank);
 
         if (cur.ghost_or_alike())
             // the stepper is 'not stepping'
             return false;
-        if (idx == 0)
+        if (last == NO_KEY)
             // first command
             return fast_enough(cur_speed);
-        const auto &prev = keys[idx - 1];
+        const auto &prev = keys[last];
         if (prev.ghost_or_alike())
             // threat as first command
             return fast_enough(cur_speed);
@@ -149,17 +196,18 @@ public:
             return false;
         const auto &keys = *keysPtr;
         const auto &cur = keys[idx];
-        const auto cur_speed = cmdSpeedUtil.deflate_speed(cur.inflated_speed());
+        const auto cur_speed = cmdSpeedUtil.deflate_speed(cur.inflated_speed(), bank);
         if (cur.ghost_or_alike())
             // the stepper is 'not stepping'
             return false;
 
-        if (idx + 1 >= MAX_ANIMATION_KEYS || request_stop_)
+        const auto next = next_index(idx);
+        if (next >= keys.size() || request_stop_)
         {
             // last command, so lets check if we need to slow down
             return fast_enough(cur_speed);
         }
-        const auto &nxt = keys[idx + 1];
+        const auto &nxt = keys[next];
         if (nxt.empty() || nxt.ghost_or_alike())
             // last command, or next is still... lets check if we need to step down...
             return fast_enough(cur_speed);
@@ -229,6 +277,7 @@ public:
 
         auto &keys = *keysPtr;
         stepper.disable_defecting();
+        stepper.end_ramp();
         if (idx == keys.size())
         {
             // nothing to do
@@ -242,9 +291,10 @@ public:
             keysPtr = nullptr;
             return;
         }
-        const auto speed = cmd.extended() ? 4 : cmdSpeedUtil.deflate_speed(cmd.inflated_speed());
+        const auto speed = cmd.extended() ? 4 : cmdSpeedUtil.deflate_speed(cmd.inflated_speed(), bank);
         const auto clockwise = cmd.clockwise();
-        step_mode = clockwise ? StepMode::CLOCKWISE : StepMode::ANTI_CLOCKWISE;
+        // note: the direction bit of an extended key can be part of its argument (see WAIT_UNTIL), it is not stepping
+        step_mode = cmd.extended() ? StepMode::SPEED_DOWN : clockwise ? StepMode::CLOCKWISE : StepMode::ANTI_CLOCKWISE;
         if (turning == 0)
         {
             if (request_stop_)
@@ -253,18 +303,49 @@ public:
                 keysPtr = nullptr;
                 return;
             }
-            speed_up = needs_speed_up();
-            speed_down = needs_speed_down();
-#define STEPS keys[idx].value.steps
-            if (speed_up && STEPS >= reverse_steps)
-                STEPS -= reverse_steps;
+            if (cmd.repeat())
+            {
+                if (repeats == 0)
+                    repeats = cmd.repeat_times() + 1;
+                if (--repeats > 0)
+                    idx -= cmd.repeat_keys();
+                else
+                    idx++;
+                return;
+            }
+            if (cmd.switches_bank())
+            {
+                bank = cmd.bank();
+                idx++;
+                return;
+            }
+            if (cmd.ramp())
+            {
+                acceleration = cmd.acceleration();
+                idx++;
+                return;
+            }
+            if (cmd.waits())
+            {
+                // the next ramp starts from standing still
+                ramped = false;
+                if (::millis() - t0 >= cmd.wait_until_millis())
+                    idx++;
+                return;
+            }
+            // a ramp speeds up and down by itself
+            const bool ramp = acceleration > 0 && !cmd.ghost_or_alike();
+            speed_up = !ramp && needs_speed_up();
+            speed_down = !ramp && needs_speed_down();
+            key_steps = cmd.steps();
+            if (speed_up && key_steps >= reverse_steps)
+                key_steps -= reverse_steps;
             else
                 speed_up = false;
-            if (speed_down && STEPS >= reverse_steps)
-                STEPS -= reverse_steps;
+            if (speed_down && key_steps >= reverse_steps)
+                key_steps -= reverse_steps;
             else
                 speed_down = false;
-#undef STEPS
             turning = 3;
         }
         if (turning == 3)
@@ -287,19 +368,24 @@ public:
             {
                 steps = cmd.steps();
                 follow_goal = -1;
+                ramped = false;
                 // should be adapted for the cases
                 stepper.set_current_speed_in_revs_per_minute(8);
                 stepper.set_speed_in_revs_per_minute(8);
             }
             else
             {
-                steps = cmd.steps() * STEP_MULTIPLIER;
+                steps = key_steps * STEP_MULTIPLIER;
                 if (ghosting)
                 {
                     // we are standing 'still' so presume more speed
                     stepper.set_current_speed_in_revs_per_minute(clockwise ? speed : -speed);
                 }
                 stepper.set_speed_in_revs_per_minute(clockwise ? speed : -speed);
+                const bool chained = ramped;
+                ramped = acceleration > 0 && !ghosting;
+                if (ramped)
+                    stepper.start_ramp(steps, speed, acceleration, now, chained);
             }
             return;
         }
@@ -316,6 +402,7 @@ public:
             {
                 steps = 0;
             }
+            last = idx;
             idx++;
         }
     }
@@ -337,6 +424,11 @@ public:
         this->t0 = ::millis();
         this->millisLeft = millisLeft;
         this->idx = 0;
+        this->last = NO_KEY;
+        this->repeats = 0;
+        this->bank = 0;
+        this->acceleration = 0;
+        this->ramped = false;
         this->special = false;
         this->steps = 0;
         this->turning = 0;
@@ -397,6 +489,11 @@ void StepExecutors::process_end_keys(int slave_id, const UartEndKeysMessage *msg
     animator1.start(&animationKeysArray[1], msg->number_of_millis_left, speed_detection1);
 }
 
+void StepExecutors::process_speed_bank(const UartSpeedBankMessage *msg)
+{
+    cmdSpeedUtil.set_speeds(msg->speed_map, msg->bank);
+}
+
 void StepExecutors::process_add_keys(const UartKeysMessage *msg)
 {
     animationKeysArray[msg->getDstId() & 1].addAll(*msg);
@@ -26,6 +26,7 @@ public:
     static void process_begin_keys(const UartMessage *msg);
     static void process_add_keys(const UartKeysMessage *msg);
     static void process_end_keys(int slave_id, const UartEndKeysMessage *msg);
+    static void process_speed_bank(const UartSpeedBankMessage *msg);
 
     // will execute the steps
     static void loop(Micros now);
@@ -0,0 +1,120 @@
+#include "stats.h"
+
+TransportStats transportStats;
+
+uint32_t Histogram::count() const
+{
+    uint32_t total = 0;
+    for (uint8_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+        total += counts_[bucket];
+    return total;
+}
+
+Micros Histogram::percentile(uint8_t percent) const
+{
+    const uint32_t total = count();
+    if (total == 0)
+        return 0;
+
+    const uint32_t wanted = (total * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t bucket = 0; bucket + 1 < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        seen += counts_[bucket];
+        if (seen >= wanted)
+            return Micros(2) << bucket;
+    }
+    return max_;
+}
+
+void Histogram::reset()
+{
+    for (uint8_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+        counts_[bucket] = 0;
+    max_ = 0;
+}
+
+void Histogram::dump_config(const char *tag, const char *name) const
+{
+    ESP_LOGI(tag, "  %s: n=%ld p50<%ld p95<%ld max=%ld micros", name, long(count()), long(percentile(50)), long(percentile(95)), long(max_));
+    // only the buckets in use
+    for (uint8_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+        if (counts_[bucket] > 0)
+            ESP_LOGI(tag, "    <%ld: %ld", bucket + 1 < HISTOGRAM_BUCKETS ? long(2) << bucket : long(max_) + 1, long(counts_[bucket]));
+}
+
+uint32_t TransportStats::rx_frames() const
+{
+    uint32_t total = 0;
+    for (uint8_t type = 0; type < STATS_MSG_TYPES; ++type)
+        total += rx[type].frames;
+    return total;
+}
+
+uint32_t TransportStats::tx_frames() const
+{
+    uint32_t total = 0;
+#ifdef MASTER_MODE
+    for (uint8_t type = 0; type < STATS_MSG_TYPES; ++type)
+        total += tx[type].frames;
+#endif
+    return total;
+}
+
+uint32_t TransportStats::rx_errors() const
+{
+    uint32_t total = 0;
+    for (uint8_t error = 0; error < STATS_RX_ERRORS; ++error)
+        total += errors[error];
+    return total;
+}
+
+void TransportStats::reset()
+{
+    for (uint8_t type = 0; type < STATS_MSG_TYPES; ++type)
+    {
+        rx[type] = {};
+#ifdef MASTER_MODE
+        tx[type] = {};
+#endif
+    }
+    for (uint8_t error = 0; error < STATS_RX_ERRORS; ++error)
+        errors[error] = 0;
+    resyncs = recovered = 0;
+    decode.reset();
+    turnaround.reset();
+#ifdef MASTER_MODE
+    broadcast.reset();
+    control.reset();
+    resync.reset();
+#endif
+}
+
+void TransportStats::dump_config(const char *tag) const
+{
+    ESP_LOGI(tag, " transport:");
+    for (uint8_t type = 0; type < STATS_MSG_TYPES; ++type)
+    {
+#ifdef MASTER_MODE
+        if (rx[type].frames == 0 && tx[type].frames == 0)
+            continue;
+        ESP_LOGI(tag, "  type %d: rx %ld frames/%ld bytes, tx %ld frames/%ld bytes", type,
+                 long(rx[type].frames), long(rx[type].bytes), long(tx[type].frames), long(tx[type].bytes));
+#else
+        if (rx[type].frames == 0)
+            continue;
+        ESP_LOGI(tag, "  type %d: rx %ld frames/%ld bytes", type, long(rx[type].frames), long(rx[type].bytes));
+#endif
+    }
+    // in the order of Protocol::RxError
+    ESP_LOGI(tag, "  errors: nibble=%ld crc=%ld overflow=%ld truncated=%ld dropped=%ld uart=%ld timeout=%ld",
+             long(errors[1]), long(errors[2]), long(errors[3]), long(errors[4]), long(errors[5]), long(errors[6]), long(errors[7]));
+    ESP_LOGI(tag, "  resyncs: %ld (recovered: %ld)", long(resyncs), long(recovered));
+    decode.dump_config(tag, "decode");
+    turnaround.dump_config(tag, "turnaround");
+#ifdef MASTER_MODE
+    broadcast.dump_config(tag, "broadcast");
+    control.dump_config(tag, "control");
+    resync.dump_config(tag, "resync");
+#endif
+}
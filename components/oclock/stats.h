@@ -0,0 +1,137 @@
+#pragma once
+#include "oclock.h"
+
+/**
+ * Transport instrumentation: where does the time (and the bytes) of a minute update go?
+ *
+ * Everything is kept in fixed size arrays, so it can run on the slaves as well (where the counters are smaller).
+ */
+
+#ifdef __AVR__
+// RAM, note: will wrap around
+typedef uint16_t StatCounter;
+#define HISTOGRAM_BUCKETS 12
+#else
+typedef uint32_t StatCounter;
+#define HISTOGRAM_BUCKETS 16
+#endif
+
+// message types are counted per type (MSG_TYPE_COUNT, see the static_assert in interop.h), higher types end up in the last one
+#define STATS_MSG_TYPES 35
+// the type of a frame is its second byte (see UartMessage: source, type, destination)
+#define FRAME_TYPE_OFFSET 1
+// see Protocol::RxError
+#define STATS_RX_ERRORS 8
+
+/**
+ * Histogram of micros with power of 2 buckets: bucket 0 counts [0, 2), bucket i counts [2^i, 2^(i+1)),
+ * the last bucket counts everything above.
+ */
+class Histogram
+{
+  StatCounter counts_[HISTOGRAM_BUCKETS] = {};
+  Micros max_{0};
+
+public:
+  void add(Micros value)
+  {
+    uint8_t bucket = 0;
+    while (bucket + 1 < HISTOGRAM_BUCKETS && (value >> (bucket + 1)) != 0)
+      bucket++;
+    counts_[bucket]++;
+    if (value > max_)
+      max_ = value;
+  }
+
+  uint32_t count() const;
+  Micros max() const { return max_; }
+  // upper bound of the bucket with the given percentile (0..100)
+  Micros percentile(uint8_t percent) const;
+
+  void reset();
+  void dump_config(const char *tag, const char *name) const;
+};
+
+struct FrameCounters
+{
+  StatCounter frames;
+  StatCounter bytes;
+};
+
+class TransportStats
+{
+public:
+  FrameCounters rx[STATS_MSG_TYPES] = {};
+#ifdef MASTER_MODE
+  FrameCounters tx[STATS_MSG_TYPES] = {};
+#endif
+  StatCounter errors[STATS_RX_ERRORS] = {};
+  // back in sync after error(s): the first good frame, of which recovered without waiting for the next frame start
+  StatCounter resyncs{0};
+  StatCounter recovered{0};
+
+  // decoding and processing a received frame (see Channel::loop)
+  Histogram decode;
+  // from start_receiving() until the gate is turned around
+  Histogram turnaround;
+#ifdef MASTER_MODE
+  // from sending a broadcast request until the terminal 0xFF reply
+  Histogram broadcast;
+  // from queueing a control frame until its last byte was handed to the UART (see TxPriority)
+  Histogram control;
+  // from the first receive error until the next good frame
+  Histogram resync;
+#endif
+
+  static uint8_t type_of(const byte *bytes, byte length)
+  {
+    if (length <= FRAME_TYPE_OFFSET)
+      return STATS_MSG_TYPES - 1;
+    const uint8_t type = bytes[FRAME_TYPE_OFFSET];
+    return type < STATS_MSG_TYPES ? type : STATS_MSG_TYPES - 1;
+  }
+
+  void count_rx(const byte *bytes, byte length)
+  {
+    auto &counters = rx[type_of(bytes, length)];
+    counters.frames++;
+    counters.bytes += length;
+  }
+
+  void count_tx(const byte *bytes, byte length)
+  {
+#ifdef MASTER_MODE
+    auto &counters = tx[type_of(bytes, length)];
+    counters.frames++;
+    counters.bytes += length;
+#endif
+  }
+
+  void count_error(uint8_t error)
+  {
+    if (error < STATS_RX_ERRORS)
+      errors[error]++;
+  }
+
+#ifdef MASTER_MODE
+  void count_resync(bool speculative, Micros duration)
+  {
+    resync.add(duration);
+#else
+  void count_resync(bool speculative)
+  {
+#endif
+    resyncs++;
+    if (speculative)
+      recovered++;
+  }
+
+  uint32_t rx_frames() const;
+  uint32_t tx_frames() const;
+  uint32_t rx_errors() const;
+
+  void reset();
+  void dump_config(const char *tag) const;
+};
+
+extern TransportStats transportStats;
@@ -0,0 +1,78 @@
+#pragma once
+#include "oclock.h"
+
+/**
+ * Wire schema of the messages (see interop.h): a message struct is its own wire image.
+ *
+ * Every field is byte sized, multi-byte integers are LittleEndian<T>, so the layout has no padding and does not
+ * depend on the compiler (avr-gcc, xtensa-gcc or a host gcc): setting a field serializes it, reading a field decodes
+ * it in place from the received frame. WIRE_MESSAGE checks the size of every message at compile time.
+ */
+
+template <uint8_t N>
+struct WireUnsigned;
+template <>
+struct WireUnsigned<1>
+{
+  typedef uint8_t type;
+};
+template <>
+struct WireUnsigned<2>
+{
+  typedef uint16_t type;
+};
+template <>
+struct WireUnsigned<4>
+{
+  typedef uint32_t type;
+};
+template <>
+struct WireUnsigned<8>
+{
+  typedef uint64_t type;
+};
+
+/**
+ * An integer of sizeof(T) bytes, least significant byte first.
+ */
+template <class T>
+class LittleEndian
+{
+  typedef typename WireUnsigned<sizeof(T)>::type Unsigned;
+  uint8_t bytes_[sizeof(T)];
+
+public:
+  LittleEndian() { *this = T(0); }
+  explicit LittleEndian(T value) { *this = value; }
+
+  LittleEndian &operator=(T value)
+  {
+    Unsigned bits = Unsigned(value);
+    for (uint8_t idx = 0; idx < sizeof(T); ++idx, bits >>= 8)
+      bytes_[idx] = uint8_t(bits);
+    return *this;
+  }
+
+  operator T() const
+  {
+    Unsigned bits = 0;
+    for (uint8_t idx = sizeof(T); idx > 0; --idx)
+      bits = Unsigned(bits << 8) | bytes_[idx - 1];
+    return T(bits);
+  }
+  // e.g. for printf
+  T get() const { return *this; }
+};
+
+static_assert(sizeof(LittleEndian<uint32_t>) == 4 && alignof(LittleEndian<uint32_t>) == 1, "LittleEndian is not a byte array");
+
+// a message that fits in a Channel frame, with its size on the wire
+#define WIRE_FRAME(M, size)                                                   \
+  static_assert(sizeof(M) == (size), #M ": unexpected size on the wire");    \
+  static_assert(alignof(M) == 1, #M ": has fields that are not byte sized"); \
+  static_assert((size) <= RECEIVER_BUFFER_SIZE, #M ": does not fit in a frame")
+
+// a message that fits in MAX_UART_MESSAGE_SIZE (e.g. to be coalesced in an envelope)
+#define WIRE_MESSAGE(M, size) \
+  WIRE_FRAME(M, size);        \
+  static_assert((size) <= MAX_UART_MESSAGE_SIZE, #M ": is larger than MAX_UART_MESSAGE_SIZE")
@@ -0,0 +1,97 @@
+/**
+ * Host benchmark of the checksum variants (see crc.h): host cycles per byte and an AVR estimate.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/bench_checksum.cpp components/oclock/crc.cpp -o /tmp/bench_checksum && /tmp/bench_checksum
+ *
+ * The AVR numbers are not measured: they are counted from the inner loop avr-gcc -Os generates for each variant
+ * (ld 2, lpm 3, taken branch 2, most others 1 cycle), use them to compare the variants on the 16 MHz Uno.
+ */
+#include "crc.h"
+
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+#define READ_CYCLES() 0ULL
+#endif
+
+#define AVR_MHZ 16
+
+struct Variant
+{
+    const char *name;
+    uint32_t (*calc)(const byte *addr, byte len);
+    // flash used by the tables
+    int table_bytes;
+    // see the note above
+    int avr_cycles_per_byte;
+};
+
+template <class C>
+uint32_t calc(const byte *addr, byte len) { return C::calc(addr, len); }
+
+const Variant variants[] = {
+    // 8x: mov, eor, andi, lsr, sbrc/eor, lsr, dec, brne
+    {"crc8 bitwise", calc<Crc8Bitwise>, 0, 8 * 10 + 5},
+    // ld, eor, movw, add, adc, lpm, dec, brne
+    {"crc8 table", calc<Crc8Table>, 256, 13},
+    // as the table, but twice (lpm on both nibbles) plus swap/andi
+    {"crc8 nibble", calc<Crc8Nibble>, 32, 24},
+    // 2x: 16 bit shift by 4 and index (swap/andi), lpm word, eor
+    {"crc16", calc<Crc16>, 32, 2 * 26 + 5},
+};
+
+// the known answers of "123456789"
+void check()
+{
+    const byte check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    for (const auto &variant : variants)
+    {
+        const uint32_t expected = variant.calc == calc<Crc16> ? 0x29B1 : 0xA1;
+        const uint32_t value = variant.calc(check, sizeof(check));
+        if (value != expected)
+            printf("%-13s check=0x%04X, expected 0x%04X (WRONG!)\n", variant.name, value, expected);
+    }
+}
+
+void bench(const Variant &variant, byte length)
+{
+    const int ROUNDS = 20000;
+
+    srand(42);
+    std::vector<byte> frame(length);
+    for (auto &value : frame)
+        value = rand();
+
+    volatile uint32_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_cycles = READ_CYCLES();
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        // note: depends on the previous round, so it can not be hoisted
+        frame[0] = sink;
+        sink = variant.calc(frame.data(), length);
+    }
+    const uint64_t cycles = READ_CYCLES() - start_cycles;
+    const uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    const double bytes = double(length) * ROUNDS;
+    printf("%-13s %3d bytes: host %.2f ns/byte %.2f cycles/byte, avr ~%d cycles/byte (%.1f us/frame), table %d bytes\n",
+           variant.name, length, nanos / bytes, cycles / bytes,
+           variant.avr_cycles_per_byte, double(variant.avr_cycles_per_byte) * length / AVR_MHZ, variant.table_bytes);
+}
+
+int main()
+{
+    check();
+    // a small message, a keys message and a full frame
+    for (byte length : {8, 32, RECEIVER_BUFFER_SIZE})
+        for (const auto &variant : variants)
+            bench(variant, length);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * Host benchmark of the control frame latency (see TxPriority in channel.h): a stop is sent somewhere during
+ * a minute update (MSG_BEGIN_KEYS, one UartKeysMessage per handle (MAX_HANDLES) and MSG_END_KEYS), how long
+ * until its last byte is on the wire?
+ *
+ * The master side (TxQueue, credits) is compiled natively, the UART is paced at the baud rate in real time
+ * (see HardwareSerial::paced in tools/host/Arduino.h). 'bulk' is the same stop queued behind the update (as before).
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -DMASTER_MODE -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/bench_control.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/capture.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/bench_control && /tmp/bench_control
+ *
+ * Note: it runs in real time, so it takes a few minutes.
+ */
+// note: interop.h expects the master to have included it already
+#include <vector>
+#include "interop.h"
+#include "interop.keys.h"
+#include "stats.h"
+
+#include <algorithm>
+
+// see Master::tx_budget
+#define TX_BUDGET_MICROS 2000
+#define TRIALS 40
+
+class NullGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override {}
+    void start_receiving() override {}
+    void start_transmitting() override {}
+};
+
+byte buffer_bytes[RX_QUEUE_SIZE];
+Buffer buffer(buffer_bytes, RX_QUEUE_SIZE);
+NullGate gate;
+InteropRS485 uart(0xFF, gate, buffer);
+
+const uint8_t speed_map[8] = {1, 2, 4, 8, 16, 32, 48, 64};
+const UartInformToStopAnimationRequest stop;
+
+uint16_t random_key()
+{
+    InflatedCmdKey key;
+    key.value.ghost = random(2);
+    key.value.clockwise = random(2);
+    key.value.steps = random(NUMBER_OF_STEPS / 4);
+    key.value.speed = random(8);
+    return key.raw;
+}
+
+void send_minute_update()
+{
+    uart.send(UartMessage(-1, MsgType::MSG_BEGIN_KEYS));
+    for (int handleId = 0; handleId < MAX_HANDLES; ++handleId)
+    {
+        UartKeysMessage msg(handleId, MAX_ANIMATION_KEYS_PER_MESSAGE);
+        for (int idx = 0; idx < MAX_ANIMATION_KEYS_PER_MESSAGE; ++idx)
+            msg.set_key(idx, random_key());
+        uart.send(msg);
+    }
+    uart.send(UartEndKeysMessage(4, 90, speed_map, 0, 58000));
+}
+
+// like Master::loop, returns when everything is on the wire
+void serve(Micros gap, Micros inject_at, TxPriority priority, Micros &queued)
+{
+    while (uart.tx_pending() || queued == 0 || micros() < Serial.fifo_empty_at)
+    {
+        if (queued == 0 && micros() >= inject_at)
+        {
+            queued = micros();
+            if (priority == TxPriority::Control)
+                uart.send_control(&stop, sizeof(stop));
+            else
+                uart.send_direct(stop);
+        }
+        uart.loop_coalescer(millis());
+        if (uart.tx_pending())
+            uart.drain(TX_BUDGET_MICROS);
+        // the other components
+        if (gap > 0)
+            delayMicroseconds(gap);
+    }
+}
+
+struct Result
+{
+    Micros upload{0};
+    Micros max{0};
+    uint64_t sum{0};
+};
+
+Result bench(uint32_t baud_rate, Micros gap, TxPriority priority, const std::vector<uint8_t> &pattern)
+{
+    Result result;
+    srandom(42);
+    for (int trial = 0; trial < TRIALS; ++trial)
+    {
+        Serial.tx.clear();
+        Serial.tx_at.clear();
+        const Micros start = micros();
+        send_minute_update();
+        const Micros upload = uart.tx_queue().size() * 10 * 1000000ULL / baud_rate;
+        if (upload > result.upload)
+            result.upload = upload;
+
+        // spread over the upload
+        Micros queued = 0;
+        serve(gap, start + upload * trial / TRIALS, priority, queued);
+
+        // the last byte of the stop
+        auto it = std::search(Serial.tx.begin(), Serial.tx.end(), pattern.begin(), pattern.end());
+        if (it == Serial.tx.end())
+        {
+            printf("stop not found!\n");
+            continue;
+        }
+        const Micros latency = Serial.tx_at[it - Serial.tx.begin() + pattern.size() - 1] - queued;
+        result.sum += latency;
+        if (latency > result.max)
+            result.max = latency;
+    }
+    return result;
+}
+
+int main()
+{
+    Serial.paced = true;
+    uart.setup();
+    for (uint32_t baud_rate : {57600, 115200, 250000})
+    {
+        uart.upgrade_baud_rate(baud_rate);
+        uart.set_credits(RX_QUEUE_FRAMES - 1, RX_FRAME_MICROS);
+
+        // the stop as it goes on the wire
+        Serial.tx.clear();
+        uart.send_control(&stop, sizeof(stop));
+        uart.flush();
+        const std::vector<uint8_t> pattern(Serial.tx.begin(), Serial.tx.end());
+        while (micros() < Serial.fifo_empty_at)
+            ;
+
+        for (Micros gap : {0, 5000})
+        {
+            const Result bulk = bench(baud_rate, gap, TxPriority::Bulk, pattern);
+            transportStats.control.reset();
+            const Result control = bench(baud_rate, gap, TxPriority::Control, pattern);
+            printf("%6ld baud, loop gap %4ld us: upload %6.1f ms, stop latency: bulk avg %6.1f max %6.1f ms, "
+                   "control avg %5.1f max %5.1f ms (queued p95 %ld us)\n",
+                   long(baud_rate), long(gap), control.upload / 1000.0,
+                   bulk.sum / 1000.0 / TRIALS, bulk.max / 1000.0,
+                   control.sum / 1000.0 / TRIALS, control.max / 1000.0, long(transportStats.control.percentile(95)));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * Host benchmark of the message dispatching (see DispatchTable in interop.h): the cost of getting a received message
+ * to its handler, the way the slave and the master used to do it and with a dispatch table.
+ *
+ *  - switch:        a function pointer to a switch over the type (the old uartMainListener of the slave)
+ *  - std::function: the same switch in a capturing lambda (the old listeners of MasterLifecycle)
+ *  - table:         DispatchTable::make of the same handlers
+ *
+ * Every variant also pays for a phase change (a new listener or table) every PHASE_MESSAGES messages.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/bench_dispatch.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/bench_dispatch && /tmp/bench_dispatch
+ */
+#include <vector>
+#include "interop.h"
+#include "interop.keys.h"
+
+#include <chrono>
+#include <functional>
+
+#define MESSAGES 1000000
+#define ROUNDS 20
+#define PHASE_MESSAGES 64
+
+volatile uint32_t handled[MSG_TYPE_COUNT];
+
+template <MsgType T>
+__attribute__((noinline)) bool on(const UartMessage *msg)
+{
+    handled[T]++;
+    return true;
+}
+
+// the message types of the main phase of the slave (see changeToMainTask)
+#define MAIN_TYPES(X)                  \
+    X(MSG_BRIGHTNESS)                  \
+    X(MSG_BOOL_DEBUG_LED_LAYER)        \
+    X(MSG_COLOR)                       \
+    X(MSG_CALIBRATE_START)             \
+    X(MSG_CALIBRATE_END)               \
+    X(MSG_BEGIN_KEYS)                  \
+    X(MSG_SEND_KEYS)                   \
+    X(MSG_END_KEYS)                    \
+    X(MSG_POS_REQUEST)                 \
+    X(MSG_STATUS)                      \
+    X(MSG_DUMP_LOG_REQUEST)            \
+    X(MSG_WAIT_FOR_ANIMATION)          \
+    X(MSG_SEQ_CHECK)                   \
+    X(MSG_BAUD_PROBE)                  \
+    X(MSG_BAUD_PATTERN)                \
+    X(MSG_BAUD_REPORT)                 \
+    X(MSG_BAUD_COMMIT)                 \
+    X(MSG_INFORM_STOP_ANIMATION)       \
+    X(MSG_LED_MODE)                    \
+    X(MSG_BACKGROUND_RGB_LEDS)         \
+    X(MSG_FOREGROUND_RGB_LEDS)
+
+bool switch_listener(const UartMessage *msg)
+{
+    switch (msg->getMessageType())
+    {
+#define CASE(T) \
+    case T:     \
+        return on<T>(msg);
+        MAIN_TYPES(CASE)
+#undef CASE
+    default:
+        return false;
+    }
+}
+
+#define ROUTE(T) {T, on<T>},
+constexpr MessageRoute mainRoutes[] = {MAIN_TYPES(ROUTE)};
+#undef ROUTE
+constexpr DispatchTable mainTable PROGMEM = DispatchTable::make(mainRoutes);
+
+// mostly keys (a minute update), some of the others
+std::vector<UartMessage> make_messages()
+{
+    const MsgType others[] = {
+#define TYPE(T) T,
+        MAIN_TYPES(TYPE)
+#undef TYPE
+        // not for this phase
+        MSG_ID_ACCEPT, MSG_LOG};
+    srandom(42);
+    std::vector<UartMessage> messages;
+    for (int idx = 0; idx < MESSAGES; ++idx)
+    {
+        const long dice = random() % 4;
+        const MsgType type = dice < 2 ? MSG_SEND_KEYS : others[random() % (sizeof(others) / sizeof(others[0]))];
+        messages.push_back(UartMessage(0, type));
+    }
+    return messages;
+}
+
+template <class Dispatch>
+double bench(const std::vector<UartMessage> &messages, Dispatch dispatch)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        uint32_t accepted = 0;
+        for (size_t idx = 0; idx < messages.size(); ++idx)
+            accepted += dispatch(idx, &messages[idx]);
+        const double nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (accepted == 0)
+            printf("nothing accepted!?\n");
+        const double per_message = nanos / messages.size();
+        if (round == 0 || per_message < best)
+            best = per_message;
+    }
+    return best;
+}
+
+int main()
+{
+    const auto messages = make_messages();
+
+    bool (*pointer)(const UartMessage *) = nullptr;
+    const double switched = bench(messages, [&](size_t idx, const UartMessage *msg)
+                                  {
+                                      if (idx % PHASE_MESSAGES == 0)
+                                          pointer = switch_listener;
+                                      return pointer(msg); });
+
+    std::function<bool(const UartMessage *)> function;
+    uint32_t phase = 0;
+    const double functioned = bench(messages, [&](size_t idx, const UartMessage *msg)
+                                    {
+                                        if (idx % PHASE_MESSAGES == 0)
+                                        {
+                                            // e.g. the broadcast request of change_to_broadcasting
+                                            const uint32_t captured = ++phase;
+                                            function = [captured](const UartMessage *msg)
+                                            { return captured != 0 && switch_listener(msg); };
+                                        }
+                                        return function(msg); });
+
+    const DispatchTable *table = nullptr;
+    const double tabled = bench(messages, [&](size_t idx, const UartMessage *msg)
+                                {
+                                    if (idx % PHASE_MESSAGES == 0)
+                                        table = &mainTable;
+                                    const MessageHandler handler = table->handler(msg->getMsgType());
+                                    return handler ? handler(msg) : false; });
+
+    printf("%d messages, %zu handlers, phase change every %d messages (best of %d):\n",
+           MESSAGES, sizeof(mainRoutes) / sizeof(mainRoutes[0]), PHASE_MESSAGES, ROUNDS);
+    printf("  switch         %6.2f ns/message\n", switched);
+    printf("  std::function  %6.2f ns/message\n", functioned);
+    printf("  table          %6.2f ns/message (%d pointers in flash)\n", tabled, DISPATCH_TYPES + 1);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Host benchmark: compares the wire size and the decode cost of the framings (see Framing in channel.h).
+ *
+ * A 'minute update' is what the master sends every minute:
+ *   MSG_BEGIN_KEYS, one UartKeysMessage per handle (MAX_HANDLES) and MSG_END_KEYS.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/bench_framing.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/crc.cpp components/oclock/slave/log.cpp -o /tmp/bench_framing && /tmp/bench_framing
+ *
+ * Note that the cycles are host cycles (rdtsc), so use them to compare the framings, not as AVR numbers.
+ * The decode cost is the fastest of the rounds (the others only add noise), per byte of payload: nibble framing
+ * handles twice the bytes of COBS for the same message, so its cost per wire byte looks cheaper than it is.
+ */
+#include "channel.h"
+#include "interop.keys.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+#define READ_CYCLES() 0ULL
+#endif
+
+class NullGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override {}
+    void start_receiving() override {}
+    void start_transmitting() override {}
+};
+
+class CountingChannel : public Channel
+{
+public:
+    uint32_t messages{0};
+    uint32_t payload{0};
+
+    CountingChannel(Gate &gate, Buffer &buffer) : Channel(gate, buffer) {}
+
+protected:
+    void process(const byte *bytes, const byte length) override
+    {
+        messages++;
+        payload += length;
+    }
+};
+
+byte buffer_bytes[RX_QUEUE_SIZE];
+Buffer buffer(buffer_bytes, RX_QUEUE_SIZE);
+NullGate gate;
+CountingChannel channel(gate, buffer);
+
+const uint8_t speed_map[8] = {1, 2, 4, 8, 16, 32, 48, 64};
+const uint32_t EXPECTED_MESSAGES = 1 + MAX_HANDLES + 1;
+
+uint16_t random_key()
+{
+    InflatedCmdKey key;
+    key.value.ghost = random(2);
+    key.value.clockwise = random(2);
+    key.value.steps = random(NUMBER_OF_STEPS / 4);
+    key.value.speed = random(8);
+    return key.raw;
+}
+
+void send_minute_update()
+{
+    channel.send(UartMessage(-1, MsgType::MSG_BEGIN_KEYS));
+    for (int handleId = 0; handleId < MAX_HANDLES; ++handleId)
+    {
+        const int size = 6 + random(MAX_ANIMATION_KEYS_PER_MESSAGE - 6);
+        UartKeysMessage msg(handleId, size);
+        for (int idx = 0; idx < size; ++idx)
+            msg.set_key(idx, random_key());
+        channel.send(msg);
+    }
+    channel.send(UartEndKeysMessage(4, 90, speed_map, 0, 58000));
+}
+
+void bench(Framing framing, const char *name)
+{
+    const int ROUNDS = 2000;
+
+    srandom(42);
+    channel.set_framing(framing);
+    Serial.tx.clear();
+    send_minute_update();
+    const std::vector<uint8_t> wire(Serial.tx.begin(), Serial.tx.end());
+    Serial.tx.clear();
+
+    channel.start_receiving();
+    channel.messages = channel.payload = 0;
+
+    uint64_t cycles = ~0ULL, nanos = ~0ULL;
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        Serial.rx.assign(wire.begin(), wire.end());
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t start_cycles = READ_CYCLES();
+        while (Serial.available() > 0)
+            channel.loop();
+        // process the frames left in the receive queue
+        for (int idx = 0; idx < RX_QUEUE_FRAMES; ++idx)
+            channel.loop();
+        cycles = std::min<uint64_t>(cycles, READ_CYCLES() - start_cycles);
+        nanos = std::min<uint64_t>(nanos, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    const uint32_t payload = channel.payload / ROUNDS;
+    printf("%-7s payload=%5u bytes, wire=%5zu bytes (x%.2f), %.1f ms @ 57600 baud, decode=%.2f ns %.2f cycles per payload byte (%.2f per wire byte)%s\n",
+           name, payload, wire.size(), double(wire.size()) / payload,
+           wire.size() * 10 * 1000.0 / 57600,
+           double(nanos) / payload, double(cycles) / payload, double(cycles) / wire.size(),
+           channel.messages == EXPECTED_MESSAGES * ROUNDS ? "" : " (MESSAGES LOST!)");
+}
+
+int main()
+{
+    channel.setup();
+    bench(Framing::Nibble, "nibble");
+    bench(Framing::Cobs, "cobs");
+    return 0;
+}
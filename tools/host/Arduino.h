@@ -0,0 +1,116 @@
+#pragma once
+
+/**
+ * Minimal Arduino API to be able to compile (parts of) the oclock code on a Linux host.
+ *
+ * Only what is actually used by the shared code is provided. Note that the code will
+ * compile in 'slave' mode since neither ESP8266 nor AVR is defined.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <type_traits>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <deque>
+
+typedef uint8_t byte;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void *const *>(addr))
+#define vsnprintf_P vsnprintf
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+template <class A, class B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+template <class A, class B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+
+/**
+ * Loopback serial: everything written ends up in 'tx', everything in 'rx' can be read.
+ *
+ * When 'paced', the written bytes leave a FIFO of FIFO_SIZE bytes at the baud rate (in real time),
+ * like the UART of the ESP8266.
+ */
+class HardwareSerial
+{
+    unsigned long byte_micros() const { return 10 * 1000000UL / baud_rate; }
+
+public:
+    static const int FIFO_SIZE = 128;
+    std::deque<uint8_t> rx, tx;
+
+    void begin(unsigned long baud) { baud_rate = baud; }
+    void end() {}
+    size_t write(uint8_t value)
+    {
+        tx.push_back(value);
+        if (paced)
+        {
+            const unsigned long now = micros();
+            fifo_empty_at = (fifo_empty_at > now ? fifo_empty_at : now) + byte_micros();
+            tx_at.push_back(fifo_empty_at);
+        }
+        return 1;
+    }
+    int available() { return rx.size(); }
+    int availableForWrite()
+    {
+        const unsigned long now = micros();
+        if (!paced || fifo_empty_at <= now)
+            return FIFO_SIZE;
+        const unsigned long queued = (fifo_empty_at - now + byte_micros() - 1) / byte_micros();
+        return queued >= FIFO_SIZE ? 0 : FIFO_SIZE - queued;
+    }
+    int read()
+    {
+        if (rx.empty())
+            return -1;
+        int ret = rx.front();
+        rx.pop_front();
+        return ret;
+    }
+    void flush() {}
+
+    // host only: feed everything that is written back to our input
+    void loopback()
+    {
+        rx.insert(rx.end(), tx.begin(), tx.end());
+        tx.clear();
+    }
+
+    unsigned long baud_rate{0};
+    bool paced{false};
+    // micros at which the last written byte left (when paced) and the same for every byte in 'tx'
+    unsigned long fifo_empty_at{0};
+    std::deque<unsigned long> tx_at;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,35 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+static const auto host_start = std::chrono::steady_clock::now();
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - host_start).count();
+}
+
+unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+int digitalRead(uint8_t pin) { return LOW; }
+
+long random(long max) { return max <= 0 ? 0 : ::random() % max; }
+long random(long min, long max) { return min + random(max - min); }
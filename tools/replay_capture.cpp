@@ -0,0 +1,265 @@
+/**
+ * Host replay of a frame capture of the master (see capture.h): every captured frame is encoded again
+ * and fed byte by byte into the protocol decoder and the dispatching of a slave (InteropRS485), compiled natively.
+ *
+ * Use it to profile real traffic offline (e.g. a bad minute with CRC storms) and to compare framing or encoder
+ * changes against it. Captured receive errors are replayed as corrupted frames.
+ *
+ * Capture: turn on the 'oclock_capture' switch, wait, press 'oclock_dump_capture' and save the log.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/replay_capture.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/capture.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/replay_capture && /tmp/replay_capture [options] capture.log
+ *
+ * Options:
+ *   --framing nibble|cobs|both   framing to replay with (default: the one of the capture)
+ *   --slave <id>                 the slave doing the dispatching (default: 0)
+ */
+#include "interop.h"
+#include "capture.h"
+#include "stats.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct Record
+{
+    uint32_t stamp;
+    char kind;
+    std::vector<uint8_t> bytes;
+};
+
+struct Capture
+{
+    uint32_t baud_rate{57600};
+    Framing framing{Framing::Nibble};
+    std::vector<Record> records;
+};
+
+static void append_hex(const char *hex, std::vector<uint8_t> &bytes)
+{
+    // stops at the first non hex character (e.g. the color codes of the logger)
+    unsigned value;
+    while (sscanf(hex, "%2x", &value) == 1 && isxdigit(hex[0]) && isxdigit(hex[1]))
+    {
+        bytes.push_back(value);
+        hex += 2;
+    }
+}
+
+static bool read_capture(const char *path, Capture &capture)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        perror(path);
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        const char *at;
+        if ((at = strstr(line, "cap: begin")) != nullptr)
+        {
+            long baud = 0;
+            int framing = 0;
+            if (sscanf(at, "cap: begin baud=%ld framing=%d", &baud, &framing) == 2)
+            {
+                capture.baud_rate = baud;
+                capture.framing = Framing(framing);
+            }
+            capture.records.clear();
+        }
+        else if ((at = strstr(line, "cap+ ")) != nullptr)
+        {
+            if (!capture.records.empty())
+                append_hex(at + 5, capture.records.back().bytes);
+        }
+        else if ((at = strstr(line, "cap ")) != nullptr)
+        {
+            Record record;
+            unsigned long stamp;
+            char hex[2 * CAPTURE_LINE_BYTES + 1] = "";
+            if (sscanf(at, "cap %lx %c %96s", &stamp, &record.kind, hex) < 2)
+                continue;
+            record.stamp = stamp;
+            append_hex(hex, record.bytes);
+            capture.records.push_back(record);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+class NullGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override {}
+    void start_receiving() override {}
+    void start_transmitting() override {}
+};
+
+class ReplayChannel : public InteropRS485
+{
+public:
+    ReplayChannel(uint8_t owner_id, Gate &gate, Buffer &buffer) : InteropRS485(owner_id, gate, buffer) {}
+
+    // the frame as it goes on the wire
+    std::vector<uint8_t> encode(const uint8_t *bytes, uint8_t length)
+    {
+        Serial.tx.clear();
+        _send(bytes, length);
+        std::vector<uint8_t> wire(Serial.tx.begin(), Serial.tx.end());
+        Serial.tx.clear();
+        return wire;
+    }
+};
+
+// see Protocol::RxError
+#define RX_ERROR_DROPPED 5
+
+// dispatched messages per type
+static uint32_t dispatched[STATS_MSG_TYPES];
+
+static bool count_dispatched(const UartMessage *msg)
+{
+    const uint8_t type = msg->getMsgType();
+    dispatched[type < STATS_MSG_TYPES ? type : STATS_MSG_TYPES - 1]++;
+    return true;
+}
+
+// every type, accepted or not by a real slave
+const MessageRoute countRoutes[] = {{MSG_LOG, count_dispatched}};
+const DispatchTable countTable = DispatchTable::make(countRoutes, count_dispatched);
+
+byte buffer_bytes[RX_QUEUE_SIZE];
+Buffer buffer(buffer_bytes, RX_QUEUE_SIZE);
+NullGate gate;
+
+struct TypeStats
+{
+    uint32_t frames, bytes, wire;
+    uint64_t nanos;
+};
+
+static const char *type_name(uint8_t type)
+{
+    return reinterpret_cast<const char *>(InteropStringifier::asF(MsgType(type)));
+}
+
+static void replay(const Capture &capture, ReplayChannel &channel, Framing framing, const char *name)
+{
+    channel.set_framing(framing);
+    channel.reset_sequence();
+    memset(dispatched, 0, sizeof(dispatched));
+    TypeStats types[STATS_MSG_TYPES] = {}, broken = {};
+    uint32_t injected = 0, skipped = 0;
+    uint64_t payload = 0, wire_bytes = 0, nanos = 0;
+    const unsigned long errors_before = channel.error_count();
+
+    for (const auto &record : capture.records)
+    {
+        std::vector<uint8_t> wire;
+        TypeStats *stats = &broken;
+        if (record.kind == char(CaptureKind::Error))
+        {
+            // a dropped frame was fine on the wire, the receiver was just too slow
+            if (record.bytes.empty() || record.bytes[0] == RX_ERROR_DROPPED)
+            {
+                skipped++;
+                continue;
+            }
+            // anything will do, as long as it is broken
+            const UartMessage filler(0xFF, MsgType::MSG_BEGIN_KEYS);
+            wire = channel.encode((const uint8_t *)&filler, sizeof(filler));
+            wire[wire.size() / 2] ^= 0x01;
+            injected++;
+        }
+        else
+        {
+            wire = channel.encode(record.bytes.data(), record.bytes.size());
+            stats = &types[TransportStats::type_of(record.bytes.data(), record.bytes.size())];
+            payload += record.bytes.size();
+        }
+
+        channel.start_receiving();
+        Serial.rx.assign(wire.begin(), wire.end());
+        const auto start = std::chrono::steady_clock::now();
+        while (Serial.available() > 0)
+            channel.loop();
+        // process the frames left in the receive queue
+        for (int idx = 0; idx < RX_QUEUE_FRAMES; ++idx)
+            channel.loop();
+        const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        stats->frames++;
+        stats->bytes += record.bytes.size();
+        stats->wire += wire.size();
+        stats->nanos += elapsed;
+        wire_bytes += wire.size();
+        nanos += elapsed;
+    }
+
+    const double wire_millis = wire_bytes * 10 * 1000.0 / capture.baud_rate;
+    const double span_millis = capture.records.size() < 2 ? 0 : uint32_t(capture.records.back().stamp - capture.records.front().stamp) / 1000.0;
+    printf("%-7s payload=%6lu bytes, wire=%6lu bytes (x%.2f), %.1f ms @ %lu baud in %.1f ms (bus %.1f%%), decode=%.2f ns/byte\n",
+           name, (unsigned long)payload, (unsigned long)wire_bytes, payload ? double(wire_bytes) / payload : 0.0,
+           wire_millis, (unsigned long)capture.baud_rate, span_millis, span_millis > 0 ? 100.0 * wire_millis / span_millis : 0.0,
+           wire_bytes ? double(nanos) / wire_bytes : 0.0);
+    printf("        errors: injected=%u detected=%lu (not replayed: %u)\n",
+           injected, channel.error_count() - errors_before, skipped);
+    printf("        %-8s %7s %8s %8s %10s %10s\n", "type", "frames", "bytes", "wire", "ns/frame", "dispatched");
+    for (uint8_t type = 0; type < STATS_MSG_TYPES; ++type)
+    {
+        const auto &stats = types[type];
+        if (stats.frames == 0 && dispatched[type] == 0)
+            continue;
+        printf("        %-8s %7u %8u %8u %10.0f %10u\n", type == STATS_MSG_TYPES - 1 ? "other" : type_name(type),
+               stats.frames, stats.bytes, stats.wire, stats.frames ? double(stats.nanos) / stats.frames : 0.0, dispatched[type]);
+    }
+    if (broken.frames > 0)
+        printf("        %-8s %7u %8s %8u %10.0f\n", "broken", broken.frames, "-", broken.wire, double(broken.nanos) / broken.frames);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    const char *framing = nullptr;
+    int slave_id = 0;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        if (strcmp(argv[idx], "--framing") == 0 && idx + 1 < argc)
+            framing = argv[++idx];
+        else if (strcmp(argv[idx], "--slave") == 0 && idx + 1 < argc)
+            slave_id = atoi(argv[++idx]);
+        else
+            path = argv[idx];
+    }
+    if (path == nullptr)
+    {
+        fprintf(stderr, "usage: %s [--framing nibble|cobs|both] [--slave <id>] capture.log\n", argv[0]);
+        return 1;
+    }
+
+    Capture capture;
+    if (!read_capture(path, capture))
+        return 1;
+    printf("%s: %zu records, %lu baud, %s\n", path, capture.records.size(), (unsigned long)capture.baud_rate,
+           capture.framing == Framing::Cobs ? "cobs" : "nibble");
+
+    ReplayChannel channel(slave_id, gate, buffer);
+    channel.set_dispatch(countTable);
+    channel.setup();
+
+    const bool both = framing && strcmp(framing, "both") == 0;
+    if (both || (framing ? strcmp(framing, "nibble") == 0 : capture.framing == Framing::Nibble))
+        replay(capture, channel, Framing::Nibble, "nibble");
+    if (both || (framing ? strcmp(framing, "cobs") == 0 : capture.framing == Framing::Cobs))
+        replay(capture, channel, Framing::Cobs, "cobs");
+    return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Arduino.h"
+
+/**
+ * The led strip of a simulated node: the colors go nowhere (and take no time).
+ */
+typedef struct rgb_color
+{
+    uint8_t red, green, blue;
+    rgb_color() {}
+    rgb_color(uint8_t r, uint8_t g, uint8_t b) : red(r), green(g), blue(b) {}
+} rgb_color;
+
+template <uint8_t dataPin, uint8_t clockPin>
+class APA102
+{
+public:
+    void startFrame() {}
+    void sendColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t brightness = 31) {}
+    void sendColor(const rgb_color &color, uint8_t brightness = 31) {}
+    void endFrame(uint16_t count) {}
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+/**
+ * Arduino API of a simulated node (see node.cpp): the clock, the UART and the pins belong to the node
+ * and are served by the virtual bus (see sim.h).
+ *
+ * Same as tools/host/Arduino.h otherwise: only what is used by the shared code is provided.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <type_traits>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void *const *>(addr))
+#define vsnprintf_P vsnprintf
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+// the master polls the FIFO of the ESP8266, the slave (an AVR) has the data register and the shift register
+#ifdef MASTER_MODE
+#define UART_TX_FIFO_SIZE 128
+#else
+#define UART_TX_FIFO_SIZE 2
+#endif
+
+template <class A, class B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+template <class A, class B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+
+// the sketch
+void setup();
+void loop();
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+/**
+ * The UART of the node, on the virtual bus.
+ */
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    size_t write(uint8_t value);
+    int available();
+    int availableForWrite();
+    int read();
+    // note: the UART is polled for being done, see SerialPort::tx_complete
+    void flush() {}
+};
+
+extern HardwareSerial Serial;
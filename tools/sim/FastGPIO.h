@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Arduino.h"
+
+/**
+ * FastGPIO of a simulated node: the same pins as digitalWrite/digitalRead (see node.cpp).
+ */
+namespace FastGPIO
+{
+    template <uint8_t pin>
+    class Pin
+    {
+    public:
+        static void setOutputValue(bool value) { digitalWrite(pin, value); }
+        static bool isInputHigh() { return digitalRead(pin) == HIGH; }
+        static bool isOutputValueHigh() { return digitalRead(pin) == HIGH; }
+    };
+}
@@ -0,0 +1,546 @@
+/**
+ * Host simulation of a whole clock: the master and up to MAX_SLAVES slaves on a virtual RS485 bus, every slave
+ * runs the real slave code (slave.cpp: Channel, InteropRS485, StepExecutors, Stepper and the listeners).
+ *
+ * Use it as a regression gate for transport and executor changes: it reports per minute update the time from
+ * the TrackTimeRequest until the last handle arrived, the frames per second and the bus utilisation.
+ *
+ * How:
+ *  - the slave code is built as a shared library, every slave loads its own copy (so it has its own globals),
+ *  - every node (the master included, see master.cpp) runs as a coroutine with its own clock: only the Arduino calls
+ *    take time (see SimCosts and node.cpp), the node with the earliest clock runs next and it gives way once
+ *    it is QUANTUM_MICROS ahead of the others,
+ *  - a written byte is on the bus from when the UART gets to it until it left at the baud rate, every other node
+ *    receives it once its clock passed the end. Bytes of nodes sending at the same time are garbled (a collision),
+ *    as are the bytes of a node at another baud rate or the ones still leaving when the driver was turned off,
+ *  - the sync line goes around: master -> S0 -> S1 -> ... -> master,
+ *  - the handles are moved by the step pulses and find the magnet, see the motor model in node.cpp.
+ *
+ * Note: the slave on the host is polling its Serial (not the RX interrupt of the AVR), a received byte is charged
+ * when it is read.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -fPIC -shared -fvisibility=hidden -Wl,-Bsymbolic -Itools/sim \
+ *       -Icomponents/oclock -Icomponents/oclock/slave -include Arduino.h \
+ *       tools/sim/node.cpp components/oclock/slave/slave.cpp components/oclock/slave/steps_executor.cpp \
+ *       components/oclock/slave/leds.cpp components/oclock/slave/log.cpp components/oclock/keys.cpp \
+ *       components/oclock/channel.cpp components/oclock/hal.cpp components/oclock/stats.cpp \
+ *       components/oclock/crc.cpp -o /tmp/oclock_slave.so
+ *   g++ -std=gnu++17 -O2 -DMASTER_MODE -Itools/sim -Icomponents/oclock -include Arduino.h \
+ *       tools/sim/bus.cpp tools/sim/master.cpp tools/sim/node.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/capture.cpp \
+ *       components/oclock/crc.cpp components/oclock/slave/log.cpp -ldl -o /tmp/oclock_sim
+ *   /tmp/oclock_sim [options]
+ *
+ * Options:
+ *   --slaves <n>       number of slaves (default: DEFAULT_SLAVES, at most MAX_SLAVES)
+ *   --baud <rate>      baud rate after the init (default: 57600)
+ *   --minutes <n>      number of minute updates (default: 3)
+ *   --keys <n>         keys per handle (default: 6)
+ *   --seed <n>         of the keys and the positions of the handles (default: 42)
+ *   --nibble           no COBS framing
+ *   --reliable         sequence numbers and a MSG_SEQ_CHECK after the upload
+ *   --legacy-broadcast broadcasts to LEGACY_ALL_SLAVES (so at most 16 slaves), see Feature::Broadcast
+ *   --slotted          poll the positions with slotted responses (see poll_destination) instead of MSG_STATUS
+ *   --slave <path>     the shared library of the slave (default: /tmp/oclock_slave.so)
+ */
+#include "sim.h"
+#include "stats.h"
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define STACK_SIZE (256 * 1024)
+// how far a node may run ahead of the slowest one, less than a byte on the wire
+#define QUANTUM_MICROS 20
+// the run is stopped after this much simulated time
+#define LIMIT_MICROS (600 * 1000000ULL)
+// a garbled byte, see Bus::write
+#define GARBLE 0x5A
+// the log is cleaned up every ... rounds
+#define PRUNE_ROUNDS 4096
+#define DEFAULT_SLAVES MAX_SLAVES
+
+// an AVR at 16 MHz
+const SimCosts SLAVE_COSTS = {4, 12, 24};
+// an ESP8266 at 80 MHz, with the other components in the loop
+const SimCosts MASTER_COSTS = {1, 2, 100};
+
+SimOptions simOptions = {DEFAULT_SLAVES, 57600, 3, 6, 42, false, false, 2000, false, false};
+
+struct Transmission
+{
+    uint64_t start, end;
+    int sender;
+    uint32_t baud_rate;
+    uint8_t value;
+    bool garbled;
+};
+
+class Bus;
+
+class Node final : public SimNode
+{
+public:
+    Bus &bus;
+    const int index;
+    std::string name;
+    ucontext_t context;
+    std::vector<char> stack;
+    SimMainFunc main{nullptr};
+    SimProbeFunc probe{nullptr};
+    // may run until
+    uint64_t horizon{0};
+
+    uint32_t baud_rate{0};
+    uint32_t fifo_size;
+    // the last written byte left
+    uint64_t tx_free_at{0};
+    // the next transmission to receive (see Bus::log)
+    uint64_t cursor{0};
+    std::deque<uint8_t> rx;
+    bool driver{false};
+    bool sync_high{false};
+
+    Node(Bus &bus, int index, const char *name, const SimCosts &costs, uint32_t fifo_size)
+        : bus(bus), index(index), name(name), stack(STACK_SIZE), fifo_size(fifo_size)
+    {
+        this->costs = costs;
+    }
+
+    uint64_t byte_micros() const { return (10 * 1000000ULL + baud_rate - 1) / baud_rate; }
+
+    void charge(uint32_t micros) override;
+    void serial_begin(uint32_t baud) override { baud_rate = baud; }
+    int serial_available() override;
+    int serial_read() override;
+    void serial_write(uint8_t value) override;
+    int serial_available_for_write() override;
+    void set_driver(bool enabled) override;
+    void set_sync_out(bool high) override { sync_high = high; }
+    bool sync_in() override;
+    void stepped(uint8_t handle, int16_t position) override;
+
+    void receive();
+};
+
+struct Counters
+{
+    uint64_t at{0};
+    uint64_t busy{0};
+    uint32_t bytes{0};
+    uint32_t tx_frames{0};
+    uint32_t rx_frames{0};
+};
+
+class Bus
+{
+public:
+    std::vector<Node *> nodes;
+    ucontext_t scheduler;
+    Node *current{nullptr};
+    bool finished{false};
+
+    // every transmission not yet received by every node, log[0] is transmission number 'first'
+    std::deque<Transmission> log;
+    uint64_t first{0};
+    uint64_t busyUntil{0};
+
+    Counters counters;
+    uint32_t collisions{0}, garbled{0}, cut{0};
+    uint64_t lastStep{0};
+
+    Counters phases[4];
+    struct Minute
+    {
+        double poll, upload, arrived, done, fps, upload_utilisation, utilisation;
+        uint32_t frames;
+    };
+    std::vector<Minute> minutes;
+
+    uint64_t end() const { return first + log.size(); }
+    Transmission &at(uint64_t number) { return log[number - first]; }
+
+    Node &previous(const Node &node) { return *nodes[(node.index + nodes.size() - 1) % nodes.size()]; }
+
+    void write(Node &sender, uint8_t value, uint64_t start)
+    {
+        Transmission tx = {start, start + sender.byte_micros(), sender.index, sender.baud_rate, value, false};
+        for (uint64_t number = end(); number > first; --number)
+        {
+            auto &other = at(number - 1);
+            if (other.end <= tx.start)
+                break;
+            if (other.sender == tx.sender)
+                continue;
+            if (!other.garbled)
+                garbled++;
+            other.garbled = tx.garbled = true;
+            collisions++;
+        }
+        if (tx.garbled)
+            garbled++;
+        log.push_back(tx);
+
+        counters.bytes++;
+        if (tx.end > busyUntil)
+        {
+            counters.busy += tx.end - (tx.start > busyUntil ? tx.start : busyUntil);
+            busyUntil = tx.end;
+        }
+    }
+
+    // the bytes of the sender still leaving
+    void cut_off(const Node &sender, uint64_t now)
+    {
+        for (uint64_t number = end(); number > first; --number)
+        {
+            auto &tx = at(number - 1);
+            if (tx.end <= now)
+                break;
+            if (tx.sender != sender.index || tx.garbled)
+                continue;
+            tx.garbled = true;
+            cut++;
+            garbled++;
+        }
+    }
+
+    void prune()
+    {
+        uint64_t oldest = end();
+        for (auto *node : nodes)
+            if (node->cursor < oldest)
+                oldest = node->cursor;
+        while (first < oldest)
+        {
+            log.pop_front();
+            first++;
+        }
+    }
+
+    static void run_current();
+
+    void run(uint64_t limit)
+    {
+        for (auto *node : nodes)
+        {
+            getcontext(&node->context);
+            node->context.uc_stack.ss_sp = node->stack.data();
+            node->context.uc_stack.ss_size = node->stack.size();
+            node->context.uc_link = &scheduler;
+            makecontext(&node->context, run_current, 0);
+        }
+
+        uint32_t rounds = 0;
+        while (!finished)
+        {
+            // the earliest runs until it is ahead of the second earliest
+            Node *earliest = nullptr;
+            uint64_t second = UINT64_MAX;
+            for (auto *node : nodes)
+            {
+                if (earliest == nullptr || node->now < earliest->now)
+                {
+                    if (earliest)
+                        second = earliest->now;
+                    earliest = node;
+                }
+                else if (node->now < second)
+                    second = node->now;
+            }
+            if (earliest->now > limit)
+            {
+                printf("stopped after %.1f s (simulated)\n", earliest->now / 1e6);
+                return;
+            }
+            earliest->horizon = (second == UINT64_MAX ? earliest->now : second) + QUANTUM_MICROS;
+            current = earliest;
+            swapcontext(&scheduler, &earliest->context);
+            if (++rounds % PRUNE_ROUNDS == 0)
+                prune();
+        }
+    }
+
+    SimProbe probe_slaves(uint32_t &rx_errors, int &active)
+    {
+        SimProbe sum = {};
+        rx_errors = 0;
+        active = 0;
+        for (auto *node : nodes)
+        {
+            if (node->probe == nullptr)
+                continue;
+            SimProbe probe = {};
+            node->probe(&probe);
+            sum.rx_frames += probe.rx_frames;
+            rx_errors += probe.rx_errors;
+            active += probe.active;
+        }
+        return sum;
+    }
+} bus;
+
+void Bus::run_current()
+{
+    bus.current->main();
+}
+
+void Node::charge(uint32_t micros)
+{
+    now += micros;
+    if (now > horizon)
+        swapcontext(&context, &bus.scheduler);
+}
+
+void Node::receive()
+{
+    while (cursor < bus.end())
+    {
+        const auto &tx = bus.at(cursor);
+        if (tx.end > now)
+            break;
+        cursor++;
+        // note: we do not hear ourselves
+        if (tx.sender == index)
+            continue;
+        rx.push_back(tx.garbled || tx.baud_rate != baud_rate ? tx.value ^ GARBLE : tx.value);
+    }
+}
+
+int Node::serial_available()
+{
+    receive();
+    return rx.size();
+}
+
+int Node::serial_read()
+{
+    receive();
+    if (rx.empty())
+        return -1;
+    const int value = rx.front();
+    rx.pop_front();
+    return value;
+}
+
+int Node::serial_available_for_write()
+{
+    if (tx_free_at <= now)
+        return fifo_size;
+    const uint64_t queued = (tx_free_at - now + byte_micros() - 1) / byte_micros();
+    return queued >= fifo_size ? 0 : fifo_size - queued;
+}
+
+void Node::serial_write(uint8_t value)
+{
+    // like the UART: wait for room
+    while (serial_available_for_write() == 0)
+        charge(tx_free_at - now - (fifo_size - 1) * byte_micros());
+    const uint64_t start = tx_free_at > now ? tx_free_at : now;
+    tx_free_at = start + byte_micros();
+    if (driver)
+        bus.write(*this, value, start);
+}
+
+void Node::set_driver(bool enabled)
+{
+    if (driver && !enabled)
+        bus.cut_off(*this, now);
+    driver = enabled;
+}
+
+bool Node::sync_in()
+{
+    return bus.previous(*this).sync_high;
+}
+
+void Node::stepped(uint8_t handle, int16_t position)
+{
+    if (now > bus.lastStep)
+        bus.lastStep = now;
+}
+
+static Counters snapshot(uint32_t tx_frames)
+{
+    Counters counters = bus.counters;
+    counters.at = bus.current->now;
+    counters.tx_frames = tx_frames;
+    counters.rx_frames = transportStats.rx_frames();
+    return counters;
+}
+
+void sim_phase(SimPhase phase, uint32_t tx_frames)
+{
+    bus.phases[int(phase)] = snapshot(tx_frames);
+    if (phase != SimPhase::Done)
+        return;
+
+    const auto &request = bus.phases[int(SimPhase::Request)];
+    const auto &polled = bus.phases[int(SimPhase::Polled)];
+    const auto &uploaded = bus.phases[int(SimPhase::Uploaded)];
+    const auto &done = bus.phases[int(SimPhase::Done)];
+
+    Bus::Minute minute;
+    const uint64_t upload = uploaded.at - polled.at;
+    const uint64_t cycle = done.at - request.at;
+    minute.poll = (polled.at - request.at) / 1000.0;
+    minute.upload = upload / 1000.0;
+    minute.arrived = bus.lastStep > polled.at ? (bus.lastStep - request.at) / 1000.0 : 0;
+    minute.done = cycle / 1000.0;
+    minute.frames = uploaded.tx_frames - polled.tx_frames;
+    minute.fps = upload ? minute.frames * 1e6 / upload : 0;
+    minute.upload_utilisation = upload ? 100.0 * (uploaded.busy - polled.busy) / upload : 0;
+    // every frame on the bus: the ones of the master and the ones of the slaves (the master hears them all)
+    minute.utilisation = cycle ? 100.0 * (done.busy - request.busy) / cycle : 0;
+    bus.minutes.push_back(minute);
+
+    uint32_t rx_errors;
+    int active;
+    bus.probe_slaves(rx_errors, active);
+    printf("minute %2zu: poll %6.1f ms, upload %6.1f ms (%3u frames, %5.0f frames/s, bus %5.1f%%), "
+           "arrived %7.1f ms, done %7.1f ms (bus %4.1f%%, %u frames/s)%s\n",
+           bus.minutes.size(), minute.poll, minute.upload, minute.frames, minute.fps, minute.upload_utilisation,
+           minute.arrived, minute.done, minute.utilisation,
+           unsigned(cycle ? ((done.tx_frames - request.tx_frames) + (done.rx_frames - request.rx_frames)) * 1e6 / cycle : 0),
+           active ? " (slaves still active!)" : "");
+}
+
+void sim_finish()
+{
+    bus.finished = true;
+    swapcontext(&bus.current->context, &bus.scheduler);
+}
+
+static bool load_slave(Node &node, const char *path, uint32_t seed)
+{
+    // dlopen only loads a library once, so every slave gets its own copy
+    char copy[128];
+    snprintf(copy, sizeof(copy), "/tmp/oclock_sim.%d.%d.so", int(getpid()), node.index);
+    FILE *in = fopen(path, "rb");
+    if (in == nullptr)
+    {
+        perror(path);
+        return false;
+    }
+    FILE *out = fopen(copy, "wb");
+    char buffer[1 << 16];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, length, out);
+    fclose(in);
+    fclose(out);
+
+    void *handle = dlopen(copy, RTLD_NOW | RTLD_LOCAL);
+    unlink(copy);
+    if (handle == nullptr)
+    {
+        fprintf(stderr, "%s\n", dlerror());
+        return false;
+    }
+    auto attach = reinterpret_cast<SimAttachFunc>(dlsym(handle, "sim_attach"));
+    node.main = reinterpret_cast<SimMainFunc>(dlsym(handle, "sim_main"));
+    node.probe = reinterpret_cast<SimProbeFunc>(dlsym(handle, "sim_probe"));
+    if (!attach || !node.main || !node.probe)
+    {
+        fprintf(stderr, "%s: not a slave of the simulation\n", path);
+        return false;
+    }
+    attach(&node, seed);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *slave = "/tmp/oclock_slave.so";
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const bool value = idx + 1 < argc;
+        if (strcmp(argv[idx], "--slaves") == 0 && value)
+            simOptions.slaves = atoi(argv[++idx]);
+        else if (strcmp(argv[idx], "--baud") == 0 && value)
+            simOptions.baud_rate = atol(argv[++idx]);
+        else if (strcmp(argv[idx], "--minutes") == 0 && value)
+            simOptions.minutes = atoi(argv[++idx]);
+        else if (strcmp(argv[idx], "--keys") == 0 && value)
+            simOptions.keys = atoi(argv[++idx]);
+        else if (strcmp(argv[idx], "--seed") == 0 && value)
+            simOptions.seed = atol(argv[++idx]);
+        else if (strcmp(argv[idx], "--nibble") == 0)
+            simOptions.nibble = true;
+        else if (strcmp(argv[idx], "--legacy-broadcast") == 0)
+            simOptions.legacy_broadcast = true;
+        else if (strcmp(argv[idx], "--reliable") == 0)
+            simOptions.reliable = true;
+        else if (strcmp(argv[idx], "--slotted") == 0)
+            simOptions.slotted = true;
+        else if (strcmp(argv[idx], "--slave") == 0 && value)
+            slave = argv[++idx];
+        else
+        {
+            fprintf(stderr, "usage: %s [--slaves <n>] [--baud <rate>] [--minutes <n>] [--keys <n>] [--seed <n>] "
+                            "[--nibble] [--reliable] [--legacy-broadcast] [--slotted] [--slave <path>]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (simOptions.slaves < 1 || simOptions.slaves > MAX_SLAVES)
+    {
+        fprintf(stderr, "--slaves: 1..%d\n", MAX_SLAVES);
+        return 1;
+    }
+
+    auto *master = new Node(bus, 0, "master", MASTER_COSTS, UART_TX_FIFO_SIZE);
+    master->main = sim_main;
+    sim_attach(master, simOptions.seed);
+    bus.nodes.push_back(master);
+    for (int idx = 0; idx < simOptions.slaves; ++idx)
+    {
+        // "S" and any int
+        char name[12];
+        snprintf(name, sizeof(name), "S%d", idx);
+        // see UART_TX_FIFO_SIZE of the slave
+        auto *node = new Node(bus, idx + 1, name, SLAVE_COSTS, 2);
+        bus.nodes.push_back(node);
+        if (!load_slave(*node, slave, simOptions.seed + idx + 1))
+            return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    bus.run(LIMIT_MICROS);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t rx_errors;
+    int active;
+    const SimProbe slaves = bus.probe_slaves(rx_errors, active);
+    if (bus.minutes.empty())
+    {
+        printf("no minute update done, the bus never got ready\n");
+        return 1;
+    }
+    Bus::Minute sum = {}, worst = {};
+    for (const auto &minute : bus.minutes)
+    {
+        sum.poll += minute.poll;
+        worst.poll = max(worst.poll, minute.poll);
+        sum.upload += minute.upload;
+        sum.arrived += minute.arrived;
+        sum.fps += minute.fps;
+        sum.upload_utilisation += minute.upload_utilisation;
+        worst.arrived = max(worst.arrived, minute.arrived);
+    }
+    const double count = bus.minutes.size();
+    printf("summary: %zu minutes, poll avg %.1f max %.1f ms, upload avg %.1f ms, %.0f frames/s, bus %.1f%%, arrived avg %.1f max %.1f ms\n",
+           bus.minutes.size(), sum.poll / count, worst.poll, sum.upload / count, sum.fps / count, sum.upload_utilisation / count,
+           sum.arrived / count, worst.arrived);
+    printf("bus: %u bytes, %u collisions, %u garbled (%u cut off by the driver), slaves received %u frames, %u errors\n",
+           bus.counters.bytes, bus.collisions, bus.garbled, bus.cut, slaves.rx_frames, rx_errors);
+    printf("simulated %.1f s in %.1f s\n", bus.nodes[0]->now / 1e6, seconds);
+    return rx_errors == 0 && bus.collisions == 0 ? 0 : 2;
+}
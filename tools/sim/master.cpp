@@ -0,0 +1,366 @@
+/**
+ * The master of the simulation: the bus side of master.cpp (the init handshake, the serving and the broadcasts)
+ * without esphome, driving minute updates the way TrackTimeRequest does:
+ *
+ *  - the positions are polled (MSG_STATUS, passed along the chain of slaves, or with --slotted a MSG_POS_REQUEST
+ *    to the broadcast address that every slave answers in its own slot),
+ *  - the keys are uploaded: MSG_BEGIN_KEYS, the keys of every handle and MSG_END_KEYS (then MSG_SEQ_CHECK when reliable),
+ *  - MSG_WAIT_FOR_ANIMATION comes back once every slave executed its keys.
+ *
+ * The animations themselves are planned on the ESP8266 only (see animation.cpp), so the keys are generated:
+ * a ghost delay depending on the column of the handle followed by moves of random steps, speed and direction
+ * (the same for every run with the same seed).
+ */
+// note: interop.h expects the master to have included it already
+#include <vector>
+#include "interop.h"
+#include "interop.keys.h"
+#include "stats.h"
+#include "sim.h"
+
+// see Master::loop
+#define GAP_MILLIS 200
+// waiting for the terminal reply of a broadcast, per 8 slaves (the position poll passes every slave)
+#define REPLY_TIMEOUT_MILLIS 2000
+// waiting for the last slave to report its animation done
+#define ANIMATION_TIMEOUT_MILLIS 60000
+// see Sync::write
+#define SYNC_SETTLE_MILLIS 30
+// the ESP8266 connects to the WiFi first, by then the slaves homed their handles (see PreMainMode), otherwise
+// a slave done before the one in front of it would see its sync line still high and reset itself
+#define BOOT_MILLIS 15000
+
+class SimGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override { pinMode(SIM_MASTER_DE_PIN, OUTPUT); }
+    void start_receiving() override { digitalWrite(SIM_MASTER_DE_PIN, LOW); }
+    void start_transmitting() override { digitalWrite(SIM_MASTER_DE_PIN, HIGH); }
+};
+
+byte receiverBufferBytes[RX_QUEUE_SIZE];
+auto receiverBuffer = Buffer(receiverBufferBytes, RX_QUEUE_SIZE);
+SimGate gate;
+InteropRS485 uart(0xFF, gate, receiverBuffer);
+
+const uint8_t speed_map[8] = {1, 2, 4, 8, 12, 16, 32, 64};
+
+int slaveIdCounter = -2;
+uint16_t busFeatures = 0;
+
+enum class Phase
+{
+    Accepting,
+    Idle,
+    Polling,
+    Uploading,
+    Checking,
+    Waiting,
+    Finished,
+};
+Phase phase = Phase::Accepting;
+Millis phaseStart = 0;
+int minute = 0;
+// the terminal reply (to 0xFF) of the current broadcast is in
+bool replied = false;
+uint32_t unexpected = 0;
+// see poll_destination
+SlottedPoll slottedPoll;
+
+static void sync_write(bool high)
+{
+    digitalWrite(SIM_MASTER_SYNC_OUT_PIN, high ? HIGH : LOW);
+    delay(SYNC_SETTLE_MILLIS);
+}
+
+static bool sync_read()
+{
+    return digitalRead(SIM_MASTER_SYNC_IN_PIN) == HIGH;
+}
+
+static void change_to(Phase value)
+{
+    phase = value;
+    phaseStart = millis();
+    replied = false;
+}
+
+// see use_slotted_responses and poll_destination in master.cpp
+static bool use_slotted_responses()
+{
+    return simOptions.slotted && (busFeatures & FEATURE_BIT(Feature::SlottedResponses)) &&
+           (Broadcast::is_wide() || slaveIdCounter <= LEGACY_ALL_SLAVES);
+}
+
+static uint8_t poll_destination(byte response_length)
+{
+    if (!use_slotted_responses())
+        return 0;
+    return slottedPoll.arm(uart, response_length, slaveIdCounter, millis());
+}
+
+bool on_log(const UartMessage *msg)
+{
+    // the logs of the slaves are not shown
+    return true;
+}
+
+bool on_reply(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF)
+        replied = true;
+    return true;
+}
+
+// see on_position in master.cpp
+bool on_position(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF && slottedPoll.last_response())
+        replied = true;
+    return true;
+}
+
+bool on_sequence_check(const UartMessage *msg)
+{
+    if (msg->getDstId() == 0xFF)
+    {
+        uart.resend_missing(reinterpret_cast<const UartSeqCheckMessage *>(msg));
+        replied = true;
+    }
+    return true;
+}
+
+bool on_unexpected(const UartMessage *msg)
+{
+    unexpected++;
+    return false;
+}
+
+constexpr MessageRoute servingRoutes[] = {
+    {MSG_LOG, on_log},
+    {MSG_STATUS, on_reply},
+    {MSG_POS_REQUEST, on_position},
+    {MSG_SEQ_CHECK, on_sequence_check},
+    {MSG_WAIT_FOR_ANIMATION, on_reply},
+};
+constexpr DispatchTable servingTable PROGMEM = DispatchTable::make(servingRoutes, on_unexpected);
+
+// see on_id_accept in master.cpp
+bool on_id_accept(const UartMessage *msg)
+{
+    if (!sync_read())
+        // still waiting for some slaves
+        return true;
+
+    auto acceptMsg = reinterpret_cast<const UartAcceptMessage *>(msg);
+    slaveIdCounter = acceptMsg->getAssignedId();
+    const int length = uart.dispatch_length();
+    const bool cobs = !simOptions.nibble && (acceptMsg->framings_of(length) & SUPPORTED_FRAMINGS & FRAMING_BIT(Framing::Cobs));
+    const Framing framing = cobs ? Framing::Cobs : Framing::Nibble;
+    const uint8_t protocol = acceptMsg->protocol_of(length);
+    busFeatures = acceptMsg->features_of(length) & SUPPORTED_FEATURES;
+    if (simOptions.legacy_broadcast)
+        busFeatures &= ~FEATURE_BIT(Feature::Broadcast);
+    uart.set_credits(acceptMsg->rx_frames_of(length), acceptMsg->frame_micros_of(length));
+
+    // the handles start where the slaves put them by default (see PreMainMode)
+    for (int id = 0; id < slaveIdCounter; id += 2)
+        uart.send(UartSlaveConfigRequest(id, 0, 0, NUMBER_OF_STEPS / 2, 0));
+
+    sync_write(false);
+    delay(100);
+    uart.send(UartDoneMessage(-1, slaveIdCounter, simOptions.baud_rate, framing, protocol, busFeatures));
+    uart.flush();
+    // every slave homes its handles first
+    while (sync_read())
+        delay(200);
+
+    delay(500);
+    uart.upgrade_baud_rate(simOptions.baud_rate);
+    uart.set_framing(framing);
+    uart.set_broadcast(busFeatures & FEATURE_BIT(Feature::Broadcast));
+    uart.set_reliable(simOptions.reliable && (busFeatures & FEATURE_BIT(Feature::Reliable)));
+    delay(100);
+
+    printf("bus: %d slaves, protocol %d, features %04x, %s framing, %ld baud, %s poll\n", slaveIdCounter >> 1, protocol, busFeatures,
+           cobs ? "cobs" : "nibble", long(simOptions.baud_rate), use_slotted_responses() ? "slotted" : "chained");
+    if (simOptions.slotted && !use_slotted_responses())
+        printf("bus: slotted responses off, not supported or %d slaves with the legacy broadcast address\n", slaveIdCounter >> 1);
+    uart.set_dispatch(servingTable);
+    uart.start_receiving();
+    change_to(Phase::Idle);
+    return true;
+}
+
+constexpr MessageRoute acceptingRoutes[] = {
+    {MSG_LOG, on_log},
+    {MSG_ID_ACCEPT, on_id_accept},
+};
+constexpr DispatchTable acceptingTable PROGMEM = DispatchTable::make(acceptingRoutes);
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(uint32_t max)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 8) % max;
+}
+
+static uint16_t key(bool ghost, bool clockwise, int steps, int speed)
+{
+    InflatedCmdKey key;
+    key.value.ghost = ghost;
+    key.value.clockwise = clockwise;
+    key.value.steps = steps;
+    key.value.speed = speed;
+    return key.raw;
+}
+
+// see AnimationRequest::sendInstructions
+static void upload_keys()
+{
+    const int count = simOptions.keys < MAX_ANIMATION_KEYS ? simOptions.keys : MAX_ANIMATION_KEYS;
+    uart.send(UartMessage(-1, MsgType::MSG_BEGIN_KEYS));
+    for (int handleId = 0; handleId < slaveIdCounter; ++handleId)
+    {
+        uint16_t keys[MAX_ANIMATION_KEYS];
+        // a swipe: the columns start one after the other
+        keys[0] = key(true, false, 10 * ((handleId >> 1) % 8), 3);
+        for (int idx = 1; idx < count; ++idx)
+            keys[idx] = key(false, next_random(2), 20 + next_random(160), 3 + next_random(4));
+
+        for (int sent = 0; sent < count; sent += MAX_ANIMATION_KEYS_PER_MESSAGE)
+        {
+            const int size = count - sent < MAX_ANIMATION_KEYS_PER_MESSAGE ? count - sent : MAX_ANIMATION_KEYS_PER_MESSAGE;
+            UartKeysMessage msg(handleId, size);
+            for (int idx = 0; idx < size; ++idx)
+                msg.set_key(idx, keys[sent + idx]);
+            uart.send(msg);
+        }
+    }
+    uart.send(UartEndKeysMessage(8, 5, speed_map, ~0ULL, 60000));
+}
+
+static void wait_for_animation()
+{
+    uart.send(UartWaitUntilAnimationIsDoneRequest());
+    uart.start_receiving();
+    change_to(Phase::Waiting);
+}
+
+void setup()
+{
+    random_state = simOptions.seed | 1;
+    pinMode(SIM_MASTER_SYNC_IN_PIN, INPUT);
+    pinMode(SIM_MASTER_SYNC_OUT_PIN, OUTPUT);
+    uart.setup();
+    uart.setOwnerId(0xFF);
+
+    delay(BOOT_MILLIS);
+
+    // see MasterLifecycle::change_to_init
+    uart.downgrade_baud_rate();
+    uart.reset_sequence();
+    uart.set_credits(0, 0);
+    sync_write(true);
+    delay(500);
+
+    uart.send(UartMessage(-1, MsgType::MSG_ID_RESET));
+    uart.flush();
+    while (sync_read())
+        delay(200);
+
+    sync_write(true);
+    delay(100);
+
+    uart.set_dispatch(acceptingTable);
+    uart.send(UartAcceptMessage(-1, 0));
+    uart.start_receiving();
+    change_to(Phase::Accepting);
+}
+
+void loop()
+{
+    const Millis now = millis();
+    uart.loop_coalescer(now);
+    if (uart.tx_pending() || uart.turnaround_pending())
+        uart.drain(simOptions.tx_budget);
+    uart.loop();
+
+    const bool timeout = now - phaseStart > Millis(REPLY_TIMEOUT_MILLIS * ((simOptions.slaves + 7) / 8));
+    switch (phase)
+    {
+    case Phase::Accepting:
+    case Phase::Finished:
+        break;
+
+    case Phase::Idle:
+        if (now - phaseStart < GAP_MILLIS)
+            break;
+        if (minute == simOptions.minutes)
+        {
+            sim_finish();
+            change_to(Phase::Finished);
+            break;
+        }
+        minute++;
+        sim_phase(SimPhase::Request, transportStats.tx_frames());
+        if (use_slotted_responses())
+        {
+            // see oclock::poll_positions
+            uart.send(UartPosRequest(false, poll_destination(sizeof(UartPosRequest))));
+        }
+        else
+        {
+            UartStatusMessage msg(false);
+            uart.send_raw(&msg, msg.size());
+        }
+        uart.start_receiving();
+        change_to(Phase::Polling);
+        break;
+
+    case Phase::Polling:
+        if (!replied && !timeout && !slottedPoll.expired(now))
+            break;
+        if (slottedPoll.armed())
+            printf("minute %d: slotted poll: %d response(s) missing\n", minute, slottedPoll.pending);
+        else if (!replied)
+            printf("minute %d: no reply on the position poll\n", minute);
+        slottedPoll.pending = 0;
+        sim_phase(SimPhase::Polled, transportStats.tx_frames());
+        upload_keys();
+        change_to(Phase::Uploading);
+        break;
+
+    case Phase::Uploading:
+        if (uart.tx_pending() || Serial.availableForWrite() < UART_TX_FIFO_SIZE)
+            break;
+        sim_phase(SimPhase::Uploaded, transportStats.tx_frames());
+        if (!uart.is_reliable())
+        {
+            wait_for_animation();
+            break;
+        }
+        // see oclock::queue_sequence_check
+        uart.send_sequence_check();
+        uart.start_receiving();
+        change_to(Phase::Checking);
+        break;
+
+    case Phase::Checking:
+        if (replied || timeout)
+            wait_for_animation();
+        break;
+
+    case Phase::Waiting:
+        // note: the slaves only reply once done
+        if (!replied && now - phaseStart <= ANIMATION_TIMEOUT_MILLIS)
+            break;
+        if (!replied)
+            printf("minute %d: the animation never reported done\n", minute);
+        sim_phase(SimPhase::Done, transportStats.tx_frames());
+        change_to(Phase::Idle);
+        break;
+    }
+}
@@ -0,0 +1,196 @@
+/**
+ * The Arduino API of a simulated node on top of SimNode (see sim.h): compiled into the simulator for the master
+ * (with MASTER_MODE) and into the shared library of the slave.
+ *
+ * Time only passes in the calls to the clock, the UART and delay (see SimCosts), so a node runs as fast as
+ * the host can while its clock stays in step with the others.
+ *
+ * The slave gets a model of its two motors: a step pulse moves the handle one step in the direction of
+ * the direction pin, the magnet pin is low over MAGNET_STEPS steps from position 0.
+ */
+#include "Arduino.h"
+#include "sim.h"
+#include "oclock.h"
+
+#ifndef MASTER_MODE
+#include "pins.h"
+#include "stats.h"
+#include "slave/steps_executor.h"
+
+extern int8_t slaveId;
+#endif
+
+HardwareSerial Serial;
+
+static SimNode *node = nullptr;
+static uint8_t pins[32];
+static uint32_t randomState = 1;
+
+#ifndef MASTER_MODE
+#define MAGNET_STEPS 8
+
+struct Motor
+{
+    uint8_t step_pin, dir_pin, magnet_pin;
+    int16_t position;
+
+    bool at_magnet() const { return position < MAGNET_STEPS; }
+};
+
+static Motor motors[2] = {
+    {MOTOR_A_STEP, MOTOR_A_DIR, SLAVE_POS_A, 0},
+    {MOTOR_B_STEP, MOTOR_B_DIR, SLAVE_POS_B, 0},
+};
+#endif
+
+extern "C" __attribute__((visibility("default"))) void sim_attach(SimNode *attached, uint32_t seed)
+{
+    node = attached;
+    randomState = seed | 1;
+#ifndef MASTER_MODE
+    // the handles are wherever they were left
+    for (auto &motor : motors)
+        motor.position = random(NUMBER_OF_STEPS);
+#endif
+}
+
+extern "C" __attribute__((visibility("default"))) void sim_main()
+{
+    setup();
+    for (;;)
+    {
+        loop();
+        node->charge(node->costs.loop);
+    }
+}
+
+#ifndef MASTER_MODE
+extern "C" __attribute__((visibility("default"))) void sim_probe(SimProbe *probe)
+{
+    probe->slave_id = slaveId;
+    probe->active = StepExecutors::active();
+    probe->rx_frames = transportStats.rx_frames();
+    probe->rx_errors = transportStats.rx_errors();
+    for (int idx = 0; idx < 2; ++idx)
+        probe->positions[idx] = motors[idx].position;
+}
+#endif
+
+unsigned long micros()
+{
+    if (node == nullptr)
+        return 0;
+    node->charge(node->costs.clock_call);
+    return node->now;
+}
+
+unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    node->charge(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    node->charge(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+#ifndef MASTER_MODE
+    // the motors step on a rising edge
+    const uint8_t previous = pins[pin];
+#endif
+    pins[pin] = value;
+#ifdef MASTER_MODE
+    if (pin == SIM_MASTER_SYNC_OUT_PIN)
+        node->set_sync_out(value);
+    else if (pin == SIM_MASTER_DE_PIN)
+        node->set_driver(value);
+#else
+    if (pin == SYNC_OUT_PIN)
+        node->set_sync_out(value);
+    else if (pin == RS485_DE_PIN)
+        node->set_driver(value);
+    for (uint8_t handle = 0; handle < 2; ++handle)
+    {
+        auto &motor = motors[handle];
+        if (pin != motor.step_pin || previous == HIGH || value == LOW)
+            continue;
+        // see Stepper::tryToStep: direction 0 (low) counts up
+        motor.position += pins[motor.dir_pin] == LOW ? 1 : -1;
+        if (motor.position < 0)
+            motor.position += NUMBER_OF_STEPS;
+        else if (motor.position >= NUMBER_OF_STEPS)
+            motor.position -= NUMBER_OF_STEPS;
+        node->stepped(handle, motor.position);
+    }
+#endif
+}
+
+int digitalRead(uint8_t pin)
+{
+#ifdef MASTER_MODE
+    if (pin == SIM_MASTER_SYNC_IN_PIN)
+        return node->sync_in() ? HIGH : LOW;
+#else
+    if (pin == SYNC_IN_PIN)
+        return node->sync_in() ? HIGH : LOW;
+    for (const auto &motor : motors)
+        if (pin == motor.magnet_pin)
+            return motor.at_magnet() ? LOW : HIGH;
+#endif
+    return pins[pin];
+}
+
+int analogRead(uint8_t pin)
+{
+    return random(1024);
+}
+
+// every node has its own (reproducible) sequence
+long random(long max)
+{
+    randomState = randomState * 1103515245 + 12345;
+    return max <= 0 ? 0 : (randomState >> 8) % max;
+}
+
+long random(long min, long max) { return min + random(max - min); }
+
+void randomSeed(unsigned long seed)
+{
+    randomState = seed | 1;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    node->serial_begin(baud);
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+    node->serial_write(value);
+    return 1;
+}
+
+int HardwareSerial::available()
+{
+    return node->serial_available();
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return node->serial_available_for_write();
+}
+
+int HardwareSerial::read()
+{
+    node->charge(node->costs.rx_byte);
+    return node->serial_read();
+}
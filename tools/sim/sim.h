@@ -0,0 +1,128 @@
+#pragma once
+
+/**
+ * The contract between a simulated node (the Arduino API of node.cpp, compiled with the master or the slave code)
+ * and the virtual RS485 bus (bus.cpp). See bus.cpp for how it all fits together.
+ *
+ * Only plain types: every slave is a private copy of a shared library, the bus reaches it through this interface.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the pins of the master (see pins.h, which can not be included with MASTER_MODE on the host)
+#define SIM_MASTER_SYNC_OUT_PIN 12
+#define SIM_MASTER_SYNC_IN_PIN 13
+#define SIM_MASTER_DE_PIN 15
+
+/**
+ * Cost model: the time a node spends, in micros of its own clock. The code itself takes no time on the
+ * simulated clock, only these calls do (an AVR at 16 MHz, an ESP8266 at 80 MHz).
+ */
+struct SimCosts
+{
+    // micros() or millis()
+    uint16_t clock_call;
+    // a received byte (on the slave: the RX interrupt and the decoding)
+    uint16_t rx_byte;
+    // the rest of a round of loop()
+    uint16_t loop;
+};
+
+/**
+ * A node as seen from its Arduino API.
+ */
+class SimNode
+{
+public:
+    virtual ~SimNode() {}
+
+    // the local clock, only moved forward by charge()
+    uint64_t now{0};
+    SimCosts costs{};
+
+    // spend some time, gives way to the other nodes once ahead of them
+    virtual void charge(uint32_t micros) = 0;
+
+    // the UART
+    virtual void serial_begin(uint32_t baud) = 0;
+    virtual int serial_available() = 0;
+    virtual int serial_read() = 0;
+    virtual void serial_write(uint8_t value) = 0;
+    virtual int serial_available_for_write() = 0;
+
+    // the RS485 driver (DE)
+    virtual void set_driver(bool enabled) = 0;
+    // the sync line: ours goes to the next node, we read the one of the previous node
+    virtual void set_sync_out(bool high) = 0;
+    virtual bool sync_in() = 0;
+
+    // a handle moved a step (not ghosting), see the motor model in node.cpp
+    virtual void stepped(uint8_t handle, int16_t position) = 0;
+};
+
+/**
+ * What the bus reads from a slave, see sim_probe.
+ */
+struct SimProbe
+{
+    int8_t slave_id;
+    bool active;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+    int16_t positions[2];
+};
+
+// the entry points of a node (see node.cpp)
+typedef void (*SimAttachFunc)(SimNode *node, uint32_t seed);
+typedef void (*SimMainFunc)();
+typedef void (*SimProbeFunc)(SimProbe *probe);
+
+extern "C"
+{
+    void sim_attach(SimNode *node, uint32_t seed);
+    // setup() and loop() forever
+    void sim_main();
+    void sim_probe(SimProbe *probe);
+}
+
+/**
+ * The phases of a minute update of the simulated master (see master.cpp), the bus takes a snapshot at each of them.
+ */
+enum class SimPhase
+{
+    // a TrackTimeRequest is executed: the positions are polled
+    Request,
+    // the last position is in, the keys are queued
+    Polled,
+    // the last byte of the keys is on the wire
+    Uploaded,
+    // the last slave reported its animation done (MSG_WAIT_FOR_ANIMATION)
+    Done,
+};
+
+/**
+ * The options of a run (see bus.cpp), what the master needs to know.
+ */
+struct SimOptions
+{
+    int slaves;
+    uint32_t baud_rate;
+    int minutes;
+    // per handle, see upload_keys in master.cpp
+    int keys;
+    uint32_t seed;
+    bool nibble;
+    bool reliable;
+    uint32_t tx_budget;
+    // as if a slave runs the legacy firmware, see Feature::Broadcast
+    bool legacy_broadcast;
+    // poll the positions with slotted responses instead of MSG_STATUS along the chain, see poll_destination
+    bool slotted;
+};
+
+// implemented by the bus, only for the master
+extern SimOptions simOptions;
+void sim_phase(SimPhase phase, uint32_t tx_frames);
+// the master did all the minute updates
+void sim_finish();
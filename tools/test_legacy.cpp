@@ -0,0 +1,161 @@
+/**
+ * Host test of the enumeration with firmware from before the negotiation (protocol 1): its MSG_ID_ACCEPT has the
+ * assigned id only and its MSG_ID_DONE the assigned id and the baud rate (see UartAcceptMessage::LEGACY_SIZE and
+ * UartDoneMessage::LEGACY_SIZE). The appended fields must not be read past the end of such a frame: the master
+ * settles on nibble framing, no receive limit and no features, a slave passes on the same.
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/test_legacy.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/test_legacy && /tmp/test_legacy
+ */
+#include <vector>
+#include "interop.h"
+
+class NullGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override {}
+    void start_receiving() override {}
+    void start_transmitting() override {}
+};
+
+byte buffer_bytes[RX_QUEUE_SIZE];
+Buffer buffer(buffer_bytes, RX_QUEUE_SIZE);
+NullGate gate;
+InteropRS485 uart(0, gate, buffer);
+
+// the messages as the legacy firmware sends them, followed by bytes a handler must not read
+struct LegacyAcceptMessage : public UartMessage
+{
+    uint8_t assignedId;
+
+    LegacyAcceptMessage(uint8_t assignedId) : UartMessage(0xFF, MSG_ID_ACCEPT), assignedId(assignedId) {}
+};
+WIRE_MESSAGE(LegacyAcceptMessage, UartAcceptMessage::LEGACY_SIZE);
+
+struct LegacyDoneMessage : public UartMessage
+{
+    uint8_t assignedId;
+    LittleEndian<uint32_t> baud_rate;
+
+    LegacyDoneMessage(uint8_t assignedId, uint32_t baud_rate) : UartMessage(0xFF, MSG_ID_DONE), assignedId(assignedId), baud_rate(baud_rate) {}
+};
+WIRE_MESSAGE(LegacyDoneMessage, UartDoneMessage::LEGACY_SIZE);
+
+// what the handlers of the master (on_id_accept) and the slaves (on_id_accept, on_id_done) read
+struct Seen
+{
+    int accepts, dones;
+    uint8_t framings, rx_frames;
+    uint16_t frame_micros;
+    uint8_t protocol;
+    uint16_t features;
+    UartAcceptMessage passed_on{0, 0};
+    Framing framing;
+    uint32_t baud_rate;
+} seen;
+
+bool on_id_accept(const UartMessage *msg)
+{
+    auto acceptMsg = reinterpret_cast<const UartAcceptMessage *>(msg);
+    const int length = uart.dispatch_length();
+    seen.accepts++;
+    seen.framings = acceptMsg->framings_of(length);
+    seen.rx_frames = acceptMsg->rx_frames_of(length);
+    seen.frame_micros = acceptMsg->frame_micros_of(length);
+    seen.protocol = acceptMsg->protocol_of(length);
+    seen.features = acceptMsg->features_of(length);
+    seen.passed_on = acceptMsg->passed_on(length, 4);
+    return true;
+}
+
+bool on_id_done(const UartMessage *msg)
+{
+    auto doneMsg = reinterpret_cast<const UartDoneMessage *>(msg);
+    const int length = uart.dispatch_length();
+    seen.dones++;
+    seen.framing = doneMsg->framing_of(length);
+    seen.protocol = doneMsg->protocol_of(length);
+    seen.features = doneMsg->features_of(length);
+    seen.baud_rate = doneMsg->baud_rate;
+    return true;
+}
+
+constexpr MessageRoute routes[] = {
+    {MSG_ID_ACCEPT, on_id_accept},
+    {MSG_ID_DONE, on_id_done},
+};
+constexpr DispatchTable table PROGMEM = DispatchTable::make(routes);
+
+template <class M>
+static void receive(const M &msg)
+{
+    seen = Seen();
+    Serial.tx.clear();
+    uart.send(msg);
+    Serial.rx.assign(Serial.tx.begin(), Serial.tx.end());
+    Serial.tx.clear();
+    // leftovers of a longer message in the receive buffer
+    memset(buffer_bytes, 0x5A, sizeof(buffer_bytes));
+    uart.start_receiving();
+    while (Serial.available() > 0)
+        uart.loop();
+    for (int idx = 0; idx < RX_QUEUE_FRAMES; ++idx)
+        uart.loop();
+}
+
+static int failures = 0;
+
+static void expect(const char *name, uint32_t actual, uint32_t expected)
+{
+    printf("%-40s %s (got %u, expected %u)\n", name, actual == expected ? "ok" : "FAILED", actual, expected);
+    if (actual != expected)
+        failures++;
+}
+
+int main()
+{
+    uart.setup();
+    uart.set_dispatch(table);
+
+    receive(LegacyAcceptMessage(4));
+    expect("legacy accept, dispatched", seen.accepts, 1);
+    expect("legacy accept, framings", seen.framings, FRAMING_BIT(Framing::Nibble));
+    expect("legacy accept, rx frames", seen.rx_frames, 0xFF);
+    expect("legacy accept, frame micros", seen.frame_micros, 0);
+    expect("legacy accept, protocol", seen.protocol, LEGACY_PROTOCOL_VERSION);
+    expect("legacy accept, features", seen.features, 0);
+    expect("legacy accept, passed on framings", seen.passed_on.framings, FRAMING_BIT(Framing::Nibble));
+    expect("legacy accept, passed on rx frames", seen.passed_on.rx_frames, RX_QUEUE_FRAMES - 1);
+    expect("legacy accept, passed on frame micros", seen.passed_on.frame_micros.get(), RX_FRAME_MICROS);
+    expect("legacy accept, passed on protocol", seen.passed_on.protocol, LEGACY_PROTOCOL_VERSION);
+    expect("legacy accept, passed on features", seen.passed_on.features.get(), 0);
+
+    receive(UartAcceptMessage(0xFF, 4, SUPPORTED_FRAMINGS, 2, 3000));
+    expect("accept, framings", seen.framings, SUPPORTED_FRAMINGS);
+    expect("accept, rx frames", seen.rx_frames, 2);
+    expect("accept, frame micros", seen.frame_micros, 3000);
+    expect("accept, protocol", seen.protocol, PROTOCOL_VERSION);
+    expect("accept, features", seen.features, SUPPORTED_FEATURES);
+    expect("accept, passed on frame micros", seen.passed_on.frame_micros.get(), 3000);
+    expect("accept, passed on features", seen.passed_on.features.get(), SUPPORTED_FEATURES);
+
+    receive(LegacyDoneMessage(4, 115200));
+    expect("legacy done, dispatched", seen.dones, 1);
+    expect("legacy done, baud rate", seen.baud_rate, 115200);
+    expect("legacy done, framing", uint8_t(seen.framing), uint8_t(Framing::Nibble));
+    expect("legacy done, protocol", seen.protocol, LEGACY_PROTOCOL_VERSION);
+    expect("legacy done, features", seen.features, 0);
+
+    receive(UartDoneMessage(0xFF, 4, 115200, Framing::Cobs, PROTOCOL_VERSION, SUPPORTED_FEATURES));
+    expect("done, framing", uint8_t(seen.framing), uint8_t(Framing::Cobs));
+    expect("done, protocol", seen.protocol, PROTOCOL_VERSION);
+    expect("done, features", seen.features, SUPPORTED_FEATURES);
+
+    printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
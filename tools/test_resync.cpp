@@ -0,0 +1,142 @@
+/**
+ * Host test of the resync after a receive error (see Protocol::error in channel.cpp): the bytes after a COBS
+ * overflow are decoded as a frame right away, but such a speculative frame is only dispatched when it is trusted
+ * (see Protocol::trusted and Channel::plausible): a known type with its length (see wire_length), whatever the checksum.
+ *
+ * Every case feeds a frame that is too long (the overflow) and a tail that is a frame with a valid checksum,
+ * followed by a regular frame that has to get through.
+ *
+ * Build & run (from the root of the repository), add -DCHECKSUM=CHECKSUM_CRC16 for the 16 bit checksum:
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/test_resync.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/test_resync && /tmp/test_resync
+ */
+#include <vector>
+#include "interop.h"
+
+class NullGate : public Gate
+{
+public:
+    void dump_config(const char *tag) override {}
+    void setup() override {}
+    void start_receiving() override {}
+    void start_transmitting() override {}
+};
+
+byte buffer_bytes[RX_QUEUE_SIZE];
+Buffer buffer(buffer_bytes, RX_QUEUE_SIZE);
+NullGate gate;
+InteropRS485 uart(0, gate, buffer);
+
+uint32_t dispatched[MSG_TYPE_COUNT + 1];
+
+bool on_any(const UartMessage *msg)
+{
+    const uint8_t type = uint8_t(msg->getMsgType());
+    dispatched[type < MSG_TYPE_COUNT ? type : MSG_TYPE_COUNT]++;
+    return true;
+}
+
+constexpr MessageRoute routes[] = {
+    {MSG_BRIGHTNESS, on_any},
+};
+constexpr DispatchTable table PROGMEM = DispatchTable::make(routes, on_any);
+
+// the rest of a broken frame as it might be: no known type
+struct Garbage : public UartMessage
+{
+    byte bytes[6] = {0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC};
+
+    Garbage() : UartMessage(0xFF, MsgType(0xEE), ALL_SLAVES) {}
+};
+
+// the rest of a broken frame that starts like a known type, but is longer than that type
+struct Misfit : public UartMessage
+{
+    byte bytes[3] = {0x03, 0x12, 0x34};
+
+    Misfit() : UartMessage(0xFF, MSG_BRIGHTNESS, ALL_SLAVES) {}
+};
+
+template <class M>
+static std::vector<uint8_t> encode(const M &msg)
+{
+    Serial.tx.clear();
+    uart.send(msg);
+    std::vector<uint8_t> wire(Serial.tx.begin(), Serial.tx.end());
+    Serial.tx.clear();
+    return wire;
+}
+
+// a COBS frame that does not fit: the last byte overflows the receive buffer
+static std::vector<uint8_t> overflow()
+{
+    const int length = RX_QUEUE_SIZE / RX_QUEUE_FRAMES + 1;
+    std::vector<uint8_t> wire(1, 0xFF);
+    wire.insert(wire.end(), length, 0x11);
+    return wire;
+}
+
+static uint32_t receive(const std::vector<uint8_t> &wire)
+{
+    for (auto &count : dispatched)
+        count = 0;
+    Serial.rx.assign(wire.begin(), wire.end());
+    uart.start_receiving();
+    while (Serial.available() > 0)
+        uart.loop();
+    for (int idx = 0; idx < RX_QUEUE_FRAMES; ++idx)
+        uart.loop();
+
+    uint32_t total = 0;
+    for (auto count : dispatched)
+        total += count;
+    return total;
+}
+
+static int failures = 0;
+
+static void expect(const char *name, uint32_t actual, uint32_t expected)
+{
+    printf("%-40s %s (dispatched %u, expected %u)\n", name, actual == expected ? "ok" : "FAILED", actual, expected);
+    if (actual != expected)
+        failures++;
+}
+
+int main()
+{
+    uart.setup();
+    uart.set_framing(Framing::Cobs);
+    uart.set_dispatch(table);
+
+    const auto message = encode(UartScaledBrightnessMessage(3));
+    const auto garbage = encode(Garbage());
+    const auto misfit = encode(Misfit());
+    const auto prefix = overflow();
+
+    expect("message", receive(message), 1);
+    expect("garbage (no resync)", receive(garbage), 1);
+
+    auto wire = prefix;
+    wire.insert(wire.end(), garbage.begin(), garbage.end());
+    expect("overflow, garbage tail", receive(wire), 0);
+
+    wire = prefix;
+    wire.insert(wire.end(), garbage.begin(), garbage.end());
+    wire.insert(wire.end(), message.begin(), message.end());
+    expect("overflow, garbage tail, message", receive(wire), 1);
+
+    wire = prefix;
+    wire.insert(wire.end(), misfit.begin(), misfit.end());
+    expect("overflow, known type with wrong length", receive(wire), 0);
+
+    // a message right after the error gets through, with the 8 bit checksum (the default) as well
+    wire = prefix;
+    wire.insert(wire.end(), message.begin(), message.end());
+    expect("overflow, message tail", receive(wire), 1);
+
+    printf("%s (checksum of %d bytes)\n", failures == 0 ? "PASSED" : "FAILED", CHECKSUM_SIZE);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/**
+ * Host test of the receiving side of the reliable mode (see SequenceTracker in interop.h): envelopes in order, a gap
+ * that gets resent and a gap too large for the window, after which nothing given up on may be reported missing
+ * (the master would replay stale envelopes otherwise).
+ *
+ * Build & run (from the root of the repository):
+ *
+ *   g++ -std=gnu++17 -O2 -Itools/host -Icomponents/oclock -include Arduino.h \
+ *       tools/test_sequence.cpp tools/host/host.cpp components/oclock/channel.cpp \
+ *       components/oclock/hal.cpp components/oclock/stats.cpp components/oclock/crc.cpp \
+ *       components/oclock/slave/log.cpp -o /tmp/test_sequence && /tmp/test_sequence
+ */
+#include "interop.h"
+
+static int failures = 0;
+
+static void expect(const char *name, uint32_t actual, uint32_t expected)
+{
+    printf("%-40s %s (got 0x%x, expected 0x%x)\n", name, actual == expected ? "ok" : "FAILED", actual, expected);
+    if (actual != expected)
+        failures++;
+}
+
+int main()
+{
+    SequenceTracker tracker;
+
+    expect("in order", tracker.receive(10, true) && tracker.receive(11, true) && tracker.receive(12, false), true);
+    expect("in order, report", tracker.report(13), 0);
+
+    // 13 lost, 14 deferred until 13 is there
+    expect("gap, deferred", tracker.receive(14, true), false);
+    expect("gap, report", tracker.report(15), 0x3);
+    expect("gap, resent", tracker.receive(13, true), true);
+    expect("gap, deferred resent", tracker.receive(14, true), true);
+    expect("gap, duplicate", tracker.receive(13, true), false);
+    expect("gap, report after", tracker.report(15), 0);
+
+    // a gap that does not fit the window while receiving: the received one is processed right away
+    expect("receive past window", tracker.receive(15 + SEQ_WINDOW, true), true);
+    expect("receive past window, lost", tracker.lost_, 1);
+    expect("receive past window, report", tracker.report(16 + SEQ_WINDOW), 0);
+
+    // a gap that does not fit the window while reporting: nothing before next_seq is missing anymore
+    const uint8_t next = 16 + 3 * SEQ_WINDOW;
+    expect("report past window", tracker.report(next), 0);
+    expect("report past window, lost", tracker.lost_, 2);
+    expect("report past window, again", tracker.report(next), 0);
+    expect("report past window, stale", tracker.receive(next - 1, true), false);
+    expect("report past window, next", tracker.receive(next, true), true);
+
+    // a gap that just fits the window
+    expect("full window, deferred", tracker.receive(next + SEQ_WINDOW, true), false);
+    expect("full window, report", tracker.report(next + SEQ_WINDOW + 1), 0xFFFFFFFF);
+
+    printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}